@@ -275,7 +275,8 @@ EXPORT_SYMBOL(blk_stop_queue);
  *     such activity is cancelled, thus allowing it to release resources
  *     that the callbacks might use. The caller must already have made sure
  *     that its ->make_request_fn will not re-add plugging prior to calling
- *     this function.
+ *     this function. Async writes still held for gathering are handed
+ *     to the elevator rather than left behind.
  *
  *     This function does not cancel any asynchronous activity arising
  *     out of elevator or throttling code. That would require elevaotor_exit()
@@ -286,6 +287,7 @@ void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
 	cancel_delayed_work_sync(&q->delay_work);
+	blk_gather_sync(q);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -439,6 +441,7 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	INIT_LIST_HEAD(&q->flush_queue[1]);
 	INIT_LIST_HEAD(&q->flush_data_in_flight);
 	INIT_DELAYED_WORK(&q->delay_work, blk_delay_work);
+	blk_gather_init(q);
 
 	kobject_init(&q->kobj, &blk_queue_ktype);
 
@@ -1299,7 +1302,11 @@ get_rq:
 		drive_stat_acct(req, 1);
 	} else {
 		spin_lock_irq(q->queue_lock);
-		add_acct_request(q, req, where);
+		if (where == ELEVATOR_INSERT_SORT && blk_gather_request(q, req)) {
+			drive_stat_acct(req, 1);
+		} else {
+			add_acct_request(q, req, where);
+		}
 		__blk_run_queue(q);
 out_unlock:
 		spin_unlock_irq(q->queue_lock);
@@ -2736,7 +2743,7 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 		 */
 		if (rq->cmd_flags & (REQ_FLUSH | REQ_FUA))
 			__elv_add_request(q, rq, ELEVATOR_INSERT_FLUSH);
-		else
+		else if (!blk_gather_request(q, rq))
 			__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
 
 		depth++;
@@ -0,0 +1,167 @@
+/*
+ * Async write gathering ahead of the io scheduler.
+ *
+ * Small random writes often only become contiguous after a few more of
+ * them have been submitted, at which point the elevator has already
+ * dispatched their neighbours. When enabled on a queue, async writes are
+ * held on a per-queue list for at most write_gather_usecs (or until
+ * write_gather_max of them have been collected), then sorted by sector
+ * and inserted with ELEVATOR_INSERT_SORT_MERGE, so that adjacent ones are
+ * merged into larger requests before the elevator schedules them.
+ *
+ * This file is released under the GPLv2.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/list_sort.h>
+
+#include "blk.h"
+
+static int gather_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct request *rqa = container_of(a, struct request, queuelist);
+	struct request *rqb = container_of(b, struct request, queuelist);
+
+	return blk_rq_pos(rqa) > blk_rq_pos(rqb);
+}
+
+/*
+ * Insert all gathered requests into the elevator in sector order.
+ * Must be called with the queue lock held and interrupts disabled.
+ */
+void blk_gather_flush(struct request_queue *q)
+{
+	struct blk_gather_stats *st = &q->gather_stats;
+	struct request_list *rl = &q->rq;
+	int count;
+	struct request *rq;
+	LIST_HEAD(list);
+	u64 now;
+
+	if (list_empty(&q->gather_list))
+		return;
+
+	hrtimer_try_to_cancel(&q->gather_timer);
+
+	now = ktime_to_us(ktime_get());
+	st->flushes++;
+	st->latency_us += q->gather_nr * now - q->gather_stamp_sum;
+
+	list_splice_init(&q->gather_list, &list);
+	q->gather_nr = 0;
+	q->gather_stamp_sum = 0;
+
+	list_sort(NULL, &list, gather_rq_cmp);
+
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+
+		/*
+		 * A request merged on insertion is freed right away,
+		 * which is how merges are counted.
+		 */
+		count = rl->count[BLK_RW_ASYNC];
+		__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+		if (rl->count[BLK_RW_ASYNC] < count)
+			st->merged++;
+	}
+}
+
+/**
+ * blk_gather_request - hold back an async write for gathering
+ * @q:	the queue @rq is being inserted into
+ * @rq:	an accounted request about to be added to the elevator
+ *
+ * Returns true if @rq was taken over by the gather list, in which case
+ * the caller must not insert it. Called with the queue lock held and
+ * interrupts disabled.
+ */
+bool blk_gather_request(struct request_queue *q, struct request *rq)
+{
+	if (!q->gather_usecs || !q->elevator ||
+	    test_bit(QUEUE_FLAG_ELVSWITCH, &q->queue_flags) ||
+	    test_bit(QUEUE_FLAG_DEAD, &q->queue_flags))
+		return false;
+
+	if (rq->cmd_type != REQ_TYPE_FS || rq_is_sync(rq) ||
+	    rq_data_dir(rq) != WRITE || !rq_mergeable(rq) ||
+	    (rq->cmd_flags & (REQ_FLUSH | REQ_FUA | REQ_DISCARD)))
+		return false;
+
+	list_add_tail(&rq->queuelist, &q->gather_list);
+	q->gather_nr++;
+	q->gather_stamp_sum += ktime_to_us(ktime_get());
+	q->gather_stats.gathered++;
+
+	if (q->gather_nr >= q->gather_max) {
+		blk_gather_flush(q);
+		return true;
+	}
+
+	if (q->gather_nr == 1)
+		hrtimer_start(&q->gather_timer,
+			      ns_to_ktime((u64) q->gather_usecs * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+
+	return true;
+}
+
+static void blk_gather_work(struct work_struct *work)
+{
+	struct request_queue *q = container_of(work, struct request_queue,
+					       gather_work);
+
+	spin_lock_irq(q->queue_lock);
+	if (!list_empty(&q->gather_list)) {
+		blk_gather_flush(q);
+		__blk_run_queue(q);
+	}
+	spin_unlock_irq(q->queue_lock);
+}
+
+static enum hrtimer_restart blk_gather_timer_fn(struct hrtimer *timer)
+{
+	struct request_queue *q = container_of(timer, struct request_queue,
+					       gather_timer);
+
+	/*
+	 * Elevator insertion may run the queue, do it from kblockd
+	 * rather than from hard interrupt context.
+	 */
+	kblockd_schedule_work(q, &q->gather_work);
+
+	return HRTIMER_NORESTART;
+}
+
+void blk_gather_init(struct request_queue *q)
+{
+	INIT_LIST_HEAD(&q->gather_list);
+	INIT_WORK(&q->gather_work, blk_gather_work);
+	hrtimer_init(&q->gather_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	q->gather_timer.function = blk_gather_timer_fn;
+	q->gather_max = BLK_GATHER_MAX;
+}
+
+/*
+ * Called from blk_sync_queue(), in process context. The timer and the
+ * work are what releases the gather list, so once they are cancelled
+ * hand what is left of it to the elevator ourselves. Nothing is pending
+ * on return; writes are no longer gathered once the queue is dead.
+ */
+void blk_gather_sync(struct request_queue *q)
+{
+	hrtimer_cancel(&q->gather_timer);
+	cancel_work_sync(&q->gather_work);
+
+	spin_lock_irq(q->queue_lock);
+	if (!list_empty(&q->gather_list)) {
+		blk_gather_flush(q);
+		__blk_run_queue(q);
+	}
+	spin_unlock_irq(q->queue_lock);
+}
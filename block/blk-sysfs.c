@@ -266,6 +266,62 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+#ifdef CONFIG_BLK_WRITE_GATHER
+static ssize_t queue_gather_usecs_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->gather_usecs, page);
+}
+
+static ssize_t
+queue_gather_usecs_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	spin_lock_irq(q->queue_lock);
+	q->gather_usecs = min_t(unsigned long, val, USEC_PER_SEC);
+	if (!q->gather_usecs) {
+		blk_gather_flush(q);
+		__blk_run_queue(q);
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t queue_gather_max_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->gather_max, page);
+}
+
+static ssize_t
+queue_gather_max_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	spin_lock_irq(q->queue_lock);
+	q->gather_max = clamp_t(unsigned long, val, 1, q->nr_requests);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t queue_gather_stats_show(struct request_queue *q, char *page)
+{
+	struct blk_gather_stats *st = &q->gather_stats;
+	u64 avg = st->latency_us;
+
+	if (st->gathered)
+		do_div(avg, st->gathered);
+	else
+		avg = 0;
+
+	return sprintf(page, "%lu %lu %lu %llu\n", st->gathered, st->merged,
+		       st->flushes, (unsigned long long) avg);
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -380,6 +436,25 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_WRITE_GATHER
+static struct queue_sysfs_entry queue_gather_usecs_entry = {
+	.attr = {.name = "write_gather_usecs", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_gather_usecs_show,
+	.store = queue_gather_usecs_store,
+};
+
+static struct queue_sysfs_entry queue_gather_max_entry = {
+	.attr = {.name = "write_gather_max", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_gather_max_show,
+	.store = queue_gather_max_store,
+};
+
+static struct queue_sysfs_entry queue_gather_stats_entry = {
+	.attr = {.name = "write_gather_stats", .mode = S_IRUGO },
+	.show = queue_gather_stats_show,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -402,6 +477,11 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+#ifdef CONFIG_BLK_WRITE_GATHER
+	&queue_gather_usecs_entry.attr,
+	&queue_gather_max_entry.attr,
+	&queue_gather_stats_entry.attr,
+#endif
 	NULL,
 };
 
@@ -52,6 +52,25 @@ static inline void blk_clear_rq_complete(struct request *rq)
 void blk_insert_flush(struct request *rq);
 void blk_abort_flushes(struct request_queue *q);
 
+#ifdef CONFIG_BLK_WRITE_GATHER
+/* Default max number of async writes held on the gather list */
+#define BLK_GATHER_MAX	32
+
+void blk_gather_init(struct request_queue *q);
+void blk_gather_sync(struct request_queue *q);
+void blk_gather_flush(struct request_queue *q);
+bool blk_gather_request(struct request_queue *q, struct request *rq);
+#else
+static inline void blk_gather_init(struct request_queue *q) { }
+static inline void blk_gather_sync(struct request_queue *q) { }
+static inline void blk_gather_flush(struct request_queue *q) { }
+static inline bool blk_gather_request(struct request_queue *q,
+				      struct request *rq)
+{
+	return false;
+}
+#endif
+
 static inline struct request *__elv_next_request(struct request_queue *q)
 {
 	struct request *rq;
@@ -609,6 +609,10 @@ void elv_requeue_request(struct request_queue *q, struct request *rq)
 void elv_drain_elevator(struct request_queue *q)
 {
 	static int printed;
+
+	/* Gathered writes hold elevator private data, hand them over first */
+	blk_gather_flush(q);
+
 	while (q->elevator->ops->elevator_dispatch_fn(q, 1))
 		;
 	if (q->nr_sorted == 0)
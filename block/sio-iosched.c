@@ -12,12 +12,18 @@
  * Asynchronous and synchronous requests are not treated separately, but
  * we relay on deadlines to ensure fairness.
  *
+ * Optionally, a read latency target can be set. Completion latency is then
+ * sampled per direction over a sliding window, and the number of async
+ * writes outstanding on the device is throttled while reads miss the target.
+ *
  */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
 #include <linux/version.h>
 
 enum { ASYNC, SYNC };
@@ -33,6 +39,22 @@ static const int writes_starved = 2;		/* max times reads can starve a write */
 static const int fifo_batch     = 8;		/* # of sequential requests treated as one
 						   by the above parameters. For throughput. */
 
+static const int target_read_latency = 0;	/* read latency target in usecs, 0 disables throttling */
+static const int latency_window = 500;		/* latency samples older than this (ms) are ignored */
+static const int async_write_depth = 8;		/* max async writes outstanding on the device */
+
+#define SIO_LAT_SAMPLES	128			/* latency samples kept per direction */
+
+/* Completion latency samples of one data direction */
+struct sio_lat_stat {
+	u32 lat[SIO_LAT_SAMPLES];		/* dispatch to completion, in usecs */
+	unsigned long stamp[SIO_LAT_SAMPLES];	/* completion time, in jiffies */
+	unsigned int head;
+
+	/* Percentiles over the last window, in usecs */
+	u32 p50, p90, p99;
+};
+
 /* Elevator data */
 struct sio_data {
 	/* Request queues */
@@ -46,6 +68,19 @@ struct sio_data {
 	int fifo_expire[2][2];
 	int fifo_batch;
 	int writes_starved;
+
+	/* Latency targeting */
+	int target_read_latency;
+	int latency_window;
+	int async_write_depth;
+
+	struct sio_lat_stat lat_stat[2];
+	u32 lat_sorted[SIO_LAT_SAMPLES];
+	unsigned long lat_next_update;
+
+	unsigned int write_depth;	/* current async write limit */
+	unsigned int write_inflight;	/* async writes on the device */
+	unsigned long throttled;	/* times an async write was held back */
 };
 
 static void
@@ -94,6 +129,15 @@ sio_queue_empty(struct request_queue *q)
 }
 #endif
 
+static inline int
+sio_write_throttled(struct sio_data *sd, int sync, int data_dir)
+{
+	if (!sd->target_read_latency || sync || data_dir != WRITE)
+		return 0;
+
+	return sd->write_inflight >= sd->write_depth;
+}
+
 static struct request *
 sio_expired_request(struct sio_data *sd, int sync, int data_dir)
 {
@@ -107,8 +151,13 @@ sio_expired_request(struct sio_data *sd, int sync, int data_dir)
 	rq = rq_entry_fifo(list->next);
 
 	/* Request has expired */
-	if (time_after(jiffies, rq_fifo_time(rq)))
+	if (time_after(jiffies, rq_fifo_time(rq))) {
+		if (sio_write_throttled(sd, sync, data_dir)) {
+			sd->throttled++;
+			return NULL;
+		}
 		return rq;
+	}
 
 	return NULL;
 }
@@ -153,14 +202,19 @@ sio_choose_request(struct sio_data *sd, int data_dir)
 	 */
 	if (!list_empty(&sync[data_dir]))
 		return rq_entry_fifo(sync[data_dir].next);
-	if (!list_empty(&async[data_dir]))
+	if (!list_empty(&async[data_dir]) &&
+	    !sio_write_throttled(sd, ASYNC, data_dir))
 		return rq_entry_fifo(async[data_dir].next);
 
 	if (!list_empty(&sync[!data_dir]))
 		return rq_entry_fifo(sync[!data_dir].next);
-	if (!list_empty(&async[!data_dir]))
+	if (!list_empty(&async[!data_dir]) &&
+	    !sio_write_throttled(sd, ASYNC, !data_dir))
 		return rq_entry_fifo(async[!data_dir].next);
 
+	if (!list_empty(&async[WRITE]))
+		sd->throttled++;
+
 	return NULL;
 }
 
@@ -174,6 +228,11 @@ sio_dispatch_request(struct sio_data *sd, struct request *rq)
 	rq_fifo_clear(rq);
 	elv_dispatch_add_tail(rq->q, rq);
 
+	/* Remember dispatch time for latency accounting */
+	rq->elevator_private[0] = (void *) (unsigned long) ktime_to_us(ktime_get());
+	if (!rq_is_sync(rq) && rq_data_dir(rq) == WRITE)
+		sd->write_inflight++;
+
 	sd->batched++;
 
 	if (rq_data_dir(rq))
@@ -189,6 +248,20 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	struct request *rq = NULL;
 	int data_dir = READ;
 
+	/*
+	 * A forced dispatch must drain everything, so the async write
+	 * limit is lifted until the queue is empty.
+	 */
+	if (unlikely(force)) {
+		unsigned int depth = sd->write_depth;
+
+		sd->write_depth = UINT_MAX;
+		while (sio_dispatch_requests(q, 0))
+			;
+		sd->write_depth = depth;
+		return 0;
+	}
+
 	/*
 	 * Retrieve any expired request after a batch of
 	 * sequential requests.
@@ -214,6 +287,81 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	return 1;
 }
 
+static int
+sio_lat_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *) a, y = *(const u32 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+sio_update_percentiles(struct sio_data *sd, struct sio_lat_stat *ls)
+{
+	unsigned long window = msecs_to_jiffies(sd->latency_window);
+	unsigned int i, nr = 0;
+
+	for (i = 0; i < SIO_LAT_SAMPLES; i++) {
+		if (!ls->stamp[i] || time_after(jiffies, ls->stamp[i] + window))
+			continue;
+		sd->lat_sorted[nr++] = ls->lat[i];
+	}
+
+	if (!nr) {
+		ls->p50 = ls->p90 = ls->p99 = 0;
+		return;
+	}
+
+	sort(sd->lat_sorted, nr, sizeof(u32), sio_lat_cmp, NULL);
+	ls->p50 = sd->lat_sorted[nr * 50 / 100];
+	ls->p90 = sd->lat_sorted[nr * 90 / 100];
+	ls->p99 = sd->lat_sorted[nr * 99 / 100];
+}
+
+static void
+sio_update_write_depth(struct sio_data *sd)
+{
+	u32 p90 = sd->lat_stat[READ].p90;
+
+	/*
+	 * Halve the async write depth while reads miss their target and
+	 * let it grow back one request at a time once they meet it again.
+	 */
+	if (p90 > sd->target_read_latency)
+		sd->write_depth = max(sd->write_depth / 2, 1U);
+	else if (sd->write_depth < sd->async_write_depth)
+		sd->write_depth++;
+	else
+		sd->write_depth = sd->async_write_depth;
+}
+
+static void
+sio_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+	struct sio_lat_stat *ls = &sd->lat_stat[rq_data_dir(rq)];
+	unsigned long now = (unsigned long) ktime_to_us(ktime_get());
+
+	if (!rq_is_sync(rq) && rq_data_dir(rq) == WRITE && sd->write_inflight)
+		sd->write_inflight--;
+
+	ls->lat[ls->head] = now - (unsigned long) rq->elevator_private[0];
+	ls->stamp[ls->head] = jiffies ? jiffies : 1;
+	ls->head = (ls->head + 1) % SIO_LAT_SAMPLES;
+
+	/* Refresh percentiles a few times per window */
+	if (time_before(jiffies, sd->lat_next_update))
+		return;
+	sd->lat_next_update = jiffies +
+		max(msecs_to_jiffies(sd->latency_window) / 4, 1UL);
+
+	sio_update_percentiles(sd, &sd->lat_stat[READ]);
+	sio_update_percentiles(sd, &sd->lat_stat[WRITE]);
+
+	if (sd->target_read_latency)
+		sio_update_write_depth(sd);
+}
+
 static struct request *
 sio_former_request(struct request_queue *q, struct request *rq)
 {
@@ -248,7 +396,7 @@ sio_init_queue(struct request_queue *q)
 	struct sio_data *sd;
 
 	/* Allocate structure */
-	sd = kmalloc_node(sizeof(*sd), GFP_KERNEL, q->node);
+	sd = kzalloc_node(sizeof(*sd), GFP_KERNEL, q->node);
 	if (!sd)
 		return NULL;
 
@@ -265,6 +413,12 @@ sio_init_queue(struct request_queue *q)
 	sd->fifo_expire[ASYNC][READ] = async_read_expire;
 	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
 	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->target_read_latency = target_read_latency;
+	sd->latency_window = latency_window;
+	sd->async_write_depth = async_write_depth;
+	sd->write_depth = async_write_depth;
+	sd->lat_next_update = jiffies;
 
 	return sd;
 }
@@ -317,6 +471,9 @@ SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
 SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
 SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+SHOW_FUNCTION(sio_target_read_latency_show, sd->target_read_latency, 0);
+SHOW_FUNCTION(sio_latency_window_show, sd->latency_window, 0);
+SHOW_FUNCTION(sio_async_write_depth_show, sd->async_write_depth, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -341,8 +498,31 @@ STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, IN
 STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
 STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_target_read_latency_store, &sd->target_read_latency, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_latency_window_store, &sd->latency_window, 1, INT_MAX, 0);
+STORE_FUNCTION(sio_async_write_depth_store, &sd->async_write_depth, 1, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+#define LAT_SHOW_FUNCTION(__FUNC, __DIR)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct sio_data *sd = e->elevator_data;			\
+	struct sio_lat_stat *ls = &sd->lat_stat[__DIR];			\
+	return sprintf(page, "%u %u %u\n", ls->p50, ls->p90, ls->p99);	\
+}
+LAT_SHOW_FUNCTION(sio_read_latency_show, READ);
+LAT_SHOW_FUNCTION(sio_write_latency_show, WRITE);
+#undef LAT_SHOW_FUNCTION
+
+static ssize_t
+sio_throttle_stats_show(struct elevator_queue *e, char *page)
+{
+	struct sio_data *sd = e->elevator_data;
+
+	return sprintf(page, "depth %u inflight %u throttled %lu\n",
+		       sd->write_depth, sd->write_inflight, sd->throttled);
+}
+
 #define DD_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, sio_##name##_show, \
 				      sio_##name##_store)
@@ -354,6 +534,12 @@ static struct elv_fs_entry sio_attrs[] = {
 	DD_ATTR(async_write_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
+	DD_ATTR(target_read_latency),
+	DD_ATTR(latency_window),
+	DD_ATTR(async_write_depth),
+	__ATTR(read_latency, S_IRUGO, sio_read_latency_show, NULL),
+	__ATTR(write_latency, S_IRUGO, sio_write_latency_show, NULL),
+	__ATTR(throttle_stats, S_IRUGO, sio_throttle_stats_show, NULL),
 	__ATTR_NULL
 };
 
@@ -362,6 +548,7 @@ static struct elevator_type iosched_sio = {
 		.elevator_merge_req_fn		= sio_merged_requests,
 		.elevator_dispatch_fn		= sio_dispatch_requests,
 		.elevator_add_req_fn		= sio_add_request,
+		.elevator_completed_req_fn	= sio_completed_request,
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
 		.elevator_queue_empty_fn	= sio_queue_empty,
 #endif
@@ -400,4 +587,4 @@ module_exit(sio_exit);
 MODULE_AUTHOR("Miguel Boton");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Simple IO scheduler");
-MODULE_VERSION("0.2");
+MODULE_VERSION("0.3");
@@ -23,6 +23,7 @@
  */
 
 #include <crypto/hash.h>
+#include <crypto/authenc.h>
 #include <linux/err.h>
 #include <linux/init.h>
 #include <linux/gfp.h>
@@ -33,6 +34,8 @@
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/rtnetlink.h>
+#include <linux/slab.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -719,6 +722,181 @@ out:
 	crypto_free_ahash(tfm);
 }
 
+/*
+ * Used by test_aead_speed(): ESP packet sized buffers, the number of
+ * requests kept in flight so that a parallelizing wrapper like pcrypt has
+ * something to spread across cpus, and the ESP header and ICV sizes.
+ */
+static u32 aead_block_sizes[] = { 64, 256, 1024, 1408, 0 };
+#define AEAD_SPEED_INFLIGHT	64
+#define AEAD_SPEED_ASSOCLEN	8
+#define AEAD_SPEED_AUTHSIZE	12
+#define AEAD_SPEED_MAX_IVLEN	32
+
+struct aead_speed_req {
+	struct aead_request *req;
+	struct scatterlist sg;
+	struct scatterlist asg;
+	char *buf;
+	u8 iv[AEAD_SPEED_MAX_IVLEN];
+};
+
+static struct {
+	unsigned long end;
+	atomic_t inflight;
+	atomic_t count;
+	int err;
+	struct completion done;
+} aead_speed;
+
+/*
+ * Encrypt until the time is up. Returns -EINPROGRESS if the request went
+ * asynchronous, in which case aead_speed_done() takes over.
+ */
+static int aead_speed_submit(struct aead_request *req)
+{
+	int ret;
+
+	while (time_before(jiffies, aead_speed.end)) {
+		ret = crypto_aead_encrypt(req);
+		if (ret == -EINPROGRESS)
+			return ret;
+		if (ret) {
+			aead_speed.err = ret;
+			return ret;
+		}
+		atomic_inc(&aead_speed.count);
+	}
+
+	return 0;
+}
+
+static void aead_speed_done(struct crypto_async_request *areq, int err)
+{
+	struct aead_request *req = areq->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	if (err) {
+		aead_speed.err = err;
+	} else {
+		atomic_inc(&aead_speed.count);
+		if (aead_speed_submit(req) == -EINPROGRESS)
+			return;
+	}
+
+	if (atomic_dec_and_test(&aead_speed.inflight))
+		complete(&aead_speed.done);
+}
+
+static void test_aead_speed(const char *algo, unsigned int sec)
+{
+	struct aead_speed_req *reqs;
+	struct crypto_aead *tfm;
+	struct crypto_authenc_key_param *param;
+	struct rtattr *rta;
+	char key[RTA_SPACE(sizeof(*param)) + 20 + 16];
+	u32 *b_size;
+	int i, ret;
+
+	if (!sec)
+		sec = 1;
+
+	printk(KERN_INFO "\ntesting speed of %s encryption, %d requests "
+	       "in flight\n", algo, AEAD_SPEED_INFLIGHT);
+
+	tfm = crypto_alloc_aead(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		pr_err("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	/* hmac(sha1) key followed by an aes-128 key, in authenc format */
+	memset(key, 0xff, sizeof(key));
+	rta = (struct rtattr *)key;
+	rta->rta_type = CRYPTO_AUTHENC_KEYA_PARAM;
+	rta->rta_len = RTA_LENGTH(sizeof(*param));
+	param = RTA_DATA(rta);
+	param->enckeylen = cpu_to_be32(16);
+
+	ret = crypto_aead_setkey(tfm, key, sizeof(key));
+	if (!ret)
+		ret = crypto_aead_setauthsize(tfm, AEAD_SPEED_AUTHSIZE);
+	if (ret) {
+		pr_err("setkey() failed flags=%x\n", crypto_aead_get_flags(tfm));
+		goto out;
+	}
+
+	reqs = kcalloc(AEAD_SPEED_INFLIGHT, sizeof(*reqs), GFP_KERNEL);
+	if (!reqs)
+		goto out;
+
+	for (i = 0; i < AEAD_SPEED_INFLIGHT; i++) {
+		struct aead_speed_req *r = &reqs[i];
+
+		r->buf = kmalloc(AEAD_SPEED_ASSOCLEN + 8192, GFP_KERNEL);
+		r->req = aead_request_alloc(tfm, GFP_KERNEL);
+		if (!r->buf || !r->req) {
+			pr_err("aead request allocation failure\n");
+			goto out_free;
+		}
+		memset(r->buf, 0xff, AEAD_SPEED_ASSOCLEN + 8192);
+		memset(r->iv, 0xff, sizeof(r->iv));
+		sg_init_one(&r->asg, r->buf, AEAD_SPEED_ASSOCLEN);
+		aead_request_set_callback(r->req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+					  aead_speed_done, r->req);
+		aead_request_set_assoc(r->req, &r->asg, AEAD_SPEED_ASSOCLEN);
+	}
+
+	for (b_size = aead_block_sizes; *b_size; b_size++) {
+		printk("test %u (%d byte blocks): ",
+		       (unsigned int)(b_size - aead_block_sizes), *b_size);
+
+		for (i = 0; i < AEAD_SPEED_INFLIGHT; i++) {
+			struct aead_speed_req *r = &reqs[i];
+
+			sg_init_one(&r->sg, r->buf + AEAD_SPEED_ASSOCLEN,
+				    *b_size + AEAD_SPEED_AUTHSIZE);
+			aead_request_set_crypt(r->req, &r->sg, &r->sg, *b_size,
+					       r->iv);
+		}
+
+		aead_speed.end = jiffies + sec * HZ;
+		aead_speed.err = 0;
+		atomic_set(&aead_speed.count, 0);
+		atomic_set(&aead_speed.inflight, AEAD_SPEED_INFLIGHT);
+		init_completion(&aead_speed.done);
+
+		for (i = 0; i < AEAD_SPEED_INFLIGHT; i++) {
+			if (aead_speed_submit(reqs[i].req) == -EINPROGRESS)
+				continue;
+			if (atomic_dec_and_test(&aead_speed.inflight))
+				complete(&aead_speed.done);
+		}
+		wait_for_completion(&aead_speed.done);
+
+		if (aead_speed.err) {
+			printk("encryption failed ret=%d\n", aead_speed.err);
+			break;
+		}
+
+		printk("%d operations in %d seconds (%ld bytes)\n",
+		       atomic_read(&aead_speed.count), sec,
+		       (long)atomic_read(&aead_speed.count) * *b_size);
+	}
+
+out_free:
+	for (i = 0; i < AEAD_SPEED_INFLIGHT; i++) {
+		aead_request_free(reqs[i].req);
+		kfree(reqs[i].buf);
+	}
+	kfree(reqs);
+out:
+	crypto_free_aead(tfm);
+}
+
 static void test_available(void)
 {
 	char **name = check;
@@ -1231,6 +1409,25 @@ static int do_test(int m)
 	case 499:
 		break;
 
+	case 500:
+		/* fall through */
+
+	case 501:
+		test_aead_speed("authenc(hmac(sha1),cbc(aes))", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 502:
+		/*
+		 * Compare with 501 while varying
+		 * /sys/kernel/pcrypt/pencrypt/parallel_cpumask
+		 * to see how ESP throughput scales with cpus.
+		 */
+		test_aead_speed("pcrypt(authenc(hmac(sha1),cbc(aes)))", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 599:
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -29,6 +29,7 @@
 #include <linux/sched.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/input.h>
 
 /* greater than 80% avg load across online CPUs increases frequency */
 #define DEFAULT_UP_FREQ_MIN_LOAD			(80)
@@ -48,6 +49,17 @@
 /* default number of sampling periods to average before hotplug-out decision */
 #define DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS		(20)
 
+/*
+ * more than 1.5 runnable tasks per online CPU on average are needed before
+ * hotplugging in, and less than 1.2 per remaining CPU before hotplugging
+ * out; the gap keeps a steady load from bouncing CPU1 in and out
+ */
+#define DEFAULT_HOTPLUG_IN_NR_RUNNING			(150)
+#define DEFAULT_HOTPLUG_OUT_NR_RUNNING			(120)
+
+/* input boost is off by default */
+#define DEFAULT_INPUT_BOOST_MS				(0)
+
 static void do_dbs_timer(struct work_struct *work);
 static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 		unsigned int event);
@@ -69,6 +81,9 @@ struct cpu_dbs_info_s {
 	struct delayed_work work;
 	struct cpufreq_frequency_table *freq_table;
 	int cpu;
+	u64 prev_nr_stamp;
+	u64 prev_nr_running;
+	u64 prev_nr_waiting;
 	/*
 	 * percpu mutex that serializes governor limit change with
 	 * do_dbs_timer invocation. We do not want do_dbs_timer to run
@@ -88,6 +103,12 @@ static DEFINE_MUTEX(dbs_mutex);
 
 static struct workqueue_struct	*khotplug_wq;
 
+/* one sampling period worth of hotplug accounting */
+struct hotplug_sample {
+	unsigned int load;
+	unsigned int nr_running;
+};
+
 static struct dbs_tuners {
 	unsigned int sampling_rate;
 	unsigned int up_threshold;
@@ -96,7 +117,10 @@ static struct dbs_tuners {
 	unsigned int hotplug_in_sampling_periods;
 	unsigned int hotplug_out_sampling_periods;
 	unsigned int hotplug_load_index;
-	unsigned int *hotplug_load_history;
+	struct hotplug_sample *hotplug_load_history;
+	unsigned int hotplug_in_nr_running;
+	unsigned int hotplug_out_nr_running;
+	unsigned int input_boost_ms;
 	unsigned int ignore_nice;
 	unsigned int io_is_busy;
 } dbs_tuners_ins = {
@@ -107,10 +131,32 @@ static struct dbs_tuners {
 	.hotplug_in_sampling_periods =	DEFAULT_HOTPLUG_IN_SAMPLING_PERIODS,
 	.hotplug_out_sampling_periods =	DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS,
 	.hotplug_load_index =		0,
+	.hotplug_in_nr_running =	DEFAULT_HOTPLUG_IN_NR_RUNNING,
+	.hotplug_out_nr_running =	DEFAULT_HOTPLUG_OUT_NR_RUNNING,
+	.input_boost_ms =		DEFAULT_INPUT_BOOST_MS,
 	.ignore_nice =			0,
 	.io_is_busy =			0,
 };
 
+/* no hotplug-out decisions before this many more sampling periods */
+static unsigned int hotplug_hold_periods;
+
+/*
+ * input boost keeps CPU1 online until this time (jiffies), which must not
+ * start out ahead of jiffies
+ */
+static unsigned long input_boost_end = INITIAL_JIFFIES;
+
+static struct hotplug_stats {
+	unsigned int hotplug_in;
+	unsigned int hotplug_out;
+	unsigned int input_boosts;
+	/* time spent with CPU1 offline */
+	u64 offline_ns;
+	/* time tasks spent runnable but waiting while CPU1 was offline */
+	u64 offline_wait_ns;
+} hotplug_stats;
+
 /*
  * A corner case exists when switching io_is_busy at run-time: comparing idle
  * times from a non-io_is_busy period to an io_is_busy period (or vice-versa)
@@ -154,6 +200,9 @@ show_one(down_differential, down_differential);
 show_one(down_threshold, down_threshold);
 show_one(hotplug_in_sampling_periods, hotplug_in_sampling_periods);
 show_one(hotplug_out_sampling_periods, hotplug_out_sampling_periods);
+show_one(hotplug_in_nr_running, hotplug_in_nr_running);
+show_one(hotplug_out_nr_running, hotplug_out_nr_running);
+show_one(input_boost_ms, input_boost_ms);
 show_one(ignore_nice_load, ignore_nice);
 show_one(io_is_busy, io_is_busy);
 
@@ -230,7 +279,7 @@ static ssize_t store_hotplug_in_sampling_periods(struct kobject *a,
 		struct attribute *b, const char *buf, size_t count)
 {
 	unsigned int input;
-	unsigned int *temp;
+	struct hotplug_sample *temp;
 	unsigned int max_windows;
 	int ret;
 	ret = sscanf(buf, "%u", &input);
@@ -254,7 +303,7 @@ static ssize_t store_hotplug_in_sampling_periods(struct kobject *a,
 	}
 
 	/* resize array */
-	temp = kmalloc((sizeof(unsigned int) * input), GFP_KERNEL);
+	temp = kmalloc((sizeof(struct hotplug_sample) * input), GFP_KERNEL);
 
 	if (!temp || IS_ERR(temp)) {
 		ret = -ENOMEM;
@@ -262,7 +311,7 @@ static ssize_t store_hotplug_in_sampling_periods(struct kobject *a,
 	}
 
 	memcpy(temp, dbs_tuners_ins.hotplug_load_history,
-			(max_windows * sizeof(unsigned int)));
+			(max_windows * sizeof(struct hotplug_sample)));
 	kfree(dbs_tuners_ins.hotplug_load_history);
 
 	/* replace old buffer, old number of sampling periods & old index */
@@ -279,7 +328,7 @@ static ssize_t store_hotplug_out_sampling_periods(struct kobject *a,
 		struct attribute *b, const char *buf, size_t count)
 {
 	unsigned int input;
-	unsigned int *temp;
+	struct hotplug_sample *temp;
 	unsigned int max_windows;
 	int ret;
 	ret = sscanf(buf, "%u", &input);
@@ -303,7 +352,7 @@ static ssize_t store_hotplug_out_sampling_periods(struct kobject *a,
 	}
 
 	/* resize array */
-	temp = kmalloc((sizeof(unsigned int) * input), GFP_KERNEL);
+	temp = kmalloc((sizeof(struct hotplug_sample) * input), GFP_KERNEL);
 
 	if (!temp || IS_ERR(temp)) {
 		ret = -ENOMEM;
@@ -311,7 +360,7 @@ static ssize_t store_hotplug_out_sampling_periods(struct kobject *a,
 	}
 
 	memcpy(temp, dbs_tuners_ins.hotplug_load_history,
-			(max_windows * sizeof(unsigned int)));
+			(max_windows * sizeof(struct hotplug_sample)));
 	kfree(dbs_tuners_ins.hotplug_load_history);
 
 	/* replace old buffer, old number of sampling periods & old index */
@@ -324,6 +373,68 @@ out:
 	return ret;
 }
 
+static ssize_t store_hotplug_in_nr_running(struct kobject *a,
+		struct attribute *b, const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+
+	if (ret != 1 || input <= dbs_tuners_ins.hotplug_out_nr_running)
+		return -EINVAL;
+
+	mutex_lock(&dbs_mutex);
+	dbs_tuners_ins.hotplug_in_nr_running = input;
+	mutex_unlock(&dbs_mutex);
+
+	return count;
+}
+
+static ssize_t store_hotplug_out_nr_running(struct kobject *a,
+		struct attribute *b, const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+
+	if (ret != 1 || input >= dbs_tuners_ins.hotplug_in_nr_running)
+		return -EINVAL;
+
+	mutex_lock(&dbs_mutex);
+	dbs_tuners_ins.hotplug_out_nr_running = input;
+	mutex_unlock(&dbs_mutex);
+
+	return count;
+}
+
+static ssize_t store_input_boost_ms(struct kobject *a, struct attribute *b,
+				    const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&dbs_mutex);
+	dbs_tuners_ins.input_boost_ms = input;
+	mutex_unlock(&dbs_mutex);
+
+	return count;
+}
+
+static ssize_t show_stats(struct kobject *kobj, struct attribute *attr,
+			  char *buf)
+{
+	struct hotplug_stats *st = &hotplug_stats;
+
+	return sprintf(buf, "hotplug_in %u\nhotplug_out %u\ninput_boosts %u\n"
+		       "offline_ms %llu\noffline_wait_ms %llu\n",
+		       st->hotplug_in, st->hotplug_out, st->input_boosts,
+		       div_u64(st->offline_ns, NSEC_PER_MSEC),
+		       div_u64(st->offline_wait_ns, NSEC_PER_MSEC));
+}
+
 static ssize_t store_ignore_nice_load(struct kobject *a, struct attribute *b,
 				      const char *buf, size_t count)
 {
@@ -384,6 +495,10 @@ define_one_global_rw(down_differential);
 define_one_global_rw(down_threshold);
 define_one_global_rw(hotplug_in_sampling_periods);
 define_one_global_rw(hotplug_out_sampling_periods);
+define_one_global_rw(hotplug_in_nr_running);
+define_one_global_rw(hotplug_out_nr_running);
+define_one_global_rw(input_boost_ms);
+define_one_global_ro(stats);
 define_one_global_rw(ignore_nice_load);
 define_one_global_rw(io_is_busy);
 
@@ -394,6 +509,10 @@ static struct attribute *dbs_attributes[] = {
 	&down_threshold.attr,
 	&hotplug_in_sampling_periods.attr,
 	&hotplug_out_sampling_periods.attr,
+	&hotplug_in_nr_running.attr,
+	&hotplug_out_nr_running.attr,
+	&input_boost_ms.attr,
+	&stats.attr,
 	&ignore_nice_load.attr,
 	&io_is_busy.attr,
 	NULL
@@ -406,6 +525,28 @@ static struct attribute_group dbs_attr_group = {
 
 /************************** sysfs end ************************/
 
+/*
+ * Can CPU1 go offline?  Not while an input boost or the hold-off after
+ * hotplugging in is active.  Otherwise either the runnable tasks would fit
+ * on the remaining CPU, or the load has stayed low at the lowest frequency.
+ */
+static bool dbs_hotplug_out_ok(struct cpufreq_policy *policy,
+		unsigned int hotplug_out_avg_load,
+		unsigned int hotplug_out_avg_nr)
+{
+	if (num_online_cpus() < 2 || hotplug_hold_periods)
+		return false;
+
+	if (time_before(jiffies, input_boost_end))
+		return false;
+
+	if (hotplug_out_avg_nr < dbs_tuners_ins.hotplug_out_nr_running)
+		return true;
+
+	return policy->cur == policy->min &&
+		hotplug_out_avg_load < dbs_tuners_ins.down_threshold;
+}
+
 static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 {
 	/* combined load of all enabled CPUs */
@@ -416,11 +557,21 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	unsigned int max_load_freq = 0;
 	/* average load across all enabled CPUs */
 	unsigned int avg_load = 0;
+	/* runnable tasks across all enabled CPUs, times 100 */
+	unsigned int nr_running = 0;
+	/* runnable but waiting time across all enabled CPUs */
+	u64 nr_waiting_ns = 0;
+	/* wall time of this sampling period */
+	u64 period_ns = 0;
 	/* average load across multiple sampling periods for hotplug events */
 	unsigned int hotplug_in_avg_load = 0;
 	unsigned int hotplug_out_avg_load = 0;
+	/* average nr_running across multiple sampling periods, times 100 */
+	unsigned int hotplug_in_avg_nr = 0;
+	unsigned int hotplug_out_avg_nr = 0;
 	/* number of sampling periods averaged for hotplug decisions */
 	unsigned int periods;
+	struct hotplug_sample *history = dbs_tuners_ins.hotplug_load_history;
 
 	struct cpufreq_policy *policy;
 	unsigned int i, j;
@@ -435,10 +586,25 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 		unsigned int load;
 		unsigned int idle_time, wall_time;
 		cputime64_t cur_wall_time, cur_idle_time;
+		u64 stamp, running, waiting, delta;
 		struct cpu_dbs_info_s *j_dbs_info;
 
 		j_dbs_info = &per_cpu(hp_cpu_dbs_info, j);
 
+		/* runqueue depth and wait time since last iteration */
+		stamp = sched_get_nr_running_integral(j, &running, &waiting);
+		delta = stamp - j_dbs_info->prev_nr_stamp;
+		if (delta) {
+			nr_running += div64_u64((running -
+					j_dbs_info->prev_nr_running) * 100,
+					delta);
+			nr_waiting_ns += waiting - j_dbs_info->prev_nr_waiting;
+			period_ns = max(period_ns, delta);
+		}
+		j_dbs_info->prev_nr_stamp = stamp;
+		j_dbs_info->prev_nr_running = running;
+		j_dbs_info->prev_nr_waiting = waiting;
+
 		/* update both cur_idle_time and cur_wall_time */
 		cur_idle_time = get_cpu_idle_time(j, &cur_wall_time);
 
@@ -472,6 +638,12 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	/* calculate the average load across all related CPUs */
 	avg_load = total_load / num_online_cpus();
 
+	/* account the time CPU1 was not there to help */
+	if (num_online_cpus() < 2) {
+		hotplug_stats.offline_ns += period_ns;
+		hotplug_stats.offline_wait_ns += nr_waiting_ns;
+	}
+
 
 	/*
 	 * hotplug load accounting
@@ -482,19 +654,21 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	periods = max(dbs_tuners_ins.hotplug_in_sampling_periods,
 			dbs_tuners_ins.hotplug_out_sampling_periods);
 
-	/* store avg_load in the circular buffer */
-	dbs_tuners_ins.hotplug_load_history[dbs_tuners_ins.hotplug_load_index]
-		= avg_load;
+	/* store avg_load and nr_running in the circular buffer */
+	history[dbs_tuners_ins.hotplug_load_index].load = avg_load;
+	history[dbs_tuners_ins.hotplug_load_index].nr_running = nr_running;
 
 	/* compute average load across in & out sampling periods */
 	for (i = 0, j = dbs_tuners_ins.hotplug_load_index;
 			i < periods; i++, j--) {
-		if (i < dbs_tuners_ins.hotplug_in_sampling_periods)
-			hotplug_in_avg_load +=
-				dbs_tuners_ins.hotplug_load_history[j];
-		if (i < dbs_tuners_ins.hotplug_out_sampling_periods)
-			hotplug_out_avg_load +=
-				dbs_tuners_ins.hotplug_load_history[j];
+		if (i < dbs_tuners_ins.hotplug_in_sampling_periods) {
+			hotplug_in_avg_load += history[j].load;
+			hotplug_in_avg_nr += history[j].nr_running;
+		}
+		if (i < dbs_tuners_ins.hotplug_out_sampling_periods) {
+			hotplug_out_avg_load += history[j].load;
+			hotplug_out_avg_nr += history[j].nr_running;
+		}
 
 		if (j == 0)
 			j = periods;
@@ -502,30 +676,57 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 
 	hotplug_in_avg_load = hotplug_in_avg_load /
 		dbs_tuners_ins.hotplug_in_sampling_periods;
+	hotplug_in_avg_nr = hotplug_in_avg_nr /
+		dbs_tuners_ins.hotplug_in_sampling_periods;
 
 	hotplug_out_avg_load = hotplug_out_avg_load /
 		dbs_tuners_ins.hotplug_out_sampling_periods;
+	hotplug_out_avg_nr = hotplug_out_avg_nr /
+		dbs_tuners_ins.hotplug_out_sampling_periods;
 
 	/* return to first element if we're at the circular buffer's end */
 	if (++dbs_tuners_ins.hotplug_load_index == periods)
 		dbs_tuners_ins.hotplug_load_index = 0;
 
-	/* check if auxiliary CPU is needed based on avg_load */
+	if (hotplug_hold_periods)
+		hotplug_hold_periods--;
+
+	/*
+	 * check if auxiliary CPU is needed: the online CPU must be busy
+	 * and have had more runnable tasks than it could run at once
+	 */
 	if (avg_load > dbs_tuners_ins.up_threshold) {
 		/* should we enable auxillary CPUs? */
 		if (num_online_cpus() < 2 && hotplug_in_avg_load >
-				dbs_tuners_ins.up_threshold) {
+				dbs_tuners_ins.up_threshold &&
+				hotplug_in_avg_nr >
+				dbs_tuners_ins.hotplug_in_nr_running) {
 			/* hotplug with cpufreq is nasty
 			 * a call to cpufreq_governor_dbs may cause a lockup.
 			 * wq is not running here so its safe.
 			 */
 			mutex_unlock(&this_dbs_info->timer_mutex);
-			cpu_up(1);
+			if (!cpu_up(1)) {
+				hotplug_stats.hotplug_in++;
+				hotplug_hold_periods =
+				dbs_tuners_ins.hotplug_out_sampling_periods;
+			}
 			mutex_lock(&this_dbs_info->timer_mutex);
 			goto out;
 		}
 	}
 
+	/* should we disable auxillary CPUs? */
+	if (max_load <= dbs_tuners_ins.up_threshold &&
+	    dbs_hotplug_out_ok(policy, hotplug_out_avg_load,
+			       hotplug_out_avg_nr)) {
+		mutex_unlock(&this_dbs_info->timer_mutex);
+		if (!cpu_down(1))
+			hotplug_stats.hotplug_out++;
+		mutex_lock(&this_dbs_info->timer_mutex);
+		goto out;
+	}
+
 	/* check for frequency increase based on max_load */
 	if (max_load > dbs_tuners_ins.up_threshold) {
 		/* increase to highest frequency supported */
@@ -539,16 +740,8 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	/* check for frequency decrease */
 	if (avg_load < dbs_tuners_ins.down_threshold) {
 		/* are we at the minimum frequency already? */
-		if (policy->cur == policy->min) {
-			/* should we disable auxillary CPUs? */
-			if (num_online_cpus() > 1 && hotplug_out_avg_load <
-					dbs_tuners_ins.down_threshold) {
-				mutex_unlock(&this_dbs_info->timer_mutex);
-				cpu_down(1);
-				mutex_lock(&this_dbs_info->timer_mutex);
-			}
+		if (policy->cur == policy->min)
 			goto out;
-		}
 	}
 
 	/*
@@ -604,6 +797,101 @@ static inline void dbs_timer_exit(struct cpu_dbs_info_s *dbs_info)
 	cancel_delayed_work_sync(&dbs_info->work);
 }
 
+/*
+ * Input boost: bring CPU1 online as soon as the user touches the screen
+ * instead of waiting for the load to show up in the sampling windows, and
+ * keep it there for input_boost_ms after the last event.
+ */
+static void dbs_input_boost(struct work_struct *work)
+{
+	if (num_online_cpus() < 2 && !cpu_up(1)) {
+		hotplug_stats.hotplug_in++;
+		hotplug_stats.input_boosts++;
+	}
+}
+
+static DECLARE_WORK(input_boost_work, dbs_input_boost);
+
+static void dbs_input_event(struct input_handle *handle, unsigned int type,
+		unsigned int code, int value)
+{
+	unsigned int boost_ms = dbs_tuners_ins.input_boost_ms;
+
+	if (!boost_ms)
+		return;
+
+	input_boost_end = jiffies + msecs_to_jiffies(boost_ms);
+	if (num_online_cpus() < 2)
+		queue_work(khotplug_wq, &input_boost_work);
+}
+
+static int dbs_input_connect(struct input_handler *handler,
+		struct input_dev *dev, const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_hotplug";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void dbs_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id dbs_input_ids[] = {
+	/* multi-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	/* single-touch touchscreens and touchpads */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	{ },
+};
+
+static struct input_handler dbs_input_handler = {
+	.event		= dbs_input_event,
+	.connect	= dbs_input_connect,
+	.disconnect	= dbs_input_disconnect,
+	.name		= "cpufreq_hotplug",
+	.id_table	= dbs_input_ids,
+};
+
 static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 				   unsigned int event)
 {
@@ -620,6 +908,23 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 			return -EINVAL;
 
 		mutex_lock(&dbs_mutex);
+		max_periods = max(dbs_tuners_ins.hotplug_in_sampling_periods,
+				dbs_tuners_ins.hotplug_out_sampling_periods);
+		dbs_tuners_ins.hotplug_load_history = kmalloc(
+				(sizeof(struct hotplug_sample) * max_periods),
+				GFP_KERNEL);
+		if (!dbs_tuners_ins.hotplug_load_history) {
+			WARN_ON(1);
+			mutex_unlock(&dbs_mutex);
+			return -ENOMEM;
+		}
+		/* start out neutral: half loaded, one runnable task */
+		for (i = 0; i < max_periods; i++) {
+			dbs_tuners_ins.hotplug_load_history[i].load = 50;
+			dbs_tuners_ins.hotplug_load_history[i].nr_running = 100;
+		}
+		dbs_tuners_ins.hotplug_load_index = 0;
+
 		dbs_enable++;
 		for_each_cpu(j, policy->cpus) {
 			struct cpu_dbs_info_s *j_dbs_info;
@@ -632,18 +937,15 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 				j_dbs_info->prev_cpu_nice =
 						kstat_cpu(j).cpustat.nice;
 			}
-
-			max_periods = max(DEFAULT_HOTPLUG_IN_SAMPLING_PERIODS,
-					DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS);
-			dbs_tuners_ins.hotplug_load_history = kmalloc(
-					(sizeof(unsigned int) * max_periods),
-					GFP_KERNEL);
-			if (!dbs_tuners_ins.hotplug_load_history) {
-				WARN_ON(1);
-				return -ENOMEM;
-			}
-			for (i = 0; i < max_periods; i++)
-				dbs_tuners_ins.hotplug_load_history[i] = 50;
+		}
+		/* CPU1 may not be in policy->cpus yet, sample every CPU */
+		for_each_possible_cpu(j) {
+			struct cpu_dbs_info_s *j_dbs_info;
+			j_dbs_info = &per_cpu(hp_cpu_dbs_info, j);
+			j_dbs_info->prev_nr_stamp =
+				sched_get_nr_running_integral(j,
+					&j_dbs_info->prev_nr_running,
+					&j_dbs_info->prev_nr_waiting);
 		}
 		this_dbs_info->cpu = cpu;
 		this_dbs_info->freq_table = cpufreq_frequency_get_table(cpu);
@@ -658,6 +960,10 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 				mutex_unlock(&dbs_mutex);
 				return rc;
 			}
+			rc = input_register_handler(&dbs_input_handler);
+			if (rc)
+				pr_warn("cpufreq-hotplug: no input boost: %d\n",
+					rc);
 		}
 		mutex_unlock(&dbs_mutex);
 
@@ -672,9 +978,12 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 		mutex_destroy(&this_dbs_info->timer_mutex);
 		dbs_enable--;
 		mutex_unlock(&dbs_mutex);
-		if (!dbs_enable)
+		if (!dbs_enable) {
+			input_unregister_handler(&dbs_input_handler);
+			cancel_work_sync(&input_boost_work);
 			sysfs_remove_group(cpufreq_global_kobject,
 					   &dbs_attr_group);
+		}
 		kfree(dbs_tuners_ins.hotplug_load_history);
 		/*
 		 * XXX BIG CAVEAT: Stopping the governor with CPU1 offline
@@ -19,14 +19,17 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/debugfs.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/rwsem.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/tick.h>
 #include <linux/time.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
+#include <linux/hrtimer.h>
 #include <linux/kthread.h>
 #include <linux/slab.h>
 #include <asm/cputime.h>
@@ -52,6 +55,13 @@ struct cpufreq_interactive_cpuinfo {
 	u64 hispeed_validate_time;
 	struct rw_semaphore enable_sem;
 	int governor_enabled;
+	int hint_pending; /* set by the scheduler hint, under its rq lock */
+	pid_t hint_pid;
+	unsigned int hint_load;
+	u64 hint_stamp;
+	u64 hint_time; /* scheduler hint not yet applied, 0 if none */
+	u64 ramp_start; /* start of the load spike being ramped for, or 0 */
+	unsigned int ramp_target;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -60,8 +70,34 @@ static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
 static struct task_struct *speedchange_task;
 static cpumask_t speedchange_cpumask;
 static spinlock_t speedchange_cpumask_lock;
+static cpumask_t hint_cpumask;
 static struct mutex gov_lock;
 
+/*
+ * Wakes the speedchange task on behalf of scheduler hints, which cannot do
+ * so under the runqueue lock. Expires a little ahead so that starting it
+ * just reprograms the clock event device; a timer already expired when
+ * queued would have hrtimer_start() raise the softirq instead.
+ */
+static struct hrtimer speedchange_kick;
+#define SPEEDCHANGE_KICK_NS	(20 * NSEC_PER_USEC)
+
+/*
+ * Ramp-up latency: time from the start of the sampling window in which
+ * more speed was first asked for, to the policy reaching the speed asked
+ * for.  Protected by speedchange_cpumask_lock.
+ */
+#define RAMP_HIST_BUCKETS 10
+static struct {
+	u64 total_us;
+	u64 max_us;
+	unsigned int count;
+	unsigned int aborted;
+	unsigned int hist[RAMP_HIST_BUCKETS];
+} ramp_stats;
+
+static struct dentry *debugfs_root;
+
 /* Hi speed to bump to from lo speed when load burst (default max) */
 static unsigned int hispeed_freq;
 
@@ -109,6 +145,12 @@ static u64 boostpulse_endtime;
 #define DEFAULT_TIMER_SLACK (4 * DEFAULT_TIMER_RATE)
 static int timer_slack_val = DEFAULT_TIMER_SLACK;
 
+/*
+ * Raise speed as soon as the scheduler wakes up or migrates a busy task
+ * rather than waiting for the next timer sample.
+ */
+static bool sched_hint_val = true;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -277,6 +319,64 @@ static u64 update_load(int cpu)
 	return now;
 }
 
+static unsigned int ramp_hist_bucket(u64 latency_us)
+{
+	/* 5ms, 10ms, 20ms, ... 1280ms, and everything slower */
+	unsigned int bucket = 0;
+	u64 limit = 5 * USEC_PER_MSEC;
+
+	while (latency_us >= limit && bucket < RAMP_HIST_BUCKETS - 1) {
+		limit <<= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/* Called with speedchange_cpumask_lock held. */
+static void cpufreq_interactive_ramp_done(
+	struct cpufreq_interactive_cpuinfo *pcpu, u64 now)
+{
+	u64 latency = now - pcpu->ramp_start;
+
+	ramp_stats.count++;
+	ramp_stats.total_us += latency;
+	if (latency > ramp_stats.max_us)
+		ramp_stats.max_us = latency;
+	ramp_stats.hist[ramp_hist_bucket(latency)]++;
+	pcpu->ramp_start = 0;
+}
+
+/*
+ * Track a ramp-up from the first sample that asks for more than the
+ * current speed.  A ramp that is still short of its target when the load
+ * no longer asks for more than the current speed is counted as aborted.
+ */
+static void cpufreq_interactive_ramp_update(
+	struct cpufreq_interactive_cpuinfo *pcpu, unsigned int wanted,
+	u64 window_start, u64 now)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	if (wanted > pcpu->policy->cur) {
+		if (!pcpu->ramp_start) {
+			pcpu->ramp_start = window_start;
+			pcpu->ramp_target = wanted;
+		} else if (wanted > pcpu->ramp_target) {
+			pcpu->ramp_target = wanted;
+		}
+	} else if (pcpu->ramp_start) {
+		if (pcpu->policy->cur >= pcpu->ramp_target) {
+			cpufreq_interactive_ramp_done(pcpu, now);
+		} else {
+			ramp_stats.aborted++;
+			pcpu->ramp_start = 0;
+		}
+	}
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	u64 now;
@@ -290,6 +390,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	unsigned int index;
 	unsigned long flags;
 	bool boosted;
+	const char *reason = "load";
+	u64 window_start;
 
 	if (!down_read_trylock(&pcpu->enable_sem))
 		return;
@@ -297,6 +399,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 		goto exit;
 
 	spin_lock_irqsave(&pcpu->load_lock, flags);
+	window_start = pcpu->cputime_speedadj_timestamp;
 	now = update_load(data);
 	delta_time = (unsigned int)(now - pcpu->cputime_speedadj_timestamp);
 	cputime_speedadj = pcpu->cputime_speedadj;
@@ -313,22 +416,30 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (cpu_load >= go_hispeed_load || boosted) {
 		if (pcpu->target_freq < hispeed_freq) {
 			new_freq = hispeed_freq;
+			reason = boosted ? "boost" : "hispeed";
 		} else {
 			new_freq = choose_freq(pcpu, loadadjfreq);
 
-			if (new_freq < hispeed_freq)
+			if (new_freq < hispeed_freq) {
 				new_freq = hispeed_freq;
+				reason = boosted ? "boost" : "hispeed";
+			}
 		}
 	} else {
 		new_freq = choose_freq(pcpu, loadadjfreq);
 	}
 
+	cpufreq_interactive_ramp_update(pcpu, new_freq, window_start, now);
+
 	if (pcpu->target_freq >= hispeed_freq &&
 	    new_freq > pcpu->target_freq &&
 	    now - pcpu->hispeed_validate_time < above_hispeed_delay_val) {
 		trace_cpufreq_interactive_notyet(
 			data, cpu_load, pcpu->target_freq,
 			pcpu->policy->cur, new_freq);
+		trace_cpufreq_interactive_decision(data, cpu_load,
+			freq_to_targetload(new_freq), pcpu->target_freq,
+			pcpu->target_freq, "delay");
 		goto rearm;
 	}
 
@@ -341,6 +452,12 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	new_freq = pcpu->freq_table[index].frequency;
 
+	/*
+	 * Scheduler hints raise target_freq and floor_freq from the
+	 * speedchange task, so check and update them under the same lock.
+	 */
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+
 	/*
 	 * Do not scale below floor_freq unless we have been at or above the
 	 * floor frequency for the minimum sample time since last validated.
@@ -350,10 +467,19 @@ static void cpufreq_interactive_timer(unsigned long data)
 			trace_cpufreq_interactive_notyet(
 				data, cpu_load, pcpu->target_freq,
 				pcpu->policy->cur, new_freq);
+			trace_cpufreq_interactive_decision(data, cpu_load,
+				freq_to_targetload(new_freq),
+				pcpu->target_freq, pcpu->target_freq, "floor");
+			spin_unlock_irqrestore(&speedchange_cpumask_lock,
+					       flags);
 			goto rearm;
 		}
 	}
 
+	trace_cpufreq_interactive_decision(data, cpu_load,
+		freq_to_targetload(new_freq), pcpu->target_freq, new_freq,
+		reason);
+
 	/*
 	 * Update the timestamp for checking whether speed has been held at
 	 * or above the selected frequency for a minimum of min_sample_time,
@@ -371,6 +497,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 		trace_cpufreq_interactive_already(
 			data, cpu_load, pcpu->target_freq,
 			pcpu->policy->cur, new_freq);
+		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
 		goto rearm_if_notmax;
 	}
 
@@ -378,7 +505,6 @@ static void cpufreq_interactive_timer(unsigned long data)
 					 pcpu->policy->cur, new_freq);
 
 	pcpu->target_freq = new_freq;
-	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
 	cpumask_set_cpu(data, &speedchange_cpumask);
 	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
 	wake_up_process(speedchange_task);
@@ -455,6 +581,107 @@ static void cpufreq_interactive_idle_end(void)
 	up_read(&pcpu->enable_sem);
 }
 
+static enum hrtimer_restart cpufreq_interactive_speedchange_kick(
+	struct hrtimer *timer)
+{
+	wake_up_process(speedchange_task);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Called by the scheduler, with the runqueue locked, when task p is woken
+ * up on or migrated to cpu. util is the recent running fraction of p out
+ * of SCHED_POWER_SCALE, at whatever speed it ran. If p alone would load
+ * the cpu to go_hispeed_load at the current target speed, the speedchange
+ * task is asked to go to hispeed_freq without waiting for the timer.
+ *
+ * Only records the hint: it must neither sleep, wake anything up nor take
+ * the governor's locks. enable_sem is not taken, as up_read() may wake a
+ * GOV_STOP writer, and GOV_STOP instead waits for hints in flight with
+ * synchronize_sched(). The per-cpu hint fields are serialised by the
+ * runqueue lock of that cpu.
+ */
+static void cpufreq_interactive_sched_hint(int cpu, struct task_struct *p,
+					   unsigned long util)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	unsigned int target_freq;
+
+	if (!sched_hint_val || !pcpu->governor_enabled || pcpu->hint_pending)
+		return;
+	/* policy is set up before governor_enabled */
+	smp_rmb();
+
+	target_freq = pcpu->target_freq;
+	if (target_freq >= hispeed_freq)
+		return;
+
+	if ((u64)util * pcpu->policy->cur * 100 <
+	    ((u64)target_freq * go_hispeed_load) << SCHED_POWER_SHIFT)
+		return;
+
+	pcpu->hint_pid = p->pid;
+	pcpu->hint_load = util * 100 >> SCHED_POWER_SHIFT;
+	pcpu->hint_stamp = ktime_to_us(ktime_get());
+	smp_wmb();
+	pcpu->hint_pending = 1;
+	cpumask_set_cpu(cpu, &hint_cpumask);
+
+	if (!hrtimer_is_queued(&speedchange_kick))
+		hrtimer_start(&speedchange_kick,
+			      ns_to_ktime(SPEEDCHANGE_KICK_NS),
+			      HRTIMER_MODE_REL);
+}
+
+/*
+ * Raise the cpus hinted by the scheduler to hispeed_freq, holding the new
+ * speed for min_sample_time as a timer-chosen one would be.
+ */
+static void cpufreq_interactive_apply_hints(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned long flags;
+	unsigned int cpu;
+	u64 now;
+
+	for_each_cpu(cpu, &hint_cpumask) {
+		if (!cpumask_test_and_clear_cpu(cpu, &hint_cpumask))
+			continue;
+
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!down_read_trylock(&pcpu->enable_sem)) {
+			pcpu->hint_pending = 0;
+			continue;
+		}
+		if (!pcpu->governor_enabled) {
+			pcpu->hint_pending = 0;
+			up_read(&pcpu->enable_sem);
+			continue;
+		}
+
+		now = ktime_to_us(ktime_get());
+		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+		if (pcpu->target_freq < hispeed_freq) {
+			trace_cpufreq_interactive_hint(cpu, pcpu->hint_pid,
+						       pcpu->hint_load,
+						       pcpu->target_freq,
+						       hispeed_freq);
+			pcpu->target_freq = hispeed_freq;
+			pcpu->floor_freq = hispeed_freq;
+			pcpu->floor_validate_time = now;
+			pcpu->hispeed_validate_time = now;
+			if (!pcpu->hint_time)
+				pcpu->hint_time = pcpu->hint_stamp;
+			cpumask_set_cpu(cpu, &speedchange_cpumask);
+		}
+		/* The hint fields may be rewritten from here on */
+		smp_mb();
+		pcpu->hint_pending = 0;
+		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+		up_read(&pcpu->enable_sem);
+	}
+}
+
 static int cpufreq_interactive_speedchange_task(void *data)
 {
 	unsigned int cpu;
@@ -466,7 +693,8 @@ static int cpufreq_interactive_speedchange_task(void *data)
 		set_current_state(TASK_INTERRUPTIBLE);
 		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
 
-		if (cpumask_empty(&speedchange_cpumask)) {
+		if (cpumask_empty(&speedchange_cpumask) &&
+		    cpumask_empty(&hint_cpumask)) {
 			spin_unlock_irqrestore(&speedchange_cpumask_lock,
 					       flags);
 			schedule();
@@ -478,6 +706,11 @@ static int cpufreq_interactive_speedchange_task(void *data)
 		}
 
 		set_current_state(TASK_RUNNING);
+		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+		cpufreq_interactive_apply_hints();
+
+		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
 		tmp_mask = speedchange_cpumask;
 		cpumask_clear(&speedchange_cpumask);
 		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
@@ -510,6 +743,22 @@ static int cpufreq_interactive_speedchange_task(void *data)
 						     pcpu->target_freq,
 						     pcpu->policy->cur);
 
+			if (pcpu->hint_time) {
+				trace_cpufreq_interactive_hint_done(cpu,
+					pcpu->target_freq, pcpu->policy->cur,
+					ktime_to_us(ktime_get()) -
+					pcpu->hint_time);
+				pcpu->hint_time = 0;
+			}
+
+			spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+			if (pcpu->ramp_start &&
+			    pcpu->policy->cur >= pcpu->ramp_target)
+				cpufreq_interactive_ramp_done(pcpu,
+					ktime_to_us(ktime_get()));
+			spin_unlock_irqrestore(&speedchange_cpumask_lock,
+					       flags);
+
 			up_read(&pcpu->enable_sem);
 		}
 	}
@@ -586,6 +835,63 @@ static struct notifier_block cpufreq_notifier_block = {
 	.notifier_call = cpufreq_interactive_notifier,
 };
 
+static int ramp_latency_show(struct seq_file *m, void *unused)
+{
+	unsigned long flags;
+	unsigned int hist[RAMP_HIST_BUCKETS];
+	unsigned int count, aborted;
+	u64 total_us, max_us;
+	int i;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	memcpy(hist, ramp_stats.hist, sizeof(hist));
+	count = ramp_stats.count;
+	aborted = ramp_stats.aborted;
+	total_us = ramp_stats.total_us;
+	max_us = ramp_stats.max_us;
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+	seq_printf(m, "ramps: %u aborted: %u\n", count, aborted);
+	seq_printf(m, "avg_us: %llu max_us: %llu\n",
+		   count ? div_u64(total_us, count) : 0,
+		   (unsigned long long)max_us);
+
+	for (i = 0; i < RAMP_HIST_BUCKETS; i++) {
+		if (i < RAMP_HIST_BUCKETS - 1)
+			seq_printf(m, "<%5ums: %u\n", 5 << i, hist[i]);
+		else
+			seq_printf(m, ">=%4ums: %u\n", 5 << (i - 1), hist[i]);
+	}
+
+	return 0;
+}
+
+static int ramp_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ramp_latency_show, NULL);
+}
+
+/* Any write clears the statistics. */
+static ssize_t ramp_latency_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	memset(&ramp_stats, 0, sizeof(ramp_stats));
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations ramp_latency_fops = {
+	.open		= ramp_latency_open,
+	.read		= seq_read,
+	.write		= ramp_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static ssize_t show_target_loads(
 	struct kobject *kobj, struct attribute *attr, char *buf)
 {
@@ -869,6 +1175,29 @@ static ssize_t store_boostpulse_duration(
 
 define_one_global_rw(boostpulse_duration);
 
+static ssize_t show_sched_hint(struct kobject *kobj,
+			       struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", sched_hint_val);
+}
+
+static ssize_t store_sched_hint(struct kobject *kobj,
+				struct attribute *attr, const char *buf,
+				size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	sched_hint_val = !!val;
+	return count;
+}
+
+define_one_global_rw(sched_hint);
+
 static struct attribute *interactive_attributes[] = {
 	&target_loads_attr.attr,
 	&hispeed_freq_attr.attr,
@@ -880,6 +1209,7 @@ static struct attribute *interactive_attributes[] = {
 	&boost.attr,
 	&boostpulse.attr,
 	&boostpulse_duration.attr,
+	&sched_hint.attr,
 	NULL,
 };
 
@@ -949,6 +1279,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 				pcpu->cpu_slack_timer.expires = expires;
 				add_timer_on(&pcpu->cpu_slack_timer, j);
 			}
+			/* scheduler hints check this without enable_sem */
+			smp_wmb();
 			pcpu->governor_enabled = 1;
 			up_write(&pcpu->enable_sem);
 		}
@@ -986,6 +1318,9 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			up_write(&pcpu->enable_sem);
 		}
 
+		/* let scheduler hints that saw the governor enabled finish */
+		synchronize_sched();
+
 		if (--active_count > 0) {
 			mutex_unlock(&gov_lock);
 			return 0;
@@ -1036,6 +1371,8 @@ static int __init cpufreq_interactive_init(void)
 
 	spin_lock_init(&target_loads_lock);
 	spin_lock_init(&speedchange_cpumask_lock);
+	hrtimer_init(&speedchange_kick, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	speedchange_kick.function = cpufreq_interactive_speedchange_kick;
 	mutex_init(&gov_lock);
 	speedchange_task =
 		kthread_create(cpufreq_interactive_speedchange_task, NULL,
@@ -1049,6 +1386,14 @@ static int __init cpufreq_interactive_init(void)
 	/* NB: wake up so the thread does not look hung to the freezer */
 	wake_up_process(speedchange_task);
 
+	/* Without scheduler hints the governor still works off the timer */
+	sched_register_freq_hint(cpufreq_interactive_sched_hint);
+
+	debugfs_root = debugfs_create_dir("cpufreq_interactive", NULL);
+	if (!IS_ERR_OR_NULL(debugfs_root))
+		debugfs_create_file("ramp_latency", S_IRUGO | S_IWUSR,
+				    debugfs_root, NULL, &ramp_latency_fops);
+
 	return cpufreq_register_governor(&cpufreq_gov_interactive);
 }
 
@@ -1061,6 +1406,9 @@ module_init(cpufreq_interactive_init);
 static void __exit cpufreq_interactive_exit(void)
 {
 	cpufreq_unregister_governor(&cpufreq_gov_interactive);
+	debugfs_remove_recursive(debugfs_root);
+	sched_unregister_freq_hint(cpufreq_interactive_sched_hint);
+	hrtimer_cancel(&speedchange_kick);
 	kthread_stop(speedchange_task);
 	put_task_struct(speedchange_task);
 }
@@ -22,6 +22,8 @@
 #include "cpuidle.h"
 
 DEFINE_PER_CPU(struct cpuidle_device *, cpuidle_devices);
+/* exit latency of the state this cpu is in, 0 while it is running */
+DEFINE_PER_CPU(unsigned int, cpuidle_exit_latency);
 
 DEFINE_MUTEX(cpuidle_lock);
 LIST_HEAD(cpuidle_detected_devices);
@@ -100,7 +102,9 @@ static void cpuidle_idle_call(void)
 	trace_power_start(POWER_CSTATE, next_state, dev->cpu);
 	trace_cpu_idle(next_state, dev->cpu);
 
+	__this_cpu_write(cpuidle_exit_latency, target_state->exit_latency);
 	dev->last_residency = target_state->enter(dev, target_state);
+	__this_cpu_write(cpuidle_exit_latency, 0);
 
 	trace_power_end(dev->cpu);
 	trace_cpu_idle(PWR_EVENT_EXIT, dev->cpu);
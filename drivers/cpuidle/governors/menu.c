@@ -19,6 +19,9 @@
 #include <linux/tick.h>
 #include <linux/sched.h>
 #include <linux/math64.h>
+#include <linux/kernel_stat.h>
+
+#include <trace/events/power.h>
 
 #define BUCKETS 12
 #define INTERVALS 8
@@ -26,6 +29,10 @@
 #define DECAY 8
 #define MAX_INTERESTING 50000
 #define STDDEV_THRESH 400
+#define HIST_BINS 16
+#define HIST_WEIGHT 1024
+#define HIST_DECAY_SHIFT 5
+#define HIST_MIN_WEIGHT (4 * HIST_WEIGHT)
 
 
 /*
@@ -77,6 +84,21 @@
  * intervals and if the stand deviation of these 8 intervals is below a
  * threshold value, we use the average of these intervals as prediction.
  *
+ * Wakeup source histograms
+ * ------------------------
+ * The correction factor averages over all wakeups, so a CPU that is woken
+ * early by a device half of the time and sleeps until its timer the other
+ * half ends up with a prediction that is wrong both ways. To separate these,
+ * every wakeup is classified by its source: the timer (we slept for about
+ * the expected time), a device interrupt (the per cpu interrupt count went
+ * up while we were idle) or otherwise an IPI. The measured intervals are
+ * kept in a per cpu, per source histogram with power of two bins and
+ * exponentially decaying weights.
+ * Timer wakeups only tell us that nothing else came first, so when the
+ * non-timer wakeups account for more than half of the recent weight below
+ * the next timer event, the middle of the bin where they cross that half is
+ * used as the prediction if it is shorter than the corrected one.
+ *
  * Limiting Performance Impact
  * ---------------------------
  * C states, especially those with large exit latencies, can have a real
@@ -108,9 +130,18 @@
  *
  */
 
+enum menu_wakeup_source {
+	MENU_WAKEUP_TIMER,
+	MENU_WAKEUP_IPI,
+	MENU_WAKEUP_IRQ,
+	MENU_WAKEUP_SOURCES,
+};
+
 struct menu_device {
 	int		last_state_idx;
 	int             needs_update;
+	int		woke_by_irq;
+	unsigned int	irqs_sum;
 
 	unsigned int	expected_us;
 	u64		predicted_us;
@@ -119,6 +150,7 @@ struct menu_device {
 	u64		correction_factor[BUCKETS];
 	u32		intervals[INTERVALS];
 	int		interval_ptr;
+	u32		hist[MENU_WAKEUP_SOURCES][HIST_BINS];
 };
 
 
@@ -231,6 +263,44 @@ static void detect_repeating_patterns(struct menu_device *data)
 		data->predicted_us = avg;
 }
 
+static inline int which_hist_bin(unsigned int duration)
+{
+	return min(fls(duration), HIST_BINS - 1);
+}
+
+/*
+ * Look for the point below the next timer event by which most of the
+ * recent wakeups have already happened, counting timer wakeups as never
+ * coming early.
+ */
+static void predict_from_histogram(struct menu_device *data)
+{
+	unsigned int limit = which_hist_bin(data->expected_us);
+	u32 total = 0, early = 0;
+	unsigned int us;
+	int i, j;
+
+	for (i = 0; i < MENU_WAKEUP_SOURCES; i++)
+		for (j = 0; j < HIST_BINS; j++)
+			total += data->hist[i][j];
+
+	if (total < HIST_MIN_WEIGHT)
+		return;
+
+	for (j = 0; j < limit; j++) {
+		early += data->hist[MENU_WAKEUP_IPI][j] +
+			 data->hist[MENU_WAKEUP_IRQ][j];
+		if (early * 2 <= total)
+			continue;
+
+		/* bin j covers [2^(j-1), 2^j) */
+		us = j ? 3 << j >> 2 : 0;
+		if (us < data->predicted_us)
+			data->predicted_us = us;
+		return;
+	}
+}
+
 /**
  * menu_select - selects the next idle state to enter
  * @dev: the CPU
@@ -251,6 +321,7 @@ static int menu_select(struct cpuidle_device *dev)
 
 	data->last_state_idx = 0;
 	data->exit_us = 0;
+	data->irqs_sum = kstat_cpu_irqs_sum(dev->cpu);
 
 	/* Special case when user has set very strict latency requirement */
 	if (unlikely(latency_req == 0))
@@ -277,6 +348,7 @@ static int menu_select(struct cpuidle_device *dev)
 	data->predicted_us = div_round64(data->expected_us * data->correction_factor[data->bucket],
 					 RESOLUTION * DECAY);
 
+	predict_from_histogram(data);
 	detect_repeating_patterns(data);
 
 	/*
@@ -323,6 +395,7 @@ static void menu_reflect(struct cpuidle_device *dev)
 {
 	struct menu_device *data = &__get_cpu_var(menu_devices);
 	data->needs_update = 1;
+	data->woke_by_irq = kstat_cpu_irqs_sum(dev->cpu) != data->irqs_sum;
 }
 
 /**
@@ -337,6 +410,7 @@ static void menu_update(struct cpuidle_device *dev)
 	struct cpuidle_state *target = &dev->states[last_idx];
 	unsigned int measured_us;
 	u64 new_factor;
+	int source, i, j;
 
 	/*
 	 * Ugh, this idle state doesn't support residency measurements, so we
@@ -384,6 +458,26 @@ static void menu_update(struct cpuidle_device *dev)
 	data->intervals[data->interval_ptr++] = last_idle_us;
 	if (data->interval_ptr >= INTERVALS)
 		data->interval_ptr = 0;
+
+	/*
+	 * Residency includes entry and exit, so having slept at least the
+	 * expected time means the timer got there first, whatever else
+	 * fired at about the same time.
+	 */
+	if (last_idle_us + data->exit_us >= data->expected_us)
+		source = MENU_WAKEUP_TIMER;
+	else if (data->woke_by_irq)
+		source = MENU_WAKEUP_IRQ;
+	else
+		source = MENU_WAKEUP_IPI;
+
+	for (i = 0; i < MENU_WAKEUP_SOURCES; i++)
+		for (j = 0; j < HIST_BINS; j++)
+			data->hist[i][j] -= data->hist[i][j] >> HIST_DECAY_SHIFT;
+	data->hist[source][which_hist_bin(measured_us)] += HIST_WEIGHT;
+
+	trace_cpu_idle_residency(dev->cpu, last_idx, source, data->expected_us,
+				 data->predicted_us, measured_us);
 }
 
 /**
@@ -1076,6 +1076,9 @@ struct ext4_super_block {
 #define EXT4_MF_MNTDIR_SAMPLED	0x0001
 #define EXT4_MF_FS_ABORTED	0x0002	/* Fatal error detected */
 
+/* Buckets of the mballoc latency and groups scanned histograms */
+#define EXT4_MB_HIST_BUCKETS	16
+
 /*
  * fourth extended-fs super-block data in memory
  */
@@ -1171,6 +1174,7 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_writeback_mb_bump;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -1192,6 +1196,17 @@ struct ext4_sb_info {
 	atomic_t s_mb_discarded;
 	atomic_t s_lock_busy;
 
+	/* groups indexed by the order of their largest free extent */
+	struct list_head *s_mb_largest_free_orders;
+	rwlock_t *s_mb_largest_free_orders_locks;
+	atomic_t s_mb_groups_initialized;
+	atomic_t s_mb_index_hits;	/* cr 0/1 served from the index */
+	atomic_t s_mb_index_misses;
+
+	/* per allocation histograms, log2 buckets */
+	atomic_t s_mb_alloc_lat[EXT4_MB_HIST_BUCKETS];		/* usecs */
+	atomic_t s_mb_alloc_scanned[EXT4_MB_HIST_BUCKETS];	/* groups */
+
 	/* locality groups */
 	struct ext4_locality_group __percpu *s_locality_groups;
 
@@ -2057,6 +2072,8 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_group_t	bb_group;	/* group number */
+	struct          list_head bb_largest_free_order_node;
 	struct          list_head bb_prealloc_list;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
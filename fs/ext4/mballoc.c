@@ -24,6 +24,7 @@
 #include "mballoc.h"
 #include <linux/debugfs.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
 #include <trace/events/ext4.h>
 
 /*
@@ -679,23 +680,42 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the matching s_mb_largest_free_orders list.
+ * Called with the group locked.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
+	int new = -1; /* uninit */
 	int i;
 	int bits;
 
-	grp->bb_largest_free_order = -1; /* uninit */
-
 	bits = sb->s_blocksize_bits + 1;
 	for (i = bits; i >= 0; i--) {
 		if (grp->bb_counters[i] > 0) {
-			grp->bb_largest_free_order = i;
+			new = i;
 			break;
 		}
 	}
+
+	if (new == old && (new < 0 ||
+			   !list_empty(&grp->bb_largest_free_order_node)))
+		return;
+
+	if (old >= 0 && !list_empty(&grp->bb_largest_free_order_node)) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	grp->bb_largest_free_order = new;
+	if (new >= 0) {
+		write_lock(&sbi->s_mb_largest_free_orders_locks[new]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[new]);
+		write_unlock(&sbi->s_mb_largest_free_orders_locks[new]);
+	}
 }
 
 static noinline_for_stack
@@ -742,7 +762,8 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 	}
 	mb_set_largest_free_order(sb, grp);
 
-	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
+	if (test_and_clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state)))
+		atomic_inc(&EXT4_SB(sb)->s_mb_groups_initialized);
 
 	period = get_cycles() - period;
 	spin_lock(&EXT4_SB(sb)->s_bal_lock);
@@ -1954,6 +1975,148 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Try to allocate from a single group with criteria cr. The result is
+ * left in ac->ac_status, an error is only returned if the buddy could
+ * not be loaded.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int err;
+
+	/* This now checks without needing the buddy page */
+	if (!ext4_mb_good_group(ac, group, cr))
+		return 0;
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, cr)) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(&e4b);
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+
+	return 0;
+}
+
+#define EXT4_MB_INDEX_BATCH	8
+
+/*
+ * Collect up to EXT4_MB_INDEX_BATCH groups below ngroups from the
+ * largest free order list of @order, starting *pos entries into it.
+ * *pos is advanced past the entries looked at.
+ */
+static int ext4_mb_index_batch(struct ext4_sb_info *sbi, int order,
+			       ext4_group_t ngroups, int *pos,
+			       ext4_group_t *groups)
+{
+	struct ext4_group_info *grp;
+	int skip = *pos;
+	int n = 0;
+
+	read_lock(&sbi->s_mb_largest_free_orders_locks[order]);
+	list_for_each_entry(grp, &sbi->s_mb_largest_free_orders[order],
+			    bb_largest_free_order_node) {
+		if (skip) {
+			skip--;
+			continue;
+		}
+		(*pos)++;
+		if (grp->bb_group >= ngroups)
+			continue;
+		groups[n++] = grp->bb_group;
+		if (n == EXT4_MB_INDEX_BATCH)
+			break;
+	}
+	read_unlock(&sbi->s_mb_largest_free_orders_locks[order]);
+
+	return n;
+}
+
+/*
+ * cr 0 and 1 only succeed in groups whose largest free extent is big
+ * enough, so rather than walking every group look them up in the
+ * largest free order index, smallest suitable order first to keep
+ * the large extents for the requests which need them. The goal group
+ * goes first though, for the locality of the goal and of streams.
+ */
+static int ext4_mb_scan_index(struct ext4_allocation_context *ac,
+			      ext4_group_t ngroups, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	ext4_group_t groups[EXT4_MB_INDEX_BATCH];
+	ext4_group_t goal = ac->ac_g_ex.fe_group;
+	ext4_group_t tried = 0;
+	int order, pos, n, i;
+	int err;
+
+	if (goal < ngroups) {
+		err = ext4_mb_scan_group(ac, goal, cr);
+		if (err || ac->ac_status != AC_STATUS_CONTINUE)
+			return err;
+	}
+
+	if (cr == 0)
+		order = ac->ac_2order;
+	else
+		order = fls(ac->ac_g_ex.fe_len) - 1;
+
+	for (; order < MB_NUM_ORDERS(sb); order++) {
+		pos = 0;
+		while ((n = ext4_mb_index_batch(sbi, order, ngroups,
+						&pos, groups))) {
+			for (i = 0; i < n; i++) {
+				if (groups[i] == goal)
+					continue;
+				err = ext4_mb_scan_group(ac, groups[i], cr);
+				if (err)
+					return err;
+				if (ac->ac_status != AC_STATUS_CONTINUE)
+					return 0;
+				/* the lists may churn under us */
+				if (++tried >= ngroups)
+					return 0;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void ext4_mb_hist_add(atomic_t *hist, u64 val)
+{
+	int i = val ? fls64(val) : 0;
+
+	if (i >= EXT4_MB_HIST_BUCKETS)
+		i = EXT4_MB_HIST_BUCKETS - 1;
+	atomic_inc(&hist[i]);
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
@@ -1963,9 +2126,14 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
 	struct ext4_buddy e4b;
+	ktime_t start = ktime_set(0, 0);
+	int stats;
 
 	sb = ac->ac_sb;
 	sbi = EXT4_SB(sb);
+	stats = sbi->s_mb_stats;
+	if (stats)
+		start = ktime_get();
 	ngroups = ext4_get_groups_count(sb);
 	/* non-extent files are limited to low blocks/groups */
 	if (!(ext4_test_inode_flag(ac->ac_inode, EXT4_INODE_EXTENTS)))
@@ -2019,6 +2187,25 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 repeat:
 	for (; cr < 4 && ac->ac_status == AC_STATUS_CONTINUE; cr++) {
 		ac->ac_criteria = cr;
+
+		if (cr < 2 && sbi->s_mb_optimize_scan) {
+			err = ext4_mb_scan_index(ac, ngroups, cr);
+			if (err)
+				goto out;
+			if (ac->ac_status != AC_STATUS_CONTINUE) {
+				atomic_inc(&sbi->s_mb_index_hits);
+				break;
+			}
+			atomic_inc(&sbi->s_mb_index_misses);
+			/*
+			 * Groups whose buddy was never loaded are not
+			 * indexed yet, only trust a miss once all are.
+			 */
+			if (atomic_read(&sbi->s_mb_groups_initialized) >=
+			    ext4_get_groups_count(sb))
+				continue;
+		}
+
 		/*
 		 * searching for the right group start
 		 * from the goal value specified
@@ -2029,38 +2216,10 @@ repeat:
 			if (group == ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			if (!ext4_mb_good_group(ac, group, cr))
-				continue;
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2092,6 +2251,12 @@ repeat:
 		}
 	}
 out:
+	if (stats) {
+		ext4_mb_hist_add(sbi->s_mb_alloc_lat,
+				 ktime_to_us(ktime_sub(ktime_get(), start)));
+		ext4_mb_hist_add(sbi->s_mb_alloc_scanned,
+				 ac->ac_groups_scanned);
+	}
 	return err;
 }
 
@@ -2194,6 +2359,59 @@ static const struct file_operations ext4_mb_seq_groups_fops = {
 	.release	= seq_release,
 };
 
+static void ext4_mb_seq_hist(struct seq_file *seq, const char *name,
+			     atomic_t *hist)
+{
+	int i;
+
+	seq_printf(seq, "%-18s %10s\n", name, "count");
+	for (i = 0; i < EXT4_MB_HIST_BUCKETS; i++) {
+		if (i == 0)
+			seq_printf(seq, "%18u", 0);
+		else if (i == EXT4_MB_HIST_BUCKETS - 1)
+			seq_printf(seq, "%8u -        inf", 1U << (i - 1));
+		else
+			seq_printf(seq, "%8u - %8u", 1U << (i - 1),
+				   (1U << i) - 1);
+		seq_printf(seq, " %10u\n", atomic_read(&hist[i]));
+	}
+}
+
+static int ext4_mb_seq_stats_show(struct seq_file *seq, void *v)
+{
+	struct super_block *sb = seq->private;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	seq_printf(seq, "mb_stats:           %u\n", sbi->s_mb_stats);
+	seq_printf(seq, "mb_optimize_scan:   %u\n", sbi->s_mb_optimize_scan);
+	seq_printf(seq, "groups_initialized: %u/%u\n",
+		   atomic_read(&sbi->s_mb_groups_initialized),
+		   ext4_get_groups_count(sb));
+	seq_printf(seq, "index_hits:         %u\n",
+		   atomic_read(&sbi->s_mb_index_hits));
+	seq_printf(seq, "index_misses:       %u\n",
+		   atomic_read(&sbi->s_mb_index_misses));
+	seq_printf(seq, "\n");
+	ext4_mb_seq_hist(seq, "latency_us", sbi->s_mb_alloc_lat);
+	seq_printf(seq, "\n");
+	ext4_mb_seq_hist(seq, "groups_scanned", sbi->s_mb_alloc_scanned);
+
+	return 0;
+}
+
+static int ext4_mb_seq_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ext4_mb_seq_stats_show, PDE(inode)->data);
+}
+
+static const struct file_operations ext4_mb_seq_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= ext4_mb_seq_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static struct kmem_cache *get_groupinfo_cache(int blocksize_bits)
 {
 	int cache_index = blocksize_bits - EXT4_MIN_BLOCK_LOG_SIZE;
@@ -2257,6 +2475,8 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	}
 
 	INIT_LIST_HEAD(&meta_group_info[i]->bb_prealloc_list);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	meta_group_info[i]->bb_group = group;
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
@@ -2438,6 +2658,25 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		goto out;
 	}
 
+	i = MB_NUM_ORDERS(sb) * sizeof(*sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	i = MB_NUM_ORDERS(sb) * sizeof(*sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = kmalloc(i, GFP_KERNEL);
+	if (sbi->s_mb_largest_free_orders_locks == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		rwlock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+
 	ret = ext4_groupinfo_create_slab(sb->s_blocksize);
 	if (ret < 0)
 		goto out;
@@ -2472,6 +2711,7 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
 	sbi->s_mb_group_prealloc = MB_DEFAULT_GROUP_PREALLOC;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 
 	sbi->s_locality_groups = alloc_percpu(struct ext4_locality_group);
 	if (sbi->s_locality_groups == NULL) {
@@ -2487,9 +2727,12 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		spin_lock_init(&lg->lg_prealloc_lock);
 	}
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
 		proc_create_data("mb_groups", S_IRUGO, sbi->s_proc,
 				 &ext4_mb_seq_groups_fops, sb);
+		proc_create_data("mb_stats", S_IRUGO, sbi->s_proc,
+				 &ext4_mb_seq_stats_fops, sb);
+	}
 
 	if (sbi->s_journal)
 		sbi->s_journal->j_commit_callback = release_blocks_on_commit;
@@ -2497,6 +2740,8 @@ out:
 	if (ret) {
 		kfree(sbi->s_mb_offsets);
 		kfree(sbi->s_mb_maxs);
+		kfree(sbi->s_mb_largest_free_orders);
+		kfree(sbi->s_mb_largest_free_orders_locks);
 	}
 	return ret;
 }
@@ -2528,8 +2773,10 @@ int ext4_mb_release(struct super_block *sb)
 	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	struct kmem_cache *cachep = get_groupinfo_cache(sb->s_blocksize_bits);
 
-	if (sbi->s_proc)
+	if (sbi->s_proc) {
+		remove_proc_entry("mb_stats", sbi->s_proc);
 		remove_proc_entry("mb_groups", sbi->s_proc);
+	}
 
 	if (sbi->s_group_info) {
 		for (i = 0; i < ngroups; i++) {
@@ -2551,6 +2798,8 @@ int ext4_mb_release(struct super_block *sb)
 	}
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
 	if (sbi->s_buddy_cache)
 		iput(sbi->s_buddy_cache);
 	if (sbi->s_mb_stats) {
@@ -94,6 +94,16 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * use the largest free order index for cr 0 and 1 group searches
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * buddy orders range from 0 to blocksize_bits + 1
+ */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from group_info */
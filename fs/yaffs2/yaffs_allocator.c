@@ -23,9 +23,10 @@ void yaffs_deinit_raw_tnodes_and_objs(struct yaffs_dev *dev)
 	dev = dev;
 }
 
-void yaffs_init_raw_tnodes_and_objs(struct yaffs_dev *dev)
+int yaffs_init_raw_tnodes_and_objs(struct yaffs_dev *dev)
 {
 	dev = dev;
+	return YAFFS_OK;
 }
 
 struct yaffs_tnode *yaffs_alloc_raw_tnode(struct yaffs_dev *dev)
@@ -39,6 +40,12 @@ void yaffs_free_raw_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 	kfree(tn);
 }
 
+int yaffs_tnodes_created(struct yaffs_dev *dev)
+{
+	dev = dev;
+	return 0;
+}
+
 void yaffs_init_raw_objs(struct yaffs_dev *dev)
 {
 	dev = dev;
@@ -64,21 +71,20 @@ void yaffs_free_raw_obj(struct yaffs_dev *dev, struct yaffs_obj *obj)
 
 #else
 
-struct yaffs_tnode_list {
-	struct yaffs_tnode_list *next;
-	struct yaffs_tnode *tnodes;
-};
-
 struct yaffs_obj_list {
 	struct yaffs_obj_list *next;
 	struct yaffs_obj *objects;
 };
 
+/*
+ * Tnodes come from a slab cache per device, sized to the device's tnode
+ * width, so that they are returned to the system as files shrink instead
+ * of being kept on a private free list until unmount.
+ */
 struct yaffs_allocator {
+	struct kmem_cache *tnode_cache;
+	char tnode_cache_name[32];
 	int n_tnodes_created;
-	struct yaffs_tnode *free_tnodes;
-	int n_free_tnodes;
-	struct yaffs_tnode_list *alloc_tnode_list;
 
 	int n_obj_created;
 	struct yaffs_obj *free_objs;
@@ -89,107 +95,46 @@ struct yaffs_allocator {
 
 static void yaffs_deinit_raw_tnodes(struct yaffs_dev *dev)
 {
-
 	struct yaffs_allocator *allocator =
 	    (struct yaffs_allocator *)dev->allocator;
 
-	struct yaffs_tnode_list *tmp;
-
 	if (!allocator) {
 		YBUG();
 		return;
 	}
 
-	while (allocator->alloc_tnode_list) {
-		tmp = allocator->alloc_tnode_list->next;
-
-		kfree(allocator->alloc_tnode_list->tnodes);
-		kfree(allocator->alloc_tnode_list);
-		allocator->alloc_tnode_list = tmp;
-
-	}
+	/* All tnodes must have been given back by now */
+	if (allocator->tnode_cache)
+		kmem_cache_destroy(allocator->tnode_cache);
 
-	allocator->free_tnodes = NULL;
-	allocator->n_free_tnodes = 0;
+	allocator->tnode_cache = NULL;
 	allocator->n_tnodes_created = 0;
 }
 
-static void yaffs_init_raw_tnodes(struct yaffs_dev *dev)
+static int yaffs_init_raw_tnodes(struct yaffs_dev *dev)
 {
+	static atomic_t n_caches = ATOMIC_INIT(0);
 	struct yaffs_allocator *allocator = dev->allocator;
 
-	if (allocator) {
-		allocator->alloc_tnode_list = NULL;
-		allocator->free_tnodes = NULL;
-		allocator->n_free_tnodes = 0;
-		allocator->n_tnodes_created = 0;
-	} else {
-		YBUG();
-	}
-}
-
-static int yaffs_create_tnodes(struct yaffs_dev *dev, int n_tnodes)
-{
-	struct yaffs_allocator *allocator =
-	    (struct yaffs_allocator *)dev->allocator;
-	int i;
-	struct yaffs_tnode *new_tnodes;
-	u8 *mem;
-	struct yaffs_tnode *curr;
-	struct yaffs_tnode *next;
-	struct yaffs_tnode_list *tnl;
-
 	if (!allocator) {
 		YBUG();
 		return YAFFS_FAIL;
 	}
 
-	if (n_tnodes < 1)
-		return YAFFS_OK;
-
-	/* make these things */
-
-	new_tnodes = kmalloc(n_tnodes * dev->tnode_size, GFP_NOFS);
-	mem = (u8 *) new_tnodes;
-
-	if (!new_tnodes) {
-		yaffs_trace(YAFFS_TRACE_ERROR,
-			"yaffs: Could not allocate Tnodes");
-		return YAFFS_FAIL;
-	}
-
-	/* New hookup for wide tnodes */
-	for (i = 0; i < n_tnodes - 1; i++) {
-		curr = (struct yaffs_tnode *)&mem[i * dev->tnode_size];
-		next = (struct yaffs_tnode *)&mem[(i + 1) * dev->tnode_size];
-		curr->internal[0] = next;
-	}
-
-	curr = (struct yaffs_tnode *)&mem[(n_tnodes - 1) * dev->tnode_size];
-	curr->internal[0] = allocator->free_tnodes;
-	allocator->free_tnodes = (struct yaffs_tnode *)mem;
-
-	allocator->n_free_tnodes += n_tnodes;
-	allocator->n_tnodes_created += n_tnodes;
-
-	/* Now add this bunch of tnodes to a list for freeing up.
-	 * NB If we can't add this to the management list it isn't fatal
-	 * but it just means we can't free this bunch of tnodes later.
-	 */
+	/* Device names need not be unique, cache names must be */
+	snprintf(allocator->tnode_cache_name,
+		 sizeof(allocator->tnode_cache_name), "yaffs_tnode_%d",
+		 atomic_inc_return(&n_caches));
+	allocator->tnode_cache = kmem_cache_create(allocator->tnode_cache_name,
+						   dev->tnode_size, 0, 0, NULL);
+	allocator->n_tnodes_created = 0;
 
-	tnl = kmalloc(sizeof(struct yaffs_tnode_list), GFP_NOFS);
-	if (!tnl) {
+	if (!allocator->tnode_cache) {
 		yaffs_trace(YAFFS_TRACE_ERROR,
-			"Could not add tnodes to management list");
+			"yaffs: Could not create tnode cache");
 		return YAFFS_FAIL;
-	} else {
-		tnl->tnodes = new_tnodes;
-		tnl->next = allocator->alloc_tnode_list;
-		allocator->alloc_tnode_list = tnl;
 	}
 
-	yaffs_trace(YAFFS_TRACE_ALLOCATE,"Tnodes added");
-
 	return YAFFS_OK;
 }
 
@@ -197,44 +142,45 @@ struct yaffs_tnode *yaffs_alloc_raw_tnode(struct yaffs_dev *dev)
 {
 	struct yaffs_allocator *allocator =
 	    (struct yaffs_allocator *)dev->allocator;
-	struct yaffs_tnode *tn = NULL;
+	struct yaffs_tnode *tn;
 
-	if (!allocator) {
+	if (!allocator || !allocator->tnode_cache) {
 		YBUG();
 		return NULL;
 	}
 
-	/* If there are none left make more */
-	if (!allocator->free_tnodes)
-		yaffs_create_tnodes(dev, YAFFS_ALLOCATION_NTNODES);
-
-	if (allocator->free_tnodes) {
-		tn = allocator->free_tnodes;
-		allocator->free_tnodes = allocator->free_tnodes->internal[0];
-		allocator->n_free_tnodes--;
-	}
+	tn = kmem_cache_alloc(allocator->tnode_cache, GFP_NOFS);
+	if (tn)
+		allocator->n_tnodes_created++;
+	else
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs: Could not allocate Tnodes");
 
 	return tn;
 }
 
-/* FreeTnode frees up a tnode and puts it back on the free list */
+/* FreeTnode gives a tnode back to the slab */
 void yaffs_free_raw_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 {
 	struct yaffs_allocator *allocator = dev->allocator;
 
-	if (!allocator) {
+	if (!allocator || !allocator->tnode_cache) {
 		YBUG();
 		return;
 	}
 
-	if (tn) {
-		tn->internal[0] = allocator->free_tnodes;
-		allocator->free_tnodes = tn;
-		allocator->n_free_tnodes++;
-	}
+	if (tn)
+		kmem_cache_free(allocator->tnode_cache, tn);
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
 }
 
+int yaffs_tnodes_created(struct yaffs_dev *dev)
+{
+	struct yaffs_allocator *allocator = dev->allocator;
+
+	return allocator ? allocator->n_tnodes_created : 0;
+}
+
 static void yaffs_init_raw_objs(struct yaffs_dev *dev)
 {
 	struct yaffs_allocator *allocator = dev->allocator;
@@ -377,7 +323,7 @@ void yaffs_deinit_raw_tnodes_and_objs(struct yaffs_dev *dev)
 	}
 }
 
-void yaffs_init_raw_tnodes_and_objs(struct yaffs_dev *dev)
+int yaffs_init_raw_tnodes_and_objs(struct yaffs_dev *dev)
 {
 	struct yaffs_allocator *allocator;
 
@@ -385,12 +331,14 @@ void yaffs_init_raw_tnodes_and_objs(struct yaffs_dev *dev)
 		allocator = kmalloc(sizeof(struct yaffs_allocator), GFP_NOFS);
 		if (allocator) {
 			dev->allocator = allocator;
-			yaffs_init_raw_tnodes(dev);
 			yaffs_init_raw_objs(dev);
+			return yaffs_init_raw_tnodes(dev);
 		}
 	} else {
 		YBUG();
 	}
+
+	return YAFFS_FAIL;
 }
 
 #endif
@@ -727,6 +727,8 @@ struct yaffs_tnode *yaffs_get_tnode(struct yaffs_dev *dev)
 	if (tn) {
 		memset(tn, 0, dev->tnode_size);
 		dev->n_tnodes++;
+		if (dev->n_tnodes > dev->n_tnodes_peak)
+			dev->n_tnodes_peak = dev->n_tnodes;
 	}
 
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
@@ -742,8 +744,43 @@ static void yaffs_free_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
 }
 
+static void yaffs_free_tnode_tree(struct yaffs_dev *dev,
+				  struct yaffs_tnode *tn, u32 level)
+{
+	int i;
+
+	if (!tn)
+		return;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			yaffs_free_tnode_tree(dev, tn->internal[i], level - 1);
+	}
+	yaffs_free_tnode(dev, tn);
+}
+
+/* Give back the tnode trees of all files so the tnode cache is empty */
+static void yaffs_free_all_tnodes(struct yaffs_dev *dev)
+{
+	struct yaffs_obj *obj;
+	struct yaffs_file_var *file_struct;
+	int i;
+
+	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+		list_for_each_entry(obj, &dev->obj_bucket[i].list, hash_link) {
+			if (obj->variant_type != YAFFS_OBJECT_TYPE_FILE)
+				continue;
+			file_struct = &obj->variant.file_variant;
+			yaffs_free_tnode_tree(dev, file_struct->top,
+					      file_struct->top_level);
+			file_struct->top = NULL;
+		}
+	}
+}
+
 static void yaffs_deinit_tnodes_and_objs(struct yaffs_dev *dev)
 {
+	yaffs_free_all_tnodes(dev);
 	yaffs_deinit_raw_tnodes_and_objs(dev);
 	dev->n_obj = 0;
 	dev->n_tnodes = 0;
@@ -2047,19 +2084,20 @@ static struct yaffs_obj *yaffs_create_fake_dir(struct yaffs_dev *dev,
 }
 
 
-static void yaffs_init_tnodes_and_objs(struct yaffs_dev *dev)
+static int yaffs_init_tnodes_and_objs(struct yaffs_dev *dev)
 {
 	int i;
 
 	dev->n_obj = 0;
 	dev->n_tnodes = 0;
-
-	yaffs_init_raw_tnodes_and_objs(dev);
+	dev->n_tnodes_peak = 0;
 
 	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
 		INIT_LIST_HEAD(&dev->obj_bucket[i].list);
 		dev->obj_bucket[i].count = 0;
 	}
+
+	return yaffs_init_raw_tnodes_and_objs(dev);
 }
 
 struct yaffs_obj *yaffs_find_or_create_by_number(struct yaffs_dev *dev,
@@ -4986,7 +5024,8 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	if (!init_failed && !yaffs_init_blocks(dev))
 		init_failed = 1;
 
-	yaffs_init_tnodes_and_objs(dev);
+	if (!yaffs_init_tnodes_and_objs(dev))
+		init_failed = 1;
 
 	if (!init_failed && !yaffs_create_initial_dir(dev))
 		init_failed = 1;
@@ -5019,7 +5058,8 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 				if (!init_failed && !yaffs_init_blocks(dev))
 					init_failed = 1;
 
-				yaffs_init_tnodes_and_objs(dev);
+				if (!yaffs_init_tnodes_and_objs(dev))
+					init_failed = 1;
 
 				if (!init_failed
 				    && !yaffs_create_initial_dir(dev))
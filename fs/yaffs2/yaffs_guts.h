@@ -60,7 +60,9 @@
 #define YAFFS_OBJECT_SPACE		0x40000
 #define YAFFS_MAX_OBJECT_ID		(YAFFS_OBJECT_SPACE -1)
 
-#define YAFFS_CHECKPOINT_VERSION 	4
+#define YAFFS_CHECKPOINT_VERSION 	5
+/* Oldest checkpoint version that can still be read (no object extension) */
+#define YAFFS_CHECKPOINT_VERSION_NO_EXT	4
 
 #ifdef CONFIG_YAFFS_UNICODE
 #define YAFFS_MAX_NAME_LENGTH		127
@@ -474,6 +476,26 @@ struct yaffs_checkpt_obj {
 	u32 size_or_equiv_obj;
 };
 
+/* yaffs_checkpt_obj_ext follows each yaffs_checkpt_obj since checkpoint
+ * version 5. It carries the object header details that would otherwise
+ * have to be lazy loaded from NAND, so that directory lookups and stat
+ * after a checkpointed mount don't need to read object headers.
+ */
+
+struct yaffs_checkpt_obj_ext {
+	int struct_type;
+	u8 has_details;		/* Details were in RAM when written */
+	u16 sum;
+	u32 yst_mode;
+	u32 yst_uid;
+	u32 yst_gid;
+	u32 yst_atime;
+	u32 yst_mtime;
+	u32 yst_ctime;
+	u32 yst_rdev;
+	YCHAR short_name[YAFFS_SHORT_NAME_LENGTH + 1];
+};
+
 /*--------------------- Temporary buffers ----------------
  *
  * These are chunk-sized working buffers. Each device has a few
@@ -547,6 +569,12 @@ struct yaffs_param {
 	int (*query_block_fn) (struct yaffs_dev * dev, int block_no,
 			       enum yaffs_block_state * state,
 			       u32 * seq_number);
+	/* Optional reentrant tags-only read into a caller supplied spare
+	 * buffer, used to read block tags from several threads at mount.
+	 */
+	int (*read_tags_buf_fn) (struct yaffs_dev * dev,
+				 int nand_chunk, struct yaffs_ext_tags * tags,
+				 u8 * spare);
 #endif
 
 	/* The remove_obj_fn function must be supplied by OS flavours that
@@ -574,6 +602,8 @@ struct yaffs_param {
 	int auto_unicode;
 #endif
 	int always_check_erased;	/* Force chunk erased check always on */
+
+	int n_scan_threads;	/* Threads reading block tags during a yaffs2 scan, <= 1 for none */
 };
 
 struct yaffs_dev {
@@ -629,6 +659,7 @@ struct yaffs_dev {
 	int checkpt_max_blocks;
 	u32 checkpt_sum;
 	u32 checkpt_xor;
+	int checkpt_has_ext;	/* checkpoint being read carries object extensions */
 
 	int checkpoint_blocks_required;	/* Number of blocks needed to store current checkpoint set */
 
@@ -650,6 +681,7 @@ struct yaffs_dev {
 	void *allocator;
 	int n_obj;
 	int n_tnodes;
+	int n_tnodes_peak;
 
 	int n_hardlinks;
 
@@ -734,6 +766,7 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 scan_time_ms;	/* Duration of the last backwards scan */
 
 };
 
@@ -0,0 +1,265 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Parallel tag reading for yaffs2_scan_backwards().
+ *
+ * The backwards scan visits the blocks in reverse sequence number order
+ * and reads the tags of every chunk before deciding what to do with it.
+ * The decisions have to be made in that order, but the tag reads don't, so
+ * a few worker threads read the tags of the next blocks into a small ring
+ * of slots while the scanner consumes them one block at a time.
+ *
+ * Workers only use the reentrant read_tags_buf_fn with their own spare
+ * buffer. Page read counts and chunk error handling are left to the
+ * scanner, which is single threaded.
+ *
+ * Off unless the yaffs_scan_threads module parameter is set above 1: MTD
+ * drivers that hold the chip for the whole of every read leave little to
+ * overlap, and then the threads only add overhead to the mount.
+ */
+
+#include <linux/kthread.h>
+#include <linux/wait.h>
+#include <linux/completion.h>
+
+#include "yaffs_guts.h"
+#include "yaffs_trace.h"
+#include "yaffs_packedtags2.h"
+#include "yaffs_scan_prefetch.h"
+
+/* Blocks read ahead per worker */
+#define YAFFS_PREFETCH_BLOCKS_PER_THREAD	2
+
+struct yaffs_prefetch_slot {
+	int iter;		/* scan position held, valid when ready */
+	int ready;
+	int *results;
+	struct yaffs_ext_tags *tags;
+};
+
+struct yaffs_scan_prefetch {
+	struct yaffs_dev *dev;
+	struct yaffs_block_index *block_index;
+	int n_blocks;
+
+	spinlock_t lock;
+	wait_queue_head_t wq;
+	int next;		/* next scan position to be read by a worker */
+	int consumed;		/* scan positions released by the scanner */
+	int abort;
+
+	int n_slots;
+	struct yaffs_prefetch_slot *slots;
+
+	atomic_t running;
+	struct completion done;
+};
+
+struct yaffs_prefetch_worker {
+	struct yaffs_scan_prefetch *pf;
+	u8 spare[sizeof(struct yaffs_packed_tags2)];
+};
+
+/*
+ * Scan position iter is block_index[n_blocks - 1 - iter], the scan runs
+ * from the highest sequence number down.
+ */
+static int yaffs_prefetch_block(struct yaffs_scan_prefetch *pf, int iter)
+{
+	return pf->block_index[pf->n_blocks - 1 - iter].block;
+}
+
+static int yaffs_prefetch_thread(void *data)
+{
+	struct yaffs_prefetch_worker *w = data;
+	struct yaffs_scan_prefetch *pf = w->pf;
+	struct yaffs_dev *dev = pf->dev;
+	struct yaffs_prefetch_slot *slot;
+	int chunks = dev->param.chunks_per_block;
+	int iter;
+	int blk;
+	int c;
+
+	while (1) {
+		spin_lock(&pf->lock);
+		if (pf->abort || pf->next >= pf->n_blocks) {
+			spin_unlock(&pf->lock);
+			break;
+		}
+		iter = pf->next++;
+		spin_unlock(&pf->lock);
+
+		/* Wait until the scanner has released the slot's last user */
+		wait_event(pf->wq, pf->abort ||
+			   iter < ACCESS_ONCE(pf->consumed) + pf->n_slots);
+		if (pf->abort)
+			break;
+
+		slot = &pf->slots[iter % pf->n_slots];
+		blk = yaffs_prefetch_block(pf, iter);
+
+		for (c = chunks - 1; c >= 0 && !pf->abort; c--)
+			slot->results[c] =
+			    dev->param.read_tags_buf_fn(dev,
+					blk * chunks + c - dev->chunk_offset,
+					&slot->tags[c], w->spare);
+
+		spin_lock(&pf->lock);
+		slot->iter = iter;
+		slot->ready = 1;
+		spin_unlock(&pf->lock);
+		wake_up_all(&pf->wq);
+	}
+
+	kfree(w);
+	if (atomic_dec_and_test(&pf->running))
+		complete(&pf->done);
+	return 0;
+}
+
+static void yaffs_prefetch_free(struct yaffs_scan_prefetch *pf)
+{
+	int i;
+
+	if (pf->slots) {
+		for (i = 0; i < pf->n_slots; i++) {
+			kfree(pf->slots[i].tags);
+			kfree(pf->slots[i].results);
+		}
+		kfree(pf->slots);
+	}
+	kfree(pf);
+}
+
+/*
+ * Start reading tags for the blocks in block_index, highest first.
+ * Returns NULL if prefetching is not possible on this device, in which
+ * case the scan should read tags itself.
+ */
+struct yaffs_scan_prefetch *yaffs_scan_prefetch_start(struct yaffs_dev *dev,
+					struct yaffs_block_index *block_index,
+					int n_blocks)
+{
+	struct yaffs_scan_prefetch *pf;
+	struct yaffs_prefetch_worker *w;
+	struct task_struct *task;
+	int n_threads = dev->param.n_scan_threads;
+	int chunks = dev->param.chunks_per_block;
+	int i;
+
+	if (n_threads <= 1 || n_blocks < 2 || !dev->param.read_tags_buf_fn ||
+	    dev->param.inband_tags)
+		return NULL;
+
+	if (n_threads > n_blocks)
+		n_threads = n_blocks;
+
+	pf = kzalloc(sizeof(*pf), GFP_NOFS);
+	if (!pf)
+		return NULL;
+
+	pf->dev = dev;
+	pf->block_index = block_index;
+	pf->n_blocks = n_blocks;
+	spin_lock_init(&pf->lock);
+	init_waitqueue_head(&pf->wq);
+	init_completion(&pf->done);
+
+	pf->n_slots = n_threads * YAFFS_PREFETCH_BLOCKS_PER_THREAD;
+	pf->slots = kcalloc(pf->n_slots, sizeof(*pf->slots), GFP_NOFS);
+	if (!pf->slots)
+		goto fail;
+
+	for (i = 0; i < pf->n_slots; i++) {
+		pf->slots[i].tags =
+		    kmalloc(chunks * sizeof(struct yaffs_ext_tags), GFP_NOFS);
+		pf->slots[i].results = kmalloc(chunks * sizeof(int), GFP_NOFS);
+		if (!pf->slots[i].tags || !pf->slots[i].results)
+			goto fail;
+	}
+
+	/* One reference for the starter, dropped once all threads are up */
+	atomic_set(&pf->running, 1);
+	for (i = 0; i < n_threads; i++) {
+		w = kzalloc(sizeof(*w), GFP_NOFS);
+		if (!w)
+			break;
+		w->pf = pf;
+		atomic_inc(&pf->running);
+		task = kthread_run(yaffs_prefetch_thread, w, "yaffs-scan/%d", i);
+		if (IS_ERR(task)) {
+			atomic_dec(&pf->running);
+			kfree(w);
+			break;
+		}
+	}
+
+	if (atomic_dec_and_test(&pf->running)) {
+		/* No thread could be started */
+		goto fail;
+	}
+
+	yaffs_trace(YAFFS_TRACE_SCAN,
+		"yaffs2 scan reading tags with %d threads", i);
+
+	return pf;
+
+fail:
+	yaffs_prefetch_free(pf);
+	return NULL;
+}
+
+/*
+ * Wait for the tags of scan position iter. Returns the tags of all chunks
+ * in the block, indexed by chunk, with the read results in results.
+ */
+struct yaffs_ext_tags *yaffs_scan_prefetch_wait(struct yaffs_scan_prefetch *pf,
+						int iter, int *results)
+{
+	struct yaffs_prefetch_slot *slot = &pf->slots[iter % pf->n_slots];
+	int chunks = pf->dev->param.chunks_per_block;
+
+	wait_event(pf->wq, ACCESS_ONCE(slot->ready) &&
+		   ACCESS_ONCE(slot->iter) == iter);
+	smp_rmb();
+
+	memcpy(results, slot->results, chunks * sizeof(int));
+	return slot->tags;
+}
+
+/* The scanner is done with scan position iter, its slot can be reused */
+void yaffs_scan_prefetch_release(struct yaffs_scan_prefetch *pf, int iter)
+{
+	struct yaffs_prefetch_slot *slot = &pf->slots[iter % pf->n_slots];
+
+	spin_lock(&pf->lock);
+	slot->ready = 0;
+	pf->consumed = iter + 1;
+	spin_unlock(&pf->lock);
+	wake_up_all(&pf->wq);
+}
+
+void yaffs_scan_prefetch_stop(struct yaffs_scan_prefetch *pf)
+{
+	if (!pf)
+		return;
+
+	spin_lock(&pf->lock);
+	pf->abort = 1;
+	spin_unlock(&pf->lock);
+	wake_up_all(&pf->wq);
+
+	wait_for_completion(&pf->done);
+	yaffs_prefetch_free(pf);
+}
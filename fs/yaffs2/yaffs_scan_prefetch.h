@@ -0,0 +1,36 @@
+/*
+ * YAFFS: Yet another Flash File System . A NAND-flash specific file system.
+ *
+ * Copyright (C) 2002-2010 Aleph One Ltd.
+ *   for Toby Churchill Ltd and Brightstar Engineering
+ *
+ * Created by Charles Manning <charles@aleph1.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 2.1 as
+ * published by the Free Software Foundation.
+ *
+ * Note: Only YAFFS headers are LGPL, YAFFS C code is covered by GPL.
+ */
+
+#ifndef __YAFFS_SCAN_PREFETCH_H__
+#define __YAFFS_SCAN_PREFETCH_H__
+
+#include "yaffs_guts.h"
+
+struct yaffs_block_index {
+	int seq;
+	int block;
+};
+
+struct yaffs_scan_prefetch;
+
+struct yaffs_scan_prefetch *yaffs_scan_prefetch_start(struct yaffs_dev *dev,
+					struct yaffs_block_index *block_index,
+					int n_blocks);
+struct yaffs_ext_tags *yaffs_scan_prefetch_wait(struct yaffs_scan_prefetch *pf,
+						int iter, int *results);
+void yaffs_scan_prefetch_release(struct yaffs_scan_prefetch *pf, int iter);
+void yaffs_scan_prefetch_stop(struct yaffs_scan_prefetch *pf);
+
+#endif
@@ -85,6 +85,7 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 #include "yaffs_trace.h"
 #include "yaffs_guts.h"
 #include "yaffs_attribs.h"
+#include "yaffs_allocator.h"
 
 #include "yaffs_linux.h"
 
@@ -97,6 +98,7 @@ unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+unsigned int yaffs_scan_threads;
 
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
@@ -104,6 +106,7 @@ module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_scan_threads, uint, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -2260,6 +2263,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	if (yaffs_version == 2) {
 		param->write_chunk_tags_fn = nandmtd2_write_chunk_tags;
 		param->read_chunk_tags_fn = nandmtd2_read_chunk_tags;
+		param->read_tags_buf_fn = nandmtd2_read_tags_buf;
+		param->n_scan_threads = yaffs_scan_threads;
 		param->bad_block_fn = nandmtd2_mark_block_bad;
 		param->query_block_fn = nandmtd2_query_block;
 		yaffs_dev_to_lc(dev)->spare_buffer = 
@@ -2459,6 +2464,12 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "blocks_in_checkpt..... %d\n", dev->blocks_in_checkpt);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes.............. %d\n", dev->n_tnodes);
+	buf += sprintf(buf, "n_tnodes_peak......... %d\n", dev->n_tnodes_peak);
+	buf += sprintf(buf, "n_tnodes_created...... %d\n",
+			yaffs_tnodes_created(dev));
+	buf += sprintf(buf, "tnode_size............ %d\n", dev->tnode_size);
+	buf += sprintf(buf, "tnode_bytes........... %d\n",
+			dev->n_tnodes * dev->tnode_size);
 	buf += sprintf(buf, "n_obj................. %d\n", dev->n_obj);
 	buf += sprintf(buf, "n_free_chunks......... %d\n", dev->n_free_chunks);
 	buf += sprintf(buf, "\n");
@@ -2486,6 +2497,7 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "scan_time_ms.......... %u\n", dev->scan_time_ms);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
@@ -20,6 +20,7 @@
 #include "yaffs_getblockinfo.h"
 #include "yaffs_verify.h"
 #include "yaffs_attribs.h"
+#include "yaffs_scan_prefetch.h"
 
 /*
  * Checkpoints are really no benefit on very small partitions.
@@ -227,6 +228,7 @@ int yaffs_calc_checkpt_blocks_required(struct yaffs_dev *dev)
 		n_bytes += dev_blocks * dev->chunk_bit_stride;
 		n_bytes +=
 		    (sizeof(struct yaffs_checkpt_obj) +
+		     sizeof(struct yaffs_checkpt_obj_ext) +
 		     sizeof(u32)) * (dev->n_obj);
 		n_bytes += (dev->tnode_size + sizeof(u32)) * (dev->n_tnodes);
 		n_bytes += sizeof(struct yaffs_checkpt_validity);
@@ -274,8 +276,14 @@ static int yaffs2_rd_checkpt_validity_marker(struct yaffs_dev *dev, int head)
 	if (ok)
 		ok = (cp.struct_type == sizeof(cp)) &&
 		    (cp.magic == YAFFS_MAGIC) &&
-		    (cp.version == YAFFS_CHECKPOINT_VERSION) &&
+		    (cp.version == YAFFS_CHECKPOINT_VERSION ||
+		     cp.version == YAFFS_CHECKPOINT_VERSION_NO_EXT) &&
 		    (cp.head == ((head) ? 1 : 0));
+
+	/* Older checkpoints don't carry object extensions */
+	if (ok && head)
+		dev->checkpt_has_ext =
+		    (cp.version != YAFFS_CHECKPOINT_VERSION_NO_EXT);
 	return ok ? 1 : 0;
 }
 
@@ -450,6 +458,54 @@ static int taffs2_checkpt_obj_to_obj(struct yaffs_obj *obj,
 	return 1;
 }
 
+static void yaffs2_obj_checkpt_obj_ext(struct yaffs_checkpt_obj_ext *cp,
+				       struct yaffs_obj *obj)
+{
+	memset(cp, 0, sizeof(*cp));
+	cp->struct_type = sizeof(*cp);
+
+	/* Nothing to save if the details were never loaded from NAND */
+	if (obj->lazy_loaded)
+		return;
+
+	cp->has_details = 1;
+	cp->sum = obj->sum;
+	cp->yst_mode = obj->yst_mode;
+	cp->yst_uid = obj->yst_uid;
+	cp->yst_gid = obj->yst_gid;
+	cp->yst_atime = obj->yst_atime;
+	cp->yst_mtime = obj->yst_mtime;
+	cp->yst_ctime = obj->yst_ctime;
+	cp->yst_rdev = obj->yst_rdev;
+#ifndef CONFIG_YAFFS_NO_SHORT_NAMES
+	memcpy(cp->short_name, obj->short_name, sizeof(cp->short_name));
+#endif
+}
+
+static void yaffs2_checkpt_obj_ext_to_obj(struct yaffs_obj *obj,
+					  struct yaffs_checkpt_obj_ext *cp)
+{
+	if (!cp->has_details)
+		return;
+
+	obj->sum = cp->sum;
+	obj->yst_mode = cp->yst_mode;
+	obj->yst_uid = cp->yst_uid;
+	obj->yst_gid = cp->yst_gid;
+	obj->yst_atime = cp->yst_atime;
+	obj->yst_mtime = cp->yst_mtime;
+	obj->yst_ctime = cp->yst_ctime;
+	obj->yst_rdev = cp->yst_rdev;
+#ifndef CONFIG_YAFFS_NO_SHORT_NAMES
+	memcpy(obj->short_name, cp->short_name, sizeof(obj->short_name));
+	obj->short_name[YAFFS_SHORT_NAME_LENGTH] = 0;
+#endif
+
+	/* Symlink aliases are not checkpointed, leave those to lazy loading */
+	if (obj->variant_type != YAFFS_OBJECT_TYPE_SYMLINK)
+		obj->lazy_loaded = 0;
+}
+
 static int yaffs2_checkpt_tnode_worker(struct yaffs_obj *in,
 				       struct yaffs_tnode *tn, u32 level,
 				       int chunk_offset)
@@ -558,6 +614,7 @@ static int yaffs2_wr_checkpt_objs(struct yaffs_dev *dev)
 {
 	struct yaffs_obj *obj;
 	struct yaffs_checkpt_obj cp;
+	struct yaffs_checkpt_obj_ext cp_ext;
 	int i;
 	int ok = 1;
 	struct list_head *lh;
@@ -584,6 +641,15 @@ static int yaffs2_wr_checkpt_objs(struct yaffs_dev *dev)
 					      (dev, &cp,
 					       sizeof(cp)) == sizeof(cp));
 
+					if (ok) {
+						yaffs2_obj_checkpt_obj_ext
+						    (&cp_ext, obj);
+						ok = (yaffs2_checkpt_wr
+						      (dev, &cp_ext,
+						       sizeof(cp_ext)) ==
+						      sizeof(cp_ext));
+					}
+
 					if (ok
 					    && obj->variant_type ==
 					    YAFFS_OBJECT_TYPE_FILE)
@@ -608,6 +674,7 @@ static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev)
 {
 	struct yaffs_obj *obj;
 	struct yaffs_checkpt_obj cp;
+	struct yaffs_checkpt_obj_ext cp_ext;
 	int ok = 1;
 	int done = 0;
 	struct yaffs_obj *hard_list = NULL;
@@ -636,6 +703,18 @@ static int yaffs2_rd_checkpt_objs(struct yaffs_dev *dev)
 				ok = taffs2_checkpt_obj_to_obj(obj, &cp);
 				if (!ok)
 					break;
+				if (dev->checkpt_has_ext) {
+					ok = (yaffs2_checkpt_rd
+					      (dev, &cp_ext,
+					       sizeof(cp_ext)) ==
+					      sizeof(cp_ext)) &&
+					    (cp_ext.struct_type ==
+					     sizeof(cp_ext));
+					if (!ok)
+						break;
+					yaffs2_checkpt_obj_ext_to_obj(obj,
+								      &cp_ext);
+				}
 				if (obj->variant_type == YAFFS_OBJECT_TYPE_FILE) {
 					ok = yaffs2_rd_checkpt_tnodes(obj);
 				} else if (obj->variant_type ==
@@ -937,11 +1016,6 @@ int yaffs2_handle_hole(struct yaffs_obj *obj, loff_t new_size)
 
 }
 
-struct yaffs_block_index {
-	int seq;
-	int block;
-};
-
 static int yaffs2_ybicmp(const void *a, const void *b)
 {
 	int aseq = ((struct yaffs_block_index *)a)->seq;
@@ -987,6 +1061,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
 
+	struct yaffs_scan_prefetch *pf = NULL;
+	struct yaffs_ext_tags *pf_tags = NULL;
+	int *pf_results = NULL;
+	unsigned long scan_start = jiffies;
+
 	yaffs_trace(YAFFS_TRACE_SCAN,
 		"yaffs2_scan_backwards starts  intstartblk %d intendblk %d...",
 		dev->internal_start_block, dev->internal_end_block);
@@ -1086,6 +1165,12 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	end_iter = n_to_scan - 1;
 	yaffs_trace(YAFFS_TRACE_SCAN_DEBUG, "%d blocks to scan", n_to_scan);
 
+	/* Have the tags of the next few blocks read ahead in parallel */
+	pf_results = kmalloc(dev->param.chunks_per_block * sizeof(int),
+			     GFP_NOFS);
+	if (pf_results)
+		pf = yaffs_scan_prefetch_start(dev, block_index, n_to_scan);
+
 	/* For each block.... backwards */
 	for (block_iter = end_iter; !alloc_failed && block_iter >= start_iter;
 	     block_iter--) {
@@ -1100,6 +1185,11 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 		state = bi->block_state;
 
+		if (pf)
+			pf_tags = yaffs_scan_prefetch_wait(pf,
+						end_iter - block_iter,
+						pf_results);
+
 		deleted = 0;
 
 		/* For each chunk in each block that needs scanning.... */
@@ -1114,8 +1204,22 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (pf) {
+				tags = pf_tags[c];
+				result = pf_results[c];
+				dev->n_page_reads++;
+				if (tags.ecc_result == YAFFS_ECC_RESULT_FIXED)
+					dev->n_ecc_fixed++;
+				else if (tags.ecc_result ==
+					 YAFFS_ECC_RESULT_UNFIXED)
+					dev->n_ecc_unfixed++;
+				if (tags.ecc_result >
+				    YAFFS_ECC_RESULT_NO_ERROR)
+					yaffs_handle_chunk_error(dev, bi);
+			} else {
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
+			}
 
 			/* Let's have a good look at this chunk... */
 
@@ -1571,8 +1675,13 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 			yaffs_block_became_dirty(dev, blk);
 		}
 
+		if (pf)
+			yaffs_scan_prefetch_release(pf, end_iter - block_iter);
 	}
 
+	yaffs_scan_prefetch_stop(pf);
+	kfree(pf_results);
+
 	yaffs_skip_rest_of_block(dev);
 
 	if (alt_block_index)
@@ -1589,6 +1698,8 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	yaffs_release_temp_buffer(dev, chunk_data, __LINE__);
 
+	dev->scan_time_ms = jiffies_to_msecs(jiffies - scan_start);
+
 	if (alloc_failed)
 		return YAFFS_FAIL;
 
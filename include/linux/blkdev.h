@@ -8,6 +8,7 @@
 #include <linux/genhd.h>
 #include <linux/list.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <linux/workqueue.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
@@ -223,6 +224,13 @@ enum blk_queue_state {
 	Queue_up,
 };
 
+struct blk_gather_stats {
+	unsigned long		gathered;	/* async writes held back */
+	unsigned long		merged;		/* merged on release */
+	unsigned long		flushes;	/* gather lists released */
+	u64			latency_us;	/* total time writes were held */
+};
+
 struct blk_queue_tag {
 	struct request **tag_index;	/* map of busy tags */
 	unsigned long *tag_map;		/* bit map of free/busy tags */
@@ -383,6 +391,20 @@ struct request_queue
 	/* Throttle data */
 	struct throtl_data *td;
 #endif
+
+#ifdef CONFIG_BLK_WRITE_GATHER
+	/*
+	 * async write gathering, see block/blk-gather.c
+	 */
+	struct list_head	gather_list;
+	unsigned int		gather_nr;
+	unsigned int		gather_usecs;
+	unsigned int		gather_max;
+	u64			gather_stamp_sum;
+	struct hrtimer		gather_timer;
+	struct work_struct	gather_work;
+	struct blk_gather_stats	gather_stats;
+#endif
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
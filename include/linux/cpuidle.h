@@ -99,6 +99,7 @@ struct cpuidle_device {
 };
 
 DECLARE_PER_CPU(struct cpuidle_device *, cpuidle_devices);
+DECLARE_PER_CPU(unsigned int, cpuidle_exit_latency);
 
 /**
  * cpuidle_get_last_residency - retrieves the last state's residency time
@@ -134,6 +135,19 @@ extern void cpuidle_resume_and_unlock(void);
 extern int cpuidle_enable_device(struct cpuidle_device *dev);
 extern void cpuidle_disable_device(struct cpuidle_device *dev);
 
+/**
+ * cpuidle_cpu_exit_latency - exit latency of the state a cpu idles in
+ * @cpu: the target CPU
+ *
+ * Returns the exit latency (in US) of the state @cpu entered through
+ * cpuidle, or 0 while it is not idle.  The value is read without any
+ * locking, so it can be stale by the time the caller acts on it.
+ */
+static inline unsigned int cpuidle_cpu_exit_latency(int cpu)
+{
+	return ACCESS_ONCE(per_cpu(cpuidle_exit_latency, cpu));
+}
+
 #else
 
 static inline int cpuidle_register_driver(struct cpuidle_driver *drv)
@@ -149,6 +163,7 @@ static inline void cpuidle_resume_and_unlock(void) { }
 static inline int cpuidle_enable_device(struct cpuidle_device *dev)
 {return -ENODEV; }
 static inline void cpuidle_disable_device(struct cpuidle_device *dev) { }
+static inline unsigned int cpuidle_cpu_exit_latency(int cpu) {return 0; }
 
 #endif
 
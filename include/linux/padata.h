@@ -37,19 +37,24 @@
  * @list: List entry, to attach to the padata lists.
  * @pd: Pointer to the internal control structure.
  * @cb_cpu: Callback cpu for serializatioon.
+ * @cpu: Cpu whose queues the object was hashed to; it may be parallel
+ *       processed elsewhere, but is always reordered from this cpu's queue.
  * @seq_nr: Sequence number of the parallelized data object.
  * @info: Used to pass information from the parallel to the serial function.
  * @parallel: Parallel execution function.
  * @serial: Serial complete function.
+ * @reorder_stamp: local_clock() when the object entered the reorder queue.
  */
 struct padata_priv {
 	struct list_head	list;
 	struct parallel_data	*pd;
 	int			cb_cpu;
+	int			cpu;
 	int			seq_nr;
 	int			info;
 	void                    (*parallel)(struct padata_priv *padata);
 	void                    (*serial)(struct padata_priv *padata);
+	u64			reorder_stamp;
 };
 
 /**
@@ -86,7 +91,7 @@ struct padata_serial_queue {
  * @swork: work struct for serialization.
  * @pd: Backpointer to the internal control structure.
  * @work: work struct for parallelization.
- * @num_obj: Number of objects that are processed by this cpu.
+ * @num_obj: Number of objects waiting in the parallel queue.
  * @cpu_index: Index of the cpu.
  */
 struct padata_parallel_queue {
@@ -139,6 +144,29 @@ struct parallel_data {
 	struct timer_list		timer;
 };
 
+#define PADATA_REORDER_BUCKETS 8
+
+/**
+ * struct padata_stats - Reorder statistics of a padata instance.
+ *
+ * @reordered: Number of objects passed on to the serial workers.
+ * @stolen: Number of objects parallel processed by a cpu other than
+ *          the one they were queued on.
+ * @reorder_ns: Total time objects spent waiting in the reorder queues.
+ * @reorder_max_ns: Longest time an object spent in the reorder queues.
+ * @reorder_hist: Histogram of reorder waits, in powers of four of
+ *                microseconds starting below 4us.
+ *
+ * All but @stolen are updated under the reorder lock.
+ */
+struct padata_stats {
+	unsigned long			reordered;
+	atomic_t			stolen;
+	u64				reorder_ns;
+	u64				reorder_max_ns;
+	unsigned long			reorder_hist[PADATA_REORDER_BUCKETS];
+};
+
 /**
  * struct padata_instance - The overall control structure.
  *
@@ -150,6 +178,7 @@ struct parallel_data {
  *            callbacks that will be called when either @pcpu or @cbcpu
  *            or both cpumasks change.
  * @kobj: padata instance kernel object.
+ * @stats: Reorder statistics.
  * @lock: padata instance lock.
  * @flags: padata flags.
  */
@@ -160,6 +189,7 @@ struct padata_instance {
 	struct padata_cpumask		cpumask;
 	struct blocking_notifier_head	 cpumask_change_notifier;
 	struct kobject                   kobj;
+	struct padata_stats		 stats;
 	struct mutex			 lock;
 	u8				 flags;
 #define	PADATA_INIT	1
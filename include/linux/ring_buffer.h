@@ -174,6 +174,26 @@ void ring_buffer_free_read_page(struct ring_buffer *buffer, void *data);
 int ring_buffer_read_page(struct ring_buffer *buffer, void **data_page,
 			  size_t len, int cpu, int full);
 
+/* Streaming of buffer pages to one file per cpu */
+#define RING_BUFFER_STREAM_MAX_PAGES	256
+
+struct ring_buffer_stream;
+
+struct ring_buffer_stream_stats {
+	unsigned long		pages;		/* pages written to the file */
+	unsigned long long	bytes;		/* bytes written to the file */
+	unsigned long		overrun;	/* events lost while streaming */
+	unsigned long		errors;		/* failed or short writes */
+};
+
+struct ring_buffer_stream *
+ring_buffer_stream_start(struct ring_buffer *buffer, const char *prefix,
+			 unsigned int flush_pages, unsigned int flush_ms);
+void ring_buffer_stream_stop(struct ring_buffer_stream *stream,
+			     struct ring_buffer_stream_stats *total);
+int ring_buffer_stream_stats(struct ring_buffer_stream *stream, int cpu,
+			     struct ring_buffer_stream_stats *stats);
+
 struct trace_seq;
 
 int ring_buffer_print_entry_header(struct trace_seq *s);
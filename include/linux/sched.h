@@ -141,6 +141,7 @@ extern unsigned long nr_uninterruptible(void);
 extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
+extern u64 sched_get_nr_running_integral(int cpu, u64 *running, u64 *waiting);
 
 
 extern void calc_global_load(unsigned long ticks);
@@ -1166,6 +1167,19 @@ struct sched_statistics {
 };
 #endif
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity load tracking: geometric series of the time an entity was
+ * runnable (and running), in ~1ms periods with y^32 = 1/2.
+ */
+struct sched_avg {
+	u64 last_runnable_update;
+	u32 runnable_avg_sum, runnable_avg_period;
+	u32 usage_avg_sum;
+	unsigned long load_avg_contrib;
+};
+#endif
+
 struct sched_entity {
 	struct load_weight	load;		/* for load-balancing */
 	struct rb_node		run_node;
@@ -1190,6 +1204,10 @@ struct sched_entity {
 	/* rq "owned" by this entity/group: */
 	struct cfs_rq		*my_q;
 #endif
+
+#ifdef CONFIG_SMP
+	struct sched_avg	avg;
+#endif
 };
 
 struct sched_rt_entity {
@@ -2053,6 +2071,27 @@ extern struct task_struct *idle_task(int cpu);
 extern struct task_struct *curr_task(int cpu);
 extern void set_curr_task(int cpu, struct task_struct *p);
 
+/*
+ * Frequency hint from the fair class, called when task p is woken up on
+ * or migrated to cpu, with its recent utilisation as a fraction of
+ * SCHED_POWER_SCALE. Called with the runqueue locked and interrupts
+ * disabled, so it must not sleep or wake anything up directly.
+ */
+typedef void (*sched_freq_hint_fn)(int cpu, struct task_struct *p,
+				   unsigned long util);
+#ifdef CONFIG_SMP
+extern int sched_register_freq_hint(sched_freq_hint_fn fn);
+extern void sched_unregister_freq_hint(sched_freq_hint_fn fn);
+#else
+static inline int sched_register_freq_hint(sched_freq_hint_fn fn)
+{
+	return -ENOSYS;
+}
+static inline void sched_unregister_freq_hint(sched_freq_hint_fn fn)
+{
+}
+#endif
+
 void yield(void);
 
 /*
@@ -94,6 +94,7 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct splice_pipe_desc;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -249,6 +250,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* Datagrams, each segment gets its own UDP header. */
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -1882,11 +1886,21 @@ extern int	       skb_store_bits(struct sk_buff *skb, int offset,
 extern __wsum	       skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      __wsum csum);
+extern ssize_t	       skb_socket_splice(struct sock *sk,
+					 struct pipe_inode_info *pipe,
+					 struct splice_pipe_desc *spd);
 extern int             skb_splice_bits(struct sk_buff *skb,
-						unsigned int offset,
-						struct pipe_inode_info *pipe,
-						unsigned int len,
-						unsigned int flags);
+					struct sock *sk,
+					unsigned int offset,
+					struct pipe_inode_info *pipe,
+					unsigned int len,
+					unsigned int flags,
+					ssize_t (*splice_cb)(struct sock *,
+						struct pipe_inode_info *,
+						struct splice_pipe_desc *));
+extern int	       skb_append_pagefrags(struct sk_buff *skb,
+					    struct page *page,
+					    int offset, size_t size);
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
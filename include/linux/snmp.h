@@ -232,6 +232,8 @@ enum
 	LINUX_MIB_TCPTIMEWAITOVERFLOW,		/* TCPTimeWaitOverflow */
 	LINUX_MIB_TCPCHALLENGEACK,		/* TCPChallengeACK */
 	LINUX_MIB_TCPSYNCHALLENGE,		/* TCPSYNChallenge */
+	LINUX_MIB_TCPSMALLQUEUETHROTTLE,	/* TCPSmallQueueThrottle */
+	LINUX_MIB_TCPPACINGDEFER,		/* TCPPacingDefer */
 	__LINUX_MIB_MAX
 };
 
@@ -207,6 +207,7 @@ struct tcp_cookie_transactions {
 
 #include <linux/skbuff.h>
 #include <linux/dmaengine.h>
+#include <linux/hrtimer.h>
 #include <net/sock.h>
 #include <net/inet_connection_sock.h>
 #include <net/inet_timewait_sock.h>
@@ -332,6 +333,16 @@ struct tcp_sock {
 #endif
 	} ucopy;
 
+	/* TCP small queues, see tcp_wfree() */
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+	unsigned long	tsq_flags;
+
+	/* Pacing, see tcp_pacing_check() */
+	u32	pacing_rate;	/* bytes per second, 0 until we have an srtt */
+	u32	pacing_srtt_us;	/* smoothed RTT in usecs << 3, 0 if none	*/
+	ktime_t	pacing_next;	/* earliest time to send the next skb	*/
+	struct hrtimer	pacing_timer;
+
 	u32	snd_wl1;	/* Sequence for window update		*/
 	u32	snd_wnd;	/* The window we expect to receive	*/
 	u32	max_window;	/* Maximal window ever seen from peer	*/
@@ -462,6 +473,12 @@ struct tcp_sock {
 	struct tcp_cookie_values  *cookie_values;
 };
 
+enum tsq_flags {
+	TSQ_THROTTLED,	/* hit the limit, waiting for an skb to be freed */
+	TSQ_QUEUED,	/* queued on the per cpu tsq tasklet */
+	TCP_TSQ_DEFERRED, /* tasklet found the socket owned by the user */
+};
+
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 {
 	return (struct tcp_sock *)sk;
@@ -74,6 +74,18 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
+/* Protects expectations, helper assignments and the dying list */
 extern spinlock_t nf_conntrack_lock ;
 
+/*
+ * Insertions into and removals from the hash table only take the lock of
+ * the bucket(s) involved: nf_conntrack_locks[bucket % CONNTRACK_LOCKS].
+ * Take it with nf_conntrack_bucket_lock() and BHs disabled, and recheck
+ * the table size afterwards, it may have been resized in the meantime.
+ */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
+
 #endif /* _NF_CONNTRACK_CORE_H */
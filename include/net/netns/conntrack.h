@@ -3,11 +3,18 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+/* Conntracks not yet in the hash table, on the cpu that created them */
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
@@ -15,7 +22,7 @@ struct netns_ct {
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
+	struct ct_pcpu __percpu	*pcpu_lists;
 	struct hlist_nulls_head	dying;
 	struct ip_conntrack_stat __percpu *stat;
 	int			sysctl_events;
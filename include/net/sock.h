@@ -103,6 +103,7 @@ typedef struct {
 struct sock;
 struct proto;
 struct net;
+struct sock_tag;
 
 /**
  *	struct sock_common - minimal network layer representation of sockets
@@ -228,6 +229,7 @@ struct sock_common {
   *	@sk_security: used by security modules
   *	@sk_mark: generic packet mark
   *	@sk_classid: this socket's cgroup classid
+  *	@sk_qtaguid_tag: xt_qtaguid accounting tag of this socket, if any
   *	@sk_write_pending: a write to stream socket waits to start
   *	@sk_state_change: callback to indicate change in the state of the sock
   *	@sk_data_ready: callback to indicate there is data to be processed
@@ -340,6 +342,9 @@ struct sock {
 #endif
 	__u32			sk_mark;
 	u32			sk_classid;
+#ifdef CONFIG_NETFILTER_XT_MATCH_QTAGUID
+	struct sock_tag __rcu	*sk_qtaguid_tag;
+#endif
 	void			(*sk_state_change)(struct sock *sk);
 	void			(*sk_data_ready)(struct sock *sk, int bytes);
 	void			(*sk_write_space)(struct sock *sk);
@@ -772,6 +777,8 @@ struct proto {
 	int			(*backlog_rcv) (struct sock *sk, 
 						struct sk_buff *skb);
 
+	void			(*release_cb)(struct sock *sk);
+
 	/* Keeping track of sk's, looking them up, and port selection methods. */
 	void			(*hash)(struct sock *sk);
 	void			(*unhash)(struct sock *sk);
@@ -103,6 +103,9 @@ static inline struct udp_hslot *udp_hashslot2(struct udp_table *table,
 /* Default, as per the RFC, is to always do csums. */
 #define UDP_CSUM_DEFAULT	0
 
+/* Most datagrams a single UDP_SEGMENT send may be cut into. */
+#define UDP_MAX_SEGMENTS	(1 << 6UL)
+
 extern struct proto udp_prot;
 
 extern atomic_long_t udp_memory_allocated;
@@ -82,6 +82,87 @@ DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
 	    TP_ARGS(cpu_id, load, curtarg, curactual, newtarg)
 );
 
+TRACE_EVENT(cpufreq_interactive_decision,
+	    TP_PROTO(unsigned long cpu_id, unsigned long load,
+		     unsigned long targetload, unsigned long curtarg,
+		     unsigned long newtarg, const char *reason),
+	    TP_ARGS(cpu_id, load, targetload, curtarg, newtarg, reason),
+
+	    TP_STRUCT__entry(
+		    __field(unsigned long, cpu_id     )
+		    __field(unsigned long, load       )
+		    __field(unsigned long, targetload )
+		    __field(unsigned long, curtarg    )
+		    __field(unsigned long, newtarg    )
+		    __string(reason, reason)
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->load = load;
+		    __entry->targetload = targetload;
+		    __entry->curtarg = curtarg;
+		    __entry->newtarg = newtarg;
+		    __assign_str(reason, reason);
+	    ),
+
+	    TP_printk("cpu=%lu load=%lu target_load=%lu cur=%lu targ=%lu "
+		      "reason=%s",
+		      __entry->cpu_id, __entry->load, __entry->targetload,
+		      __entry->curtarg, __entry->newtarg, __get_str(reason))
+);
+
+TRACE_EVENT(cpufreq_interactive_hint,
+	    TP_PROTO(unsigned long cpu_id, pid_t pid, unsigned long load,
+		     unsigned long curtarg, unsigned long newtarg),
+	    TP_ARGS(cpu_id, pid, load, curtarg, newtarg),
+
+	    TP_STRUCT__entry(
+		    __field(unsigned long, cpu_id    )
+		    __field(pid_t,         pid       )
+		    __field(unsigned long, load      )
+		    __field(unsigned long, curtarg   )
+		    __field(unsigned long, newtarg   )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->pid = pid;
+		    __entry->load = load;
+		    __entry->curtarg = curtarg;
+		    __entry->newtarg = newtarg;
+	    ),
+
+	    TP_printk("cpu=%lu pid=%d load=%lu cur=%lu targ=%lu",
+		      __entry->cpu_id, __entry->pid, __entry->load,
+		      __entry->curtarg, __entry->newtarg)
+);
+
+TRACE_EVENT(cpufreq_interactive_hint_done,
+	    TP_PROTO(unsigned long cpu_id, unsigned long targfreq,
+		     unsigned long actualfreq, u64 latency_us),
+	    TP_ARGS(cpu_id, targfreq, actualfreq, latency_us),
+
+	    TP_STRUCT__entry(
+		    __field(unsigned long, cpu_id     )
+		    __field(unsigned long, targfreq   )
+		    __field(unsigned long, actualfreq )
+		    __field(u64,           latency_us )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->targfreq = targfreq;
+		    __entry->actualfreq = actualfreq;
+		    __entry->latency_us = latency_us;
+	    ),
+
+	    TP_printk("cpu=%lu targ=%lu actual=%lu latency=%lluus",
+		      __entry->cpu_id, __entry->targfreq,
+		      __entry->actualfreq,
+		      (unsigned long long)__entry->latency_us)
+);
+
 TRACE_EVENT(cpufreq_interactive_boost,
 	    TP_PROTO(const char *s),
 	    TP_ARGS(s),
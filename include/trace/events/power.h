@@ -34,6 +34,43 @@ DEFINE_EVENT(cpu, cpu_idle,
 	TP_ARGS(state, cpu_id)
 );
 
+TRACE_EVENT(cpu_idle_residency,
+
+	TP_PROTO(unsigned int cpu_id, unsigned int state, unsigned int source,
+		 unsigned int expected_us, unsigned int predicted_us,
+		 unsigned int measured_us),
+
+	TP_ARGS(cpu_id, state, source, expected_us, predicted_us, measured_us),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cpu_id		)
+		__field(	u32,		state		)
+		__field(	u32,		source		)
+		__field(	u32,		expected_us	)
+		__field(	u32,		predicted_us	)
+		__field(	u32,		measured_us	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu_id = cpu_id;
+		__entry->state = state;
+		__entry->source = source;
+		__entry->expected_us = expected_us;
+		__entry->predicted_us = predicted_us;
+		__entry->measured_us = measured_us;
+	),
+
+	TP_printk("cpu_id=%lu state=%lu wakeup=%s expected_us=%lu "
+		  "predicted_us=%lu measured_us=%lu",
+		  (unsigned long)__entry->cpu_id,
+		  (unsigned long)__entry->state,
+		  __print_symbolic(__entry->source,
+				   { 0, "timer" }, { 1, "ipi" }, { 2, "irq" }),
+		  (unsigned long)__entry->expected_us,
+		  (unsigned long)__entry->predicted_us,
+		  (unsigned long)__entry->measured_us)
+);
+
 /* This file can get included multiple times, TRACE_HEADER_MULTI_READ at top */
 #ifndef _PWR_EVENT_AVOID_DOUBLE_DEFINING
 #define _PWR_EVENT_AVOID_DOUBLE_DEFINING
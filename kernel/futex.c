@@ -60,6 +60,8 @@
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
 #include <linux/ptrace.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -67,7 +69,13 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+/*
+ * The hash table is sized at boot: 256 buckets per possible cpu, capped
+ * so that it never takes more than 1/1024th of memory. It can be
+ * overridden with futex_hashsize= on the kernel command line.
+ */
+#define FUTEX_BUCKETS_PER_CPU	(CONFIG_BASE_SMALL ? 16 : 256)
+#define FUTEX_HASH_MEM_SHIFT	10
 
 /*
  * Futex flags used to encode options to functions and preserve them across
@@ -144,11 +152,61 @@ static const struct futex_q futex_q_init = {
  * waiting on a futex.
  */
 struct futex_hash_bucket {
+	atomic_t waiters;
 	spinlock_t lock;
 	struct plist_head chain;
-};
+} ____cacheline_aligned_in_smp;
+
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned long futex_hashsize __read_mostly;
+
+static int __init setup_futex_hashsize(char *str)
+{
+	unsigned long size;
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+	if (strict_strtoul(str, 0, &size) || !size)
+		return 0;
+	futex_hashsize = roundup_pow_of_two(size);
+	return 1;
+}
+__setup("futex_hashsize=", setup_futex_hashsize);
+
+/*
+ * Waiter accounting, so that futex_wake() can tell that a bucket is
+ * empty without taking its lock.
+ *
+ * A waiter is counted before it takes hb->lock in queue_lock() and
+ * before it reads the futex value, and stays counted until it is
+ * removed from hb->chain (or gives up in queue_unlock()). The waker
+ * changes the futex value before it gets the futex key, and
+ * get_futex_key_refs() implies a full barrier. So either the waker
+ * sees the waiter counted, or the waiter sees the new futex value and
+ * does not sleep.
+ */
+static inline void hb_waiters_inc(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_SMP
+	atomic_inc(&hb->waiters);
+	/* Pairs with the barrier in get_futex_key_refs() */
+	smp_mb__after_atomic_inc();
+#endif
+}
+
+static inline void hb_waiters_dec(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_SMP
+	atomic_dec(&hb->waiters);
+#endif
+}
+
+static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
+{
+#ifdef CONFIG_SMP
+	return atomic_read(&hb->waiters);
+#else
+	return 1;
+#endif
+}
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
@@ -158,7 +216,7 @@ static struct futex_hash_bucket *hash_futex(union futex_key *key)
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+	return &futex_queues[hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -182,13 +240,20 @@ static void get_futex_key_refs(union futex_key *key)
 	if (!key->both.ptr)
 		return;
 
+	/*
+	 * Every path must imply a full barrier, futex_wake() relies on it
+	 * to see the waiter count (see hb_waiters_inc()).
+	 */
 	switch (key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED)) {
 	case FUT_OFF_INODE:
-		ihold(key->shared.inode);
+		ihold(key->shared.inode); /* implies smp_mb() */
 		break;
 	case FUT_OFF_MMSHARED:
 		atomic_inc(&key->private.mm->mm_count);
+		smp_mb__after_atomic_inc();
 		break;
+	default:
+		smp_mb();
 	}
 }
 
@@ -946,6 +1011,7 @@ static void __unqueue_futex(struct futex_q *q)
 
 	hb = container_of(q->lock_ptr, struct futex_hash_bucket, lock);
 	plist_del(&q->list, &hb->chain);
+	hb_waiters_dec(hb);
 }
 
 /*
@@ -1103,6 +1169,11 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 		goto out;
 
 	hb = hash_futex(&key);
+
+	/* Nobody is waiting in this bucket, don't bother with the lock */
+	if (!hb_waiters_pending(hb))
+		goto out_put_key;
+
 	spin_lock(&hb->lock);
 	head = &hb->chain;
 
@@ -1124,6 +1195,7 @@ futex_wake(u32 __user *uaddr, unsigned int flags, int nr_wake, u32 bitset)
 	}
 
 	spin_unlock(&hb->lock);
+out_put_key:
 	put_futex_key(&key);
 out:
 	return ret;
@@ -1247,7 +1319,9 @@ void requeue_futex(struct futex_q *q, struct futex_hash_bucket *hb1,
 	 */
 	if (likely(&hb1->chain != &hb2->chain)) {
 		plist_del(&q->list, &hb1->chain);
+		hb_waiters_dec(hb1);
 		plist_add(&q->list, &hb2->chain);
+		hb_waiters_inc(hb2);
 		q->lock_ptr = &hb2->lock;
 	}
 	get_futex_key_refs(key2);
@@ -1439,6 +1513,12 @@ retry:
 	hb2 = hash_futex(&key2);
 
 retry_private:
+	/*
+	 * Waiters are moved over to hb2 under both locks, count it as
+	 * busy for the duration so a concurrent futex_wake() on key2
+	 * does not skip it.
+	 */
+	hb_waiters_inc(hb2);
 	double_lock_hb(hb1, hb2);
 
 	if (likely(cmpval != NULL)) {
@@ -1448,6 +1528,7 @@ retry_private:
 
 		if (unlikely(ret)) {
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 
 			ret = get_user(curval, uaddr1);
 			if (ret)
@@ -1506,6 +1587,7 @@ retry_private:
 			break;
 		case -EFAULT:
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 			put_futex_key(&key2);
 			put_futex_key(&key1);
 			ret = fault_in_user_writeable(uaddr2);
@@ -1515,6 +1597,7 @@ retry_private:
 		case -EAGAIN:
 			/* The owner was exiting, try again. */
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 			put_futex_key(&key2);
 			put_futex_key(&key1);
 			cond_resched();
@@ -1591,6 +1674,7 @@ retry_private:
 
 out_unlock:
 	double_unlock_hb(hb1, hb2);
+	hb_waiters_dec(hb2);
 
 	/*
 	 * drop_futex_key_refs() must be called outside the spinlocks. During
@@ -1620,6 +1704,11 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	hb = hash_futex(&q->key);
 	q->lock_ptr = &hb->lock;
 
+	/*
+	 * Count ourselves before looking at the futex value, the count is
+	 * dropped in queue_unlock() or once we are taken off hb->chain.
+	 */
+	hb_waiters_inc(hb);
 	spin_lock(&hb->lock);
 	return hb;
 }
@@ -1629,6 +1718,7 @@ queue_unlock(struct futex_q *q, struct futex_hash_bucket *hb)
 	__releases(&hb->lock)
 {
 	spin_unlock(&hb->lock);
+	hb_waiters_dec(hb);
 }
 
 /**
@@ -2362,6 +2452,7 @@ int handle_early_requeue_pi_wakeup(struct futex_hash_bucket *hb,
 		 * Unqueue the futex_q and determine which it was.
 		 */
 		plist_del(&q->list, &hb->chain);
+		hb_waiters_dec(hb);
 
 		/* Handle spurious wakeups gracefully */
 		ret = -EWOULDBLOCK;
@@ -2885,8 +2976,10 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 static int __init futex_init(void)
 {
+	unsigned long limit;
+	unsigned int futex_shift;
 	u32 curval;
-	int i;
+	unsigned long i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2901,7 +2994,20 @@ static int __init futex_init(void)
 	if (cmpxchg_futex_value_locked(&curval, NULL, 0, 0) == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
+	if (!futex_hashsize)
+		futex_hashsize = roundup_pow_of_two(FUTEX_BUCKETS_PER_CPU *
+						    num_possible_cpus());
+
+	limit = (totalram_pages << PAGE_SHIFT) >> FUTEX_HASH_MEM_SHIFT;
+	limit = max(limit / sizeof(*futex_queues), 16UL);
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       futex_hashsize, 0, 0,
+					       &futex_shift, NULL, limit);
+	futex_hashsize = 1UL << futex_shift;
+
+	for (i = 0; i < futex_hashsize; i++) {
+		atomic_set(&futex_queues[i].waiters, 0);
 		plist_head_init(&futex_queues[i].chain);
 		spin_lock_init(&futex_queues[i].lock);
 	}
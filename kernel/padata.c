@@ -59,33 +59,74 @@ static int padata_cpu_hash(struct padata_priv *padata)
 	return padata_index_to_cpu(pd, cpu_index);
 }
 
+static struct padata_priv *padata_dequeue_parallel(
+	struct padata_parallel_queue *pqueue)
+{
+	struct padata_priv *padata = NULL;
+
+	spin_lock(&pqueue->parallel.lock);
+	if (!list_empty(&pqueue->parallel.list)) {
+		padata = list_entry(pqueue->parallel.list.next,
+				    struct padata_priv, list);
+		list_del_init(&padata->list);
+		atomic_dec(&pqueue->num_obj);
+	}
+	spin_unlock(&pqueue->parallel.lock);
+
+	return padata;
+}
+
+/*
+ * Take the oldest object from the parallel queue with the most objects
+ * waiting. A cpu that falls behind holds up the reordering of everything
+ * queued after its objects, so the others help out once they are idle.
+ */
+static struct padata_priv *padata_steal(struct parallel_data *pd,
+					struct padata_parallel_queue *pqueue)
+{
+	struct padata_parallel_queue *victim = NULL, *queue;
+	struct padata_priv *padata;
+	int cpu, num_obj, max_obj = 0;
+
+	for_each_cpu(cpu, pd->cpumask.pcpu) {
+		queue = per_cpu_ptr(pd->pqueue, cpu);
+		num_obj = atomic_read(&queue->num_obj);
+		if (queue != pqueue && num_obj > max_obj) {
+			max_obj = num_obj;
+			victim = queue;
+		}
+	}
+
+	if (!victim)
+		return NULL;
+
+	padata = padata_dequeue_parallel(victim);
+	if (padata)
+		atomic_inc(&pd->pinst->stats.stolen);
+
+	return padata;
+}
+
 static void padata_parallel_worker(struct work_struct *parallel_work)
 {
 	struct padata_parallel_queue *pqueue;
 	struct parallel_data *pd;
-	struct padata_instance *pinst;
-	LIST_HEAD(local_list);
+	struct padata_priv *padata;
 
 	local_bh_disable();
 	pqueue = container_of(parallel_work,
 			      struct padata_parallel_queue, work);
 	pd = pqueue->pd;
-	pinst = pd->pinst;
 
-	spin_lock(&pqueue->parallel.lock);
-	list_replace_init(&pqueue->parallel.list, &local_list);
-	spin_unlock(&pqueue->parallel.lock);
-
-	while (!list_empty(&local_list)) {
-		struct padata_priv *padata;
-
-		padata = list_entry(local_list.next,
-				    struct padata_priv, list);
-
-		list_del_init(&padata->list);
+	/*
+	 * Objects are dequeued one at a time rather than spliced off, so
+	 * that they can still be stolen while this cpu works through them.
+	 */
+	while ((padata = padata_dequeue_parallel(pqueue)))
+		padata->parallel(padata);
 
+	while ((padata = padata_steal(pd, pqueue)))
 		padata->parallel(padata);
-	}
 
 	local_bh_enable();
 }
@@ -138,10 +179,12 @@ int padata_do_parallel(struct padata_instance *pinst,
 	padata->seq_nr = atomic_inc_return(&pd->seq_nr);
 
 	target_cpu = padata_cpu_hash(padata);
+	padata->cpu = target_cpu;
 	queue = per_cpu_ptr(pd->pqueue, target_cpu);
 
 	spin_lock(&queue->parallel.lock);
 	list_add_tail(&padata->list, &queue->parallel.list);
+	atomic_inc(&queue->num_obj);
 	spin_unlock(&queue->parallel.lock);
 
 	queue_work_on(target_cpu, pinst->wq, &queue->work);
@@ -154,86 +197,114 @@ out:
 EXPORT_SYMBOL(padata_do_parallel);
 
 /*
- * padata_get_next - Get the next object that needs serialization.
- *
- * Return values are:
- *
- * A pointer to the control struct of the next object that needs
- * serialization, if present in one of the percpu reorder queues.
- *
- * NULL, if all percpu reorder queues are empty.
- *
- * -EINPROGRESS, if the next object that needs serialization will
- *  be parallel processed by another cpu and is not yet present in
- *  the cpu's reorder queue.
- *
- * -ENODATA, if this cpu has to do the parallel processing for
- *  the next object.
+ * Calculate the percpu reorder queue and the sequence number of the next
+ * object. Called with the reorder lock held, or locklessly as a hint.
  */
-static struct padata_priv *padata_get_next(struct parallel_data *pd)
+static struct padata_parallel_queue *padata_next_queue(struct parallel_data *pd,
+						       int *next_nr)
 {
 	int cpu, num_cpus;
-	int next_nr, next_index;
-	struct padata_parallel_queue *queue, *next_queue;
-	struct padata_priv *padata;
-	struct padata_list *reorder;
+	int nr, index;
 
 	num_cpus = cpumask_weight(pd->cpumask.pcpu);
 
-	/*
-	 * Calculate the percpu reorder queue and the sequence
-	 * number of the next object.
-	 */
-	next_nr = pd->processed;
-	next_index = next_nr % num_cpus;
-	cpu = padata_index_to_cpu(pd, next_index);
-	next_queue = per_cpu_ptr(pd->pqueue, cpu);
-
-	if (unlikely(next_nr > pd->max_seq_nr)) {
-		next_nr = next_nr - pd->max_seq_nr - 1;
-		next_index = next_nr % num_cpus;
-		cpu = padata_index_to_cpu(pd, next_index);
-		next_queue = per_cpu_ptr(pd->pqueue, cpu);
-		pd->processed = 0;
-	}
+	nr = pd->processed;
+	if (unlikely(nr > pd->max_seq_nr))
+		nr = nr - pd->max_seq_nr - 1;
 
-	padata = NULL;
+	index = nr % num_cpus;
+	cpu = padata_index_to_cpu(pd, index);
+	*next_nr = nr;
 
-	reorder = &next_queue->reorder;
-
-	if (!list_empty(&reorder->list)) {
-		padata = list_entry(reorder->list.next,
-				    struct padata_priv, list);
+	return per_cpu_ptr(pd->pqueue, cpu);
+}
 
-		BUG_ON(next_nr != padata->seq_nr);
+/*
+ * Find the object with sequence number @next_nr in @reorder, optionally
+ * taking it off the list. With stealing, the objects hashed to one cpu
+ * may finish out of order, so it is not necessarily the first one.
+ */
+static struct padata_priv *padata_find_next(struct parallel_data *pd,
+					    struct padata_list *reorder,
+					    int next_nr, bool remove)
+{
+	struct padata_priv *padata, *found = NULL;
 
-		spin_lock(&reorder->lock);
-		list_del_init(&padata->list);
+	spin_lock(&reorder->lock);
+	list_for_each_entry(padata, &reorder->list, list) {
+		if (padata->seq_nr == next_nr) {
+			found = padata;
+			break;
+		}
+	}
+	if (found && remove) {
+		list_del_init(&found->list);
 		atomic_dec(&pd->reorder_objects);
-		spin_unlock(&reorder->lock);
+	}
+	spin_unlock(&reorder->lock);
 
-		pd->processed++;
+	return found;
+}
 
-		goto out;
-	}
+/*
+ * padata_get_next - Get the next object that needs serialization.
+ *
+ * Return values are:
+ *
+ * A pointer to the control struct of the next object that needs
+ * serialization, if present in its percpu reorder queue.
+ *
+ * -EINPROGRESS, if the next object that needs serialization is still
+ *  being parallel processed, or waiting to be, and is not yet present
+ *  in the reorder queue.
+ */
+static struct padata_priv *padata_get_next(struct parallel_data *pd)
+{
+	struct padata_parallel_queue *next_queue;
+	struct padata_priv *padata;
+	int next_nr;
 
-	queue = per_cpu_ptr(pd->pqueue, smp_processor_id());
-	if (queue->cpu_index == next_queue->cpu_index) {
-		padata = ERR_PTR(-ENODATA);
-		goto out;
-	}
+	next_queue = padata_next_queue(pd, &next_nr);
+	if (unlikely(next_nr != pd->processed))
+		pd->processed = next_nr;
+
+	padata = padata_find_next(pd, &next_queue->reorder, next_nr, true);
+	if (!padata)
+		return ERR_PTR(-EINPROGRESS);
+
+	pd->processed++;
 
-	padata = ERR_PTR(-EINPROGRESS);
-out:
 	return padata;
 }
 
+/* Time spent in the reorder queue, called with the reorder lock held. */
+static void padata_account_reorder(struct padata_instance *pinst,
+				   struct padata_priv *padata)
+{
+	struct padata_stats *stats = &pinst->stats;
+	u64 wait = local_clock() - padata->reorder_stamp;
+	u64 limit = 4 * NSEC_PER_USEC;
+	int i;
+
+	stats->reordered++;
+	stats->reorder_ns += wait;
+	if (wait > stats->reorder_max_ns)
+		stats->reorder_max_ns = wait;
+
+	for (i = 0; i < PADATA_REORDER_BUCKETS - 1 && wait >= limit; i++)
+		limit <<= 2;
+	stats->reorder_hist[i]++;
+}
+
 static void padata_reorder(struct parallel_data *pd)
 {
 	struct padata_priv *padata;
 	struct padata_serial_queue *squeue;
 	struct padata_instance *pinst = pd->pinst;
+	struct padata_parallel_queue *next_queue;
+	int next_nr;
 
+again:
 	/*
 	 * We need to ensure that only one cpu can work on dequeueing of
 	 * the reorder queue the time. Calculating in which percpu reorder
@@ -251,24 +322,14 @@ static void padata_reorder(struct parallel_data *pd)
 		padata = padata_get_next(pd);
 
 		/*
-		 * All reorder queues are empty, or the next object that needs
-		 * serialization is parallel processed by another cpu and is
-		 * still on it's way to the cpu's reorder queue, nothing to
-		 * do for now.
+		 * The next object that needs serialization is parallel
+		 * processed by some cpu and is still on it's way to the
+		 * reorder queue, nothing to do for now.
 		 */
-		if (!padata || PTR_ERR(padata) == -EINPROGRESS)
+		if (IS_ERR(padata))
 			break;
 
-		/*
-		 * This cpu has to do the parallel processing of the next
-		 * object. It's waiting in the cpu's parallelization queue,
-		 * so exit immediately.
-		 */
-		if (PTR_ERR(padata) == -ENODATA) {
-			del_timer(&pd->timer);
-			spin_unlock_bh(&pd->lock);
-			return;
-		}
+		padata_account_reorder(pinst, padata);
 
 		squeue = per_cpu_ptr(pd->squeue, padata->cb_cpu);
 
@@ -282,9 +343,19 @@ static void padata_reorder(struct parallel_data *pd)
 	spin_unlock_bh(&pd->lock);
 
 	/*
-	 * The next object that needs serialization might have arrived to
-	 * the reorder queues in the meantime, we will be called again
-	 * from the timer function if no one else cares for it.
+	 * The next object may have been queued by a cpu that failed the
+	 * trylock while we held the lock. The barrier pairs with the one in
+	 * padata_do_serial(): either that cpu sees the lock released, or we
+	 * see its object here.
+	 */
+	smp_mb();
+	next_queue = padata_next_queue(pd, &next_nr);
+	if (padata_find_next(pd, &next_queue->reorder, next_nr, false))
+		goto again;
+
+	/*
+	 * Otherwise we will be called again from the timer function if no
+	 * one else cares for it.
 	 */
 	if (atomic_read(&pd->reorder_objects)
 			&& !(pinst->flags & PADATA_RESET))
@@ -340,21 +411,20 @@ static void padata_serial_worker(struct work_struct *serial_work)
  */
 void padata_do_serial(struct padata_priv *padata)
 {
-	int cpu;
 	struct padata_parallel_queue *pqueue;
 	struct parallel_data *pd;
 
 	pd = padata->pd;
-
-	cpu = get_cpu();
-	pqueue = per_cpu_ptr(pd->pqueue, cpu);
+	pqueue = per_cpu_ptr(pd->pqueue, padata->cpu);
+	padata->reorder_stamp = local_clock();
 
 	spin_lock(&pqueue->reorder.lock);
 	atomic_inc(&pd->reorder_objects);
 	list_add_tail(&padata->list, &pqueue->reorder.list);
 	spin_unlock(&pqueue->reorder.lock);
 
-	put_cpu();
+	/* Pairs with the barrier in padata_reorder(). */
+	smp_mb();
 
 	padata_reorder(pd);
 }
@@ -987,17 +1057,46 @@ out:
 	static struct padata_sysfs_entry _name##_attr = \
 		__ATTR(_name, 0400, _show_name, NULL)
 
+static ssize_t show_reorder_stats(struct padata_instance *pinst,
+				  struct attribute *attr, char *buf)
+{
+	struct padata_stats *stats = &pinst->stats;
+	unsigned long reordered = stats->reordered;
+	ssize_t len;
+	int i;
+
+	len = sprintf(buf, "reordered: %lu\nstolen: %u\n", reordered,
+		      atomic_read(&stats->stolen));
+	len += sprintf(buf + len, "avg_us: %llu\nmax_us: %llu\n",
+		       reordered ?
+		       div_u64(div_u64(stats->reorder_ns, reordered),
+			       NSEC_PER_USEC) : 0,
+		       div_u64(stats->reorder_max_ns, NSEC_PER_USEC));
+
+	for (i = 0; i < PADATA_REORDER_BUCKETS - 1; i++)
+		len += sprintf(buf + len, "<%lu us: %lu\n", 4UL << (2 * i),
+			       stats->reorder_hist[i]);
+	len += sprintf(buf + len, ">=%lu us: %lu\n", 4UL << (2 * i - 2),
+		       stats->reorder_hist[i]);
+
+	return len;
+}
+
 PADATA_ATTR_RW(serial_cpumask, show_cpumask, store_cpumask);
 PADATA_ATTR_RW(parallel_cpumask, show_cpumask, store_cpumask);
+PADATA_ATTR_RO(reorder_stats, show_reorder_stats);
 
 /*
  * Padata sysfs provides the following objects:
  * serial_cpumask   [RW] - cpumask for serial workers
  * parallel_cpumask [RW] - cpumask for parallel workers
+ * reorder_stats    [RO] - time objects wait to be reordered, and how
+ *                         many were stolen by idle parallel workers
  */
 static struct attribute *padata_default_attrs[] = {
 	&serial_cpumask_attr.attr,
 	&parallel_cpumask_attr.attr,
+	&reorder_stats_attr.attr,
 	NULL,
 };
 
@@ -41,6 +41,10 @@
 #include <linux/cpu.h>
 #include <linux/notifier.h>
 #include <linux/rculist.h>
+#include <linux/kthread.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
 
 #include <asm/uaccess.h>
 
@@ -146,6 +150,15 @@ EXPORT_SYMBOL(console_set_on_cmdline);
 /* Flag: console code may call schedule() */
 static int console_may_schedule;
 
+/* Pushes the printk() output to the consoles, see printk_sync_output() */
+static struct task_struct *printk_kthread;
+static int printk_output_pending;
+
+#define PRINTK_PENDING_WAKEUP	0x01
+#define PRINTK_PENDING_OUTPUT	0x02
+
+static DEFINE_PER_CPU(int, printk_pending);
+
 #ifdef CONFIG_PRINTK
 
 static char __log_buf[__LOG_BUF_LEN];
@@ -154,6 +167,229 @@ static int log_buf_len = __LOG_BUF_LEN;
 static unsigned logged_chars; /* Number of chars produced since last read+clear operation */
 static int saved_console_loglevel = -1;
 
+/*
+ * printk() does not write into log_buf directly. Every line is stored
+ * as a record in a lockless multi-writer ring, tagged with a sequence
+ * number and a timestamp:
+ *
+ *  - a writer reserves a sequence number with an atomic increment of
+ *    printk_head, which also picks its slot, claims the slot with a
+ *    cmpxchg on its state word, fills it in and marks it committed.
+ *  - readers copy a record out and check that its state did not change
+ *    meanwhile, i.e. that it was not overwritten by a writer one lap
+ *    ahead. Nothing ever waits for a reader.
+ *  - a writer that finds its slot still owned by a writer one lap behind
+ *    drops its record, and notes its sequence number in the slot so that
+ *    readers skip it rather than wait for it.
+ *
+ * Writers run with interrupts disabled, so only an NMI or a crash can
+ * keep a reserved record from being committed shortly after. Readers
+ * wait for such records, except during an oops, when the writer may
+ * never come back: they wait a little and then commit it as it is.
+ *
+ * Records are moved into log_buf (for syslog(2), kmsg_dump and the
+ * consoles) by log_sync_records() under logbuf_lock. Outside of early
+ * boot, oopses and shutdown that happens from the tick and from a
+ * kernel thread which also does the console output, so that printk()
+ * callers never wait for a slow console. /dev/kmsg readers consume
+ * the records directly, by sequence number.
+ */
+#define PRINTK_RING_SIZE	(1 << CONFIG_PRINTK_RING_SHIFT)
+#define PRINTK_RING_MASK	(PRINTK_RING_SIZE - 1)
+#define PRINTK_REC_TEXT		128
+
+/* Record state: sequence number and ownership */
+#define REC_RESERVED		1UL	/* a writer is filling it in */
+#define REC_COMMITTED		2UL	/* complete, may be read */
+#define REC_STATE_FLAGS		3UL
+#define REC_STATE(seq, f)	(((seq) << 2) | (f))
+
+/* Record flags */
+#define REC_LINE_START		0x01	/* explicit log level, starts a line */
+#define REC_LINE_END		0x02	/* the line ends after this record */
+
+struct printk_rec {
+	unsigned long state;
+	unsigned long dropped;		/* last sequence number dropped here */
+	u64 ts_nsec;
+	u16 prefix;			/* syslog priority, facility and level */
+	u8 flags;
+	u8 len;
+	char text[PRINTK_REC_TEXT];
+};
+
+static struct printk_rec printk_ring[PRINTK_RING_SIZE];
+
+/* Next sequence number to hand out, 0 is never used */
+static atomic_long_t printk_head = ATOMIC_LONG_INIT(1);
+
+/* Records dropped because a writer a lap behind still owned their slot */
+static atomic_t printk_ring_dropped = ATOMIC_INIT(0);
+
+/* How long an oops waits for a reserved record before committing it */
+#define PRINTK_OOPS_WAIT_USECS	1000
+
+/* Is the record in @state newer than sequence number @seq? */
+static inline bool rec_state_after(unsigned long state, unsigned long seq)
+{
+	return (long)((state & ~REC_STATE_FLAGS) - REC_STATE(seq, 0)) > 0;
+}
+
+static inline unsigned long printk_ring_first(void)
+{
+	unsigned long head = atomic_long_read(&printk_head);
+
+	return head > PRINTK_RING_SIZE + 1 ? head - PRINTK_RING_SIZE : 1;
+}
+
+static void printk_ring_store(unsigned int prefix, u8 flags, u64 ts_nsec,
+			      const char *text, size_t len)
+{
+	struct printk_rec *r;
+	unsigned long seq, old;
+
+	seq = atomic_long_inc_return(&printk_head) - 1;
+	r = &printk_ring[seq & PRINTK_RING_MASK];
+
+	old = ACCESS_ONCE(r->state);
+	if (unlikely((old & REC_RESERVED) || rec_state_after(old, seq) ||
+		     cmpxchg(&r->state, old,
+			     REC_STATE(seq, REC_RESERVED)) != old)) {
+		ACCESS_ONCE(r->dropped) = seq;
+		atomic_inc(&printk_ring_dropped);
+		return;
+	}
+
+	r->ts_nsec = ts_nsec;
+	r->prefix = prefix;
+	r->flags = flags;
+	r->len = len;
+	memcpy(r->text, text, len);
+
+	smp_wmb();
+	r->state = REC_STATE(seq, REC_COMMITTED);
+}
+
+/*
+ * Where is the record with sequence number @seq? Returns 0 if it is
+ * committed, -EAGAIN if it is not yet, -EPIPE if it has already been
+ * overwritten and -ENOENT if its writer dropped it.
+ */
+static int printk_rec_check(struct printk_rec *r, unsigned long seq)
+{
+	unsigned long head = atomic_long_read(&printk_head);
+	unsigned long state;
+
+	if (seq == head)
+		return -EAGAIN;
+	if (head - seq > PRINTK_RING_SIZE)
+		return -EPIPE;
+
+	state = ACCESS_ONCE(r->state);
+	if (state == REC_STATE(seq, REC_COMMITTED))
+		return 0;
+	if (rec_state_after(state, seq))
+		return -EPIPE;
+	smp_rmb();
+	if (ACCESS_ONCE(r->dropped) == seq)
+		return -ENOENT;
+	return -EAGAIN;
+}
+
+/*
+ * Copy out the record with sequence number @seq. Returns an error from
+ * printk_rec_check() if there is nothing to copy.
+ */
+static int printk_ring_read(unsigned long seq, struct printk_rec *rec)
+{
+	struct printk_rec *r = &printk_ring[seq & PRINTK_RING_MASK];
+	unsigned long want = REC_STATE(seq, REC_COMMITTED);
+	int ret;
+
+	ret = printk_rec_check(r, seq);
+	if (ret)
+		return ret;
+	smp_rmb();
+
+	rec->ts_nsec = r->ts_nsec;
+	rec->prefix = r->prefix;
+	rec->flags = r->flags;
+	rec->len = min_t(u8, r->len, PRINTK_REC_TEXT);
+	memcpy(rec->text, r->text, rec->len);
+
+	smp_rmb();
+	if (ACCESS_ONCE(r->state) != want)
+		return -EPIPE;
+
+	return 0;
+}
+
+/* Will printk_ring_next() return something other than -EAGAIN? */
+static bool printk_ring_ready(unsigned long seq)
+{
+	return printk_rec_check(&printk_ring[seq & PRINTK_RING_MASK],
+				seq) != -EAGAIN;
+}
+
+/*
+ * During an oops, the writer of a reserved record may have been stopped
+ * or be the code that crashed. Give it a moment, then commit whatever it
+ * got to rather than lose what is probably part of the oops.
+ */
+static int printk_ring_read_oops(unsigned long seq, struct printk_rec *rec)
+{
+	struct printk_rec *r = &printk_ring[seq & PRINTK_RING_MASK];
+	int i, ret;
+
+	for (i = 0; i < PRINTK_OOPS_WAIT_USECS; i++) {
+		ret = printk_ring_read(seq, rec);
+		if (ret != -EAGAIN)
+			return ret;
+		udelay(1);
+	}
+
+	cmpxchg(&r->state, REC_STATE(seq, REC_RESERVED),
+		REC_STATE(seq, REC_COMMITTED));
+	ret = printk_ring_read(seq, rec);
+
+	/* not even reserved, it is lost */
+	return ret == -EAGAIN ? -EPIPE : ret;
+}
+
+/*
+ * Read the record at *@seq and advance *@seq. On -EPIPE, *@seq has been
+ * moved past the lost records instead, on -ENOENT past the one dropped.
+ */
+static int printk_ring_next(unsigned long *seq, struct printk_rec *rec)
+{
+	unsigned long first;
+	int ret;
+
+	ret = printk_ring_read(*seq, rec);
+	if (ret == -EAGAIN && oops_in_progress &&
+	    *seq != atomic_long_read(&printk_head))
+		ret = printk_ring_read_oops(*seq, rec);
+
+	switch (ret) {
+	case 0:
+	case -ENOENT:
+		(*seq)++;
+		break;
+	case -EPIPE:
+		first = printk_ring_first();
+		if ((long)(first - *seq) > 0)
+			*seq = first;
+		else
+			(*seq)++;
+		break;
+	}
+
+	return ret;
+}
+
+static void log_sync_records(void);
+static void log_sync(void);
+
 #ifdef CONFIG_KEXEC
 /*
  * This appends the listed symbols to /proc/vmcoreinfo
@@ -323,6 +559,7 @@ int log_buf_copy(char *dest, int idx, int len)
 		took_lock = true;
 	}
 
+	log_sync_records();
 	max = log_buf_get_len();
 	if (idx < 0 || idx >= max) {
 		ret = -1;
@@ -411,6 +648,7 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 			error = -EFAULT;
 			goto out;
 		}
+		log_sync();
 		error = wait_event_interruptible(log_wait,
 							(log_start - log_end));
 		if (error)
@@ -451,6 +689,7 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 		if (count > log_buf_len)
 			count = log_buf_len;
 		spin_lock_irq(&logbuf_lock);
+		log_sync_records();
 		if (count > logged_chars)
 			count = logged_chars;
 		if (do_clear)
@@ -520,6 +759,7 @@ int do_syslog(int type, char __user *buf, int len, bool from_file)
 		break;
 	/* Number of chars in the log buffer */
 	case SYSLOG_ACTION_SIZE_UNREAD:
+		log_sync();
 		error = log_end - log_start;
 		break;
 	/* Size of the log buffer */
@@ -723,6 +963,15 @@ static void call_console_drivers(unsigned start, unsigned end)
 	_call_console_drivers(start_print, end, msg_level);
 }
 
+/* Index just past the first line in log_buf[start, end), or end */
+static unsigned log_line_end(unsigned start, unsigned end)
+{
+	while (start != end)
+		if (LOG_BUF(start++) == '\n')
+			break;
+	return start;
+}
+
 static void emit_log_char(char c)
 {
 	LOG_BUF(log_end) = c;
@@ -763,6 +1012,110 @@ static int printk_time = 0;
 #endif
 module_param_named(time, printk_time, bool, S_IRUGO | S_IWUSR);
 
+/* Print to the consoles from printk() itself, as early in boot */
+static int printk_synchronous;
+module_param_named(synchronous, printk_synchronous, bool, S_IRUGO | S_IWUSR);
+
+/* Next record to be moved into log_buf, protected by logbuf_lock */
+static unsigned long log_seq = 1;
+static int log_new_line = 1;
+
+static void emit_log_str(const char *s, size_t len)
+{
+	while (len--)
+		emit_log_char(*s++);
+}
+
+static void log_store_rec(struct printk_rec *rec)
+{
+	char tbuf[50];
+	unsigned tlen;
+
+	if ((rec->flags & REC_LINE_START) && !log_new_line) {
+		emit_log_char('\n');
+		log_new_line = 1;
+	}
+
+	if (log_new_line && (rec->len || (rec->flags & REC_LINE_END))) {
+		tlen = sprintf(tbuf, "<%u>", rec->prefix);
+		emit_log_str(tbuf, tlen);
+
+		if (printk_time) {
+			/* Add the time stamp of the record */
+			unsigned long long t = rec->ts_nsec;
+			unsigned long nanosec_rem = do_div(t, 1000000000);
+
+			tlen = sprintf(tbuf, "[%5lu.%06lu] ",
+				       (unsigned long) t, nanosec_rem / 1000);
+			emit_log_str(tbuf, tlen);
+		}
+		log_new_line = 0;
+	}
+
+	emit_log_str(rec->text, rec->len);
+	if (rec->flags & REC_LINE_END) {
+		emit_log_char('\n');
+		log_new_line = 1;
+	}
+}
+
+/* Note in log_buf that @n messages were lost or dropped */
+static void log_store_loss(unsigned long n, const char *how)
+{
+	char tbuf[64];
+	unsigned tlen;
+
+	tlen = sprintf(tbuf, "%s<%d>printk: %lu messages %s\n",
+		       log_new_line ? "" : "\n", default_message_loglevel,
+		       n, how);
+	emit_log_str(tbuf, tlen);
+	log_new_line = 1;
+}
+
+/*
+ * Move the records committed since the last call into log_buf.
+ * Must be called with logbuf_lock held and interrupts disabled.
+ */
+static void log_sync_records(void)
+{
+	struct printk_rec rec;
+	unsigned long seq, lost = 0;
+	int dropped, ret;
+
+	for (;;) {
+		seq = log_seq;
+		ret = printk_ring_next(&log_seq, &rec);
+		if (ret == -EPIPE) {
+			lost += log_seq - seq;
+			continue;
+		}
+		/* counted in printk_ring_dropped by the writer */
+		if (ret == -ENOENT)
+			continue;
+		if (lost) {
+			log_store_loss(lost, "lost");
+			lost = 0;
+		}
+		if (atomic_read(&printk_ring_dropped)) {
+			dropped = atomic_xchg(&printk_ring_dropped, 0);
+			if (dropped)
+				log_store_loss(dropped, "dropped");
+		}
+		if (ret)
+			break;
+		log_store_rec(&rec);
+	}
+}
+
+static void log_sync(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&logbuf_lock, flags);
+	log_sync_records();
+	spin_unlock_irqrestore(&logbuf_lock, flags);
+}
+
 /* Check if we have any console registered that can be called early in boot. */
 static int have_callable_console(void)
 {
@@ -817,9 +1170,6 @@ asmlinkage int printk(const char *fmt, ...)
 	return r;
 }
 
-/* cpu currently holding logbuf_lock */
-static volatile unsigned int printk_cpu = UINT_MAX;
-
 /*
  * Can we actually use the console at this time on this cpu?
  *
@@ -863,15 +1213,69 @@ static int console_trylock_for_printk(unsigned int cpu)
 			retval = 0;
 		}
 	}
-	printk_cpu = UINT_MAX;
 	spin_unlock(&logbuf_lock);
 	return retval;
 }
 static const char recursion_bug_msg [] =
-		KERN_CRIT "BUG: recent printk recursion!\n";
+		"BUG: recent printk recursion!";
 static int recursion_bug;
-static int new_text_line = 1;
-static char printk_buf[1024];
+
+/*
+ * Messages are formatted into a per-cpu buffer with interrupts off.
+ * A second one is there for an NMI or an oops interrupting printk()
+ * on the same cpu.
+ */
+#define PRINTK_BUF_SIZE		1024
+
+struct printk_cpu_buf {
+	int nesting;
+	char buf[2][PRINTK_BUF_SIZE];
+};
+
+static DEFINE_PER_CPU(struct printk_cpu_buf, printk_cpu_buf);
+
+/*
+ * Whether printk() has to push its output to the consoles itself:
+ * until the printk thread runs, and whenever it may not get to run
+ * again.
+ */
+static inline bool printk_sync_output(void)
+{
+	return !printk_kthread || printk_synchronous || oops_in_progress ||
+		system_state != SYSTEM_RUNNING;
+}
+
+/*
+ * Split the formatted message into lines, and those into records. Every
+ * line after the first one starts a new line with the same prefix.
+ */
+static void printk_store_text(unsigned int prefix, u8 flags, u64 ts_nsec,
+			      const char *text)
+{
+	const char *end;
+	size_t len;
+	u8 f;
+
+	while (*text) {
+		for (end = text; *end && *end != '\n'; end++)
+			;
+		len = end - text;
+
+		f = flags;
+		if (len > PRINTK_REC_TEXT)
+			len = PRINTK_REC_TEXT;
+		else if (*end == '\n')
+			f |= REC_LINE_END;
+
+		printk_ring_store(prefix, f, ts_nsec, text, len);
+
+		text += len;
+		if (f & REC_LINE_END)
+			text++;
+		/* what is left of an overlong line continues it */
+		flags = 0;
+	}
+}
 
 int printk_delay_msec __read_mostly;
 
@@ -889,11 +1293,15 @@ static inline void printk_delay(void)
 
 asmlinkage int vprintk(const char *fmt, va_list args)
 {
+	struct printk_cpu_buf *pcb;
 	int printed_len = 0;
-	int current_log_level = default_message_loglevel;
+	unsigned int current_log_level = default_message_loglevel;
+	unsigned int prefix;
 	unsigned long flags;
-	int this_cpu;
-	char *p;
+	int this_cpu, nesting, sync;
+	u8 rec_flags = 0;
+	u64 ts_nsec;
+	char *buf, *p;
 	size_t plen;
 	char special;
 
@@ -901,46 +1309,50 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	printk_delay();
 
 	preempt_disable();
-	/* This stops the holder of console_sem just where we want him */
 	raw_local_irq_save(flags);
 	this_cpu = smp_processor_id();
+	pcb = &per_cpu(printk_cpu_buf, this_cpu);
 
 	/*
 	 * Ouch, printk recursed into itself!
 	 */
-	if (unlikely(printk_cpu == this_cpu)) {
+	nesting = pcb->nesting;
+	if (unlikely(nesting)) {
 		/*
 		 * If a crash is occurring during printk() on this CPU,
-		 * then try to get the crash message out but make sure
-		 * we can't deadlock. Otherwise just return to avoid the
-		 * recursion and return - but flag the recursion so that
-		 * it can be printed at the next appropriate moment:
+		 * or an NMI interrupted it, then try to get the message
+		 * out on the spare buffer. Otherwise just return to avoid
+		 * the recursion and return - but flag the recursion so
+		 * that it can be printed at the next appropriate moment:
 		 */
-		if (!oops_in_progress) {
+		if (nesting > 1 || !(oops_in_progress || in_nmi())) {
 			recursion_bug = 1;
 			goto out_restore_irqs;
 		}
-		zap_locks();
+		if (oops_in_progress)
+			zap_locks();
 	}
+	pcb->nesting++;
+	buf = pcb->buf[nesting];
 
 	lockdep_off();
-	spin_lock(&logbuf_lock);
-	printk_cpu = this_cpu;
+	ts_nsec = cpu_clock(this_cpu);
 
 	if (recursion_bug) {
 		recursion_bug = 0;
-		strcpy(printk_buf, recursion_bug_msg);
-		printed_len = strlen(recursion_bug_msg);
+		printk_ring_store(2, REC_LINE_START | REC_LINE_END, ts_nsec,
+				  recursion_bug_msg,
+				  sizeof(recursion_bug_msg) - 1);
 	}
 	/* Emit the output into the temporary buffer */
-	printed_len += vscnprintf(printk_buf + printed_len,
-				  sizeof(printk_buf) - printed_len, fmt, args);
+	printed_len = vscnprintf(buf, PRINTK_BUF_SIZE, fmt, args);
 
 #ifdef	CONFIG_DEBUG_LL
-	printascii(printk_buf);
+	printascii(buf);
 #endif
 
-	p = printk_buf;
+	p = buf;
+	prefix = current_log_level;
 
 	/* Read log level and handle special printk prefix */
 	plen = log_prefix(p, &current_log_level, &special);
@@ -949,81 +1361,60 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 
 		switch (special) {
 		case 'c': /* Strip <c> KERN_CONT, continue line */
-			plen = 0;
 			break;
 		case 'd': /* Strip <d> KERN_DEFAULT, start new line */
-			plen = 0;
+			rec_flags |= REC_LINE_START;
+			break;
 		default:
-			if (!new_text_line) {
-				emit_log_char('\n');
-				new_text_line = 1;
-			}
+			/* Keep the original prefix, with any facility */
+			prefix = simple_strtoul(buf + 1, NULL, 10);
+			rec_flags |= REC_LINE_START;
 		}
 	}
 
+	printk_store_text(prefix, rec_flags, ts_nsec, p);
+	pcb->nesting--;
+
 	/*
-	 * Copy the output into log_buf. If the caller didn't provide
-	 * the appropriate log prefix, we insert them here
+	 * An NMI, or a printk() nested in one that crashed, may have
+	 * interrupted this cpu with logbuf_lock held. It must not spin on
+	 * it, and leaves the output to the tick if the lock is taken.
 	 */
-	for (; *p; p++) {
-		if (new_text_line) {
-			new_text_line = 0;
-
-			if (plen) {
-				/* Copy original log prefix */
-				int i;
-
-				for (i = 0; i < plen; i++)
-					emit_log_char(printk_buf[i]);
-				printed_len += plen;
-			} else {
-				/* Add log prefix */
-				emit_log_char('<');
-				emit_log_char(current_log_level + '0');
-				emit_log_char('>');
-				printed_len += 3;
-			}
+	sync = printk_sync_output();
+	if (sync && (nesting || in_nmi()))
+		sync = spin_trylock(&logbuf_lock);
+	else if (sync)
+		spin_lock(&logbuf_lock);
 
-			if (printk_time) {
-				/* Add the current time stamp */
-				char tbuf[50], *tp;
-				unsigned tlen;
-				unsigned long long t;
-				unsigned long nanosec_rem;
-
-				t = cpu_clock(printk_cpu);
-				nanosec_rem = do_div(t, 1000000000);
-				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
-						(unsigned long) t,
-						nanosec_rem / 1000);
-
-				for (tp = tbuf; tp < tbuf + tlen; tp++)
-					emit_log_char(*tp);
-				printed_len += tlen;
-			}
-
-			if (!*p)
-				break;
+	if (sync) {
+		/*
+		 * Try to acquire and then immediately release the
+		 * console semaphore. The release will do all the
+		 * actual magic (print out buffers, wake up klogd,
+		 * etc).
+		 *
+		 * The console_trylock_for_printk() function
+		 * will release 'logbuf_lock' regardless of whether it
+		 * actually gets the semaphore or not.
+		 */
+		log_sync_records();
+		if (console_trylock_for_printk(this_cpu))
+			console_unlock();
+	} else {
+		/*
+		 * Leave the rest to the tick and the printk thread, but
+		 * move records into log_buf right away if the ring is
+		 * filling up and nobody else is doing it.
+		 */
+		if (atomic_long_read(&printk_head) - ACCESS_ONCE(log_seq) >
+		    PRINTK_RING_SIZE / 2 && spin_trylock(&logbuf_lock)) {
+			log_sync_records();
+			spin_unlock(&logbuf_lock);
 		}
-
-		emit_log_char(*p);
-		if (*p == '\n')
-			new_text_line = 1;
+		__this_cpu_or(printk_pending,
+			      PRINTK_PENDING_WAKEUP | PRINTK_PENDING_OUTPUT);
 	}
 
-	/*
-	 * Try to acquire and then immediately release the
-	 * console semaphore. The release will do all the
-	 * actual magic (print out buffers, wake up klogd,
-	 * etc). 
-	 *
-	 * The console_trylock_for_printk() function
-	 * will release 'logbuf_lock' regardless of whether it
-	 * actually gets the semaphore or not.
-	 */
-	if (console_trylock_for_printk(this_cpu))
-		console_unlock();
-
 	lockdep_on();
 out_restore_irqs:
 	raw_local_irq_restore(flags);
@@ -1034,12 +1425,249 @@ out_restore_irqs:
 EXPORT_SYMBOL(printk);
 EXPORT_SYMBOL(vprintk);
 
+/*
+ * /dev/kmsg: writes are logged with printk(), reads return one record
+ * at a time, oldest first, as
+ *
+ *   <syslog prefix>,<sequence number>,<timestamp in usecs>,<flag>;<text>
+ *
+ * terminated by a newline. The flag is '-' for a complete line, 'c' for
+ * the start of a line continued in the following records and '+' for
+ * such a continuation. Non-printable characters in the text are escaped
+ * as \xXX. A read returns -EPIPE once if records were overwritten before
+ * they could be read, or dropped by printk().
+ */
+struct devkmsg_user {
+	unsigned long seq;
+	int cont;
+	struct mutex lock;
+	char buf[PRINTK_REC_TEXT * 4 + 64];
+};
+
+static ssize_t devkmsg_writev(struct kiocb *iocb, const struct iovec *iv,
+			      unsigned long count, loff_t pos)
+{
+	char *line, *p;
+	int i;
+	ssize_t ret = -EFAULT;
+	size_t len = iov_length(iv, count);
+
+	line = kmalloc(len + 1, GFP_KERNEL);
+	if (line == NULL)
+		return -ENOMEM;
+
+	/*
+	 * copy all vectors into a single string, to ensure we do
+	 * not interleave our log line with other printk calls
+	 */
+	p = line;
+	for (i = 0; i < count; i++) {
+		if (copy_from_user(p, iv[i].iov_base, iv[i].iov_len))
+			goto out;
+		p += iv[i].iov_len;
+	}
+	p[0] = '\0';
+
+	printk("%s", line);
+	ret = len;
+out:
+	kfree(line);
+	return ret;
+}
+
+static size_t devkmsg_format(struct devkmsg_user *user, unsigned long seq,
+			     struct printk_rec *rec)
+{
+	unsigned long long ts_usec = rec->ts_nsec;
+	char *p = user->buf;
+	char flag = '-';
+	int i;
+
+	do_div(ts_usec, 1000);
+
+	if (!(rec->flags & REC_LINE_END))
+		flag = user->cont ? '+' : 'c';
+	else if (user->cont && !(rec->flags & REC_LINE_START))
+		flag = '+';
+	user->cont = !(rec->flags & REC_LINE_END);
+
+	p += sprintf(p, "%u,%lu,%llu,%c;", rec->prefix, seq, ts_usec, flag);
+	for (i = 0; i < rec->len; i++) {
+		unsigned char c = rec->text[i];
+
+		if (c < ' ' || c >= 127 || c == '\\')
+			p += sprintf(p, "\\x%02x", c);
+		else
+			*p++ = c;
+	}
+	*p++ = '\n';
+
+	return p - user->buf;
+}
+
+static ssize_t devkmsg_read(struct file *file, char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	struct devkmsg_user *user = file->private_data;
+	struct printk_rec rec;
+	unsigned long seq;
+	size_t len;
+	ssize_t ret;
+	int cont;
+
+	if (!user)
+		return -EBADF;
+
+	ret = mutex_lock_interruptible(&user->lock);
+	if (ret)
+		return ret;
+
+	for (;;) {
+		seq = user->seq;
+		ret = printk_ring_next(&user->seq, &rec);
+		if (ret != -EAGAIN)
+			break;
+
+		if (file->f_flags & O_NONBLOCK)
+			goto out;
+
+		ret = wait_event_interruptible(log_wait,
+					printk_ring_ready(user->seq));
+		if (ret)
+			goto out;
+	}
+	if (ret) {
+		/* lost or dropped records, return -EPIPE once and resync */
+		ret = -EPIPE;
+		user->cont = 0;
+		goto out;
+	}
+
+	cont = user->cont;
+	len = devkmsg_format(user, seq, &rec);
+	if (len > count) {
+		/* keep it for a read with a large enough buffer */
+		user->seq = seq;
+		user->cont = cont;
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (copy_to_user(buf, user->buf, len)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	ret = len;
+out:
+	mutex_unlock(&user->lock);
+	return ret;
+}
+
+static loff_t devkmsg_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct devkmsg_user *user = file->private_data;
+	loff_t ret = 0;
+
+	if (!user)
+		return noop_llseek(file, offset, whence);
+	if (offset)
+		return -ESPIPE;
+
+	mutex_lock(&user->lock);
+	switch (whence) {
+	case SEEK_SET:
+		/* the oldest record still around */
+		user->seq = printk_ring_first();
+		break;
+	case SEEK_END:
+		/* after the newest record */
+		user->seq = atomic_long_read(&printk_head);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+	user->cont = 0;
+	mutex_unlock(&user->lock);
+
+	return ret;
+}
+
+static unsigned int devkmsg_poll(struct file *file, poll_table *wait)
+{
+	struct devkmsg_user *user = file->private_data;
+
+	if (!user)
+		return POLLERR|POLLNVAL;
+
+	poll_wait(file, &log_wait, wait);
+
+	if (printk_ring_ready(user->seq))
+		return POLLIN|POLLRDNORM;
+	return 0;
+}
+
+static int devkmsg_open(struct inode *inode, struct file *file)
+{
+	struct devkmsg_user *user;
+	int err;
+
+	/* write-only does not need any file context */
+	if ((file->f_flags & O_ACCMODE) == O_WRONLY)
+		return 0;
+
+	err = check_syslog_permissions(SYSLOG_ACTION_READ_ALL,
+				       SYSLOG_FROM_CALL);
+	if (err)
+		return err;
+	err = security_syslog(SYSLOG_ACTION_READ_ALL);
+	if (err)
+		return err;
+
+	user = kzalloc(sizeof(*user), GFP_KERNEL);
+	if (!user)
+		return -ENOMEM;
+
+	mutex_init(&user->lock);
+	user->seq = printk_ring_first();
+
+	file->private_data = user;
+	return 0;
+}
+
+static int devkmsg_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+const struct file_operations kmsg_fops = {
+	.open = devkmsg_open,
+	.read = devkmsg_read,
+	.aio_write = devkmsg_writev,
+	.llseek = devkmsg_llseek,
+	.poll = devkmsg_poll,
+	.release = devkmsg_release,
+};
+
 #else
 
 static void call_console_drivers(unsigned start, unsigned end)
 {
 }
 
+static void log_sync_records(void)
+{
+}
+
+static void log_sync(void)
+{
+}
+
+static unsigned log_line_end(unsigned start, unsigned end)
+{
+	return end;
+}
+
 #endif
 
 static int __add_preferred_console(char *name, int idx, char *options,
@@ -1268,12 +1896,17 @@ int is_console_locked(void)
 	return console_locked;
 }
 
-static DEFINE_PER_CPU(int, printk_pending);
-
 void printk_tick(void)
 {
-	if (__this_cpu_read(printk_pending)) {
+	int pending = __this_cpu_read(printk_pending);
+
+	if (pending) {
 		__this_cpu_write(printk_pending, 0);
+		log_sync();
+		if ((pending & PRINTK_PENDING_OUTPUT) && printk_kthread) {
+			printk_output_pending = 1;
+			wake_up_process(printk_kthread);
+		}
 		wake_up_interruptible(&log_wait);
 	}
 }
@@ -1288,8 +1921,27 @@ int printk_needs_cpu(int cpu)
 void wake_up_klogd(void)
 {
 	if (waitqueue_active(&log_wait))
-		this_cpu_write(printk_pending, 1);
+		this_cpu_or(printk_pending, PRINTK_PENDING_WAKEUP);
+}
+
+#ifdef CONFIG_PRINTK
+static int printk_kthread_fn(void *unused)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!xchg(&printk_output_pending, 0)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		console_lock();
+		console_unlock();
+	}
+
+	return 0;
 }
+#endif
 
 /**
  * console_unlock - unlock the console system
@@ -1320,17 +1972,21 @@ void console_unlock(void)
 
 	for ( ; ; ) {
 		spin_lock_irqsave(&logbuf_lock, flags);
+		log_sync_records();
 		wake_klogd |= log_start - log_end;
 		if (con_start == log_end)
 			break;			/* Nothing to print */
 		_con_start = con_start;
-		_log_end = log_end;
-		con_start = log_end;		/* Flush */
+		/* A line at a time, so interrupts are only off briefly */
+		_log_end = log_line_end(con_start, log_end);
+		con_start = _log_end;		/* Flush */
 		spin_unlock(&logbuf_lock);
 		stop_critical_timings();	/* don't trace print latency */
 		call_console_drivers(_con_start, _log_end);
 		start_critical_timings();
 		local_irq_restore(flags);
+		if (current == printk_kthread)
+			cond_resched();
 	}
 	console_locked = 0;
 
@@ -1658,6 +2314,12 @@ static int __init printk_late_init(void)
 		}
 	}
 	hotcpu_notifier(console_cpu_notify, 0);
+
+#ifdef CONFIG_PRINTK
+	printk_kthread = kthread_run(printk_kthread_fn, NULL, "kprintkd");
+	if (IS_ERR(printk_kthread))
+		printk_kthread = NULL;
+#endif
 	return 0;
 }
 late_initcall(printk_late_init);
@@ -1779,6 +2441,7 @@ void kmsg_dump(enum kmsg_dump_reason reason)
 	   there's not a lot we can do about that. The new messages
 	   will overwrite the start of what we dump. */
 	spin_lock_irqsave(&logbuf_lock, flags);
+	log_sync_records();
 	end = log_end & LOG_BUF_MASK;
 	chars = logged_chars;
 	spin_unlock_irqrestore(&logbuf_lock, flags);
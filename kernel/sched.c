@@ -333,6 +333,11 @@ struct cfs_rq {
 	unsigned int nr_spread_over;
 #endif
 
+#ifdef CONFIG_SMP
+	/* sum of load_avg_contrib of the queued entities */
+	unsigned long runnable_load_avg;
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -474,6 +479,11 @@ struct rq {
 	unsigned long nr_load_updates;
 	u64 nr_switches;
 
+	/* time integrals of nr_running, see sched_get_nr_running_integral() */
+	u64 nr_stamp;
+	u64 nr_running_integral;
+	u64 nr_waiting_integral;
+
 	struct cfs_rq cfs;
 	struct rt_rq rt;
 
@@ -1777,13 +1787,28 @@ static const struct sched_class rt_sched_class;
 
 #include "sched_stats.h"
 
+static void update_nr_running_integral(struct rq *rq)
+{
+	s64 delta = rq->clock - rq->nr_stamp;
+
+	if (delta <= 0)
+		return;
+
+	rq->nr_stamp = rq->clock;
+	rq->nr_running_integral += rq->nr_running * delta;
+	if (rq->nr_running > 1)
+		rq->nr_waiting_integral += (rq->nr_running - 1) * delta;
+}
+
 static void inc_nr_running(struct rq *rq)
 {
+	update_nr_running_integral(rq);
 	rq->nr_running++;
 }
 
 static void dec_nr_running(struct rq *rq)
 {
+	update_nr_running_integral(rq);
 	rq->nr_running--;
 }
 
@@ -2841,6 +2866,11 @@ static void __sched_fork(struct task_struct *p)
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
 
+#ifdef CONFIG_SMP
+	/* A zero timestamp starts tracking at the first enqueue */
+	memset(&p->se.avg, 0, sizeof(p->se.avg));
+#endif
+
 	INIT_LIST_HEAD(&p->rt.run_list);
 
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -3283,6 +3313,35 @@ unsigned long this_cpu_load(void)
 	return this->cpu_load[0];
 }
 
+/**
+ * sched_get_nr_running_integral - runqueue depth integrated over time
+ * @cpu: the runqueue to look at
+ * @running: returns the sum of nr_running over time, in task-nanoseconds
+ * @waiting: returns the same for the tasks that were runnable but not
+ *	running, i.e. nr_running - 1 whenever that is positive
+ *
+ * Returns the rq clock the integrals are current to. Callers sample this
+ * periodically and divide the differences to get the average runqueue
+ * depth and the time tasks spent waiting for this cpu.
+ */
+u64 sched_get_nr_running_integral(int cpu, u64 *running, u64 *waiting)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+	u64 stamp;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	update_rq_clock(rq);
+	update_nr_running_integral(rq);
+	*running = rq->nr_running_integral;
+	*waiting = rq->nr_waiting_integral;
+	stamp = rq->nr_stamp;
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	return stamp;
+}
+EXPORT_SYMBOL_GPL(sched_get_nr_running_integral);
+
 
 /* Variables and functions for calc_load */
 static atomic_long_t calc_load_tasks;
@@ -706,6 +706,261 @@ account_entity_dequeue(struct cfs_rq *cfs_rq, struct sched_entity *se)
 	cfs_rq->nr_running--;
 }
 
+#ifdef CONFIG_SMP
+/*
+ * Per-entity load tracking.
+ *
+ * The runnable time of an entity is accounted in periods of 1024us
+ * (~1ms), a period i periods ago contributing with weight y^i where
+ * y^32 = 1/2:
+ *
+ *   runnable_avg_sum = u_0 + u_1*y + u_2*y^2 + ...
+ *
+ * runnable_avg_period is the same series for wall time, so that
+ * sum / period is the fraction of recent time the entity was runnable.
+ * usage_avg_sum does the same for the time it was actually running.
+ * Group entities are runnable while any of their children are, so the
+ * averages propagate up the task group hierarchy.
+ */
+#define LOAD_AVG_PERIOD		32
+#define LOAD_AVG_MAX		47742	/* maximum possible runnable_avg_sum */
+#define LOAD_AVG_MAX_N		345	/* periods to reach LOAD_AVG_MAX */
+
+/* Precomputed fixed inverse multiplies for y^n, n < LOAD_AVG_PERIOD */
+static const u32 runnable_avg_yN_inv[] = {
+	0xffffffff, 0xfa83b2da, 0xf5257d14, 0xefe4b99a, 0xeac0c6e6, 0xe5b906e6,
+	0xe0ccdeeb, 0xdbfbb796, 0xd744fcc9, 0xd2a81d91, 0xce248c14, 0xc9b9bd85,
+	0xc5672a10, 0xc12c4cc9, 0xbd08a39e, 0xb8fbaf46, 0xb504f333, 0xb123f581,
+	0xad583ee9, 0xa9a15ab4, 0xa5fed6a9, 0xa2704302, 0x9ef5325f, 0x9b8d39b9,
+	0x9837f050, 0x94f4efa8, 0x91c3d373, 0x8ea4398a, 0x8b95c1e3, 0x88980e80,
+	0x85aac367, 0x82cd8698,
+};
+
+/* Precomputed sum of 1024*y^k for k = 1..n, n <= LOAD_AVG_PERIOD */
+static const u32 runnable_avg_yN_sum[] = {
+	    0, 1002, 1982, 2941, 3880, 4798, 5697, 6576, 7437, 8279, 9103,
+	 9909,10698,11470,12226,12966,13690,14398,15091,15769,16433,17082,
+	17718,18340,18949,19545,20128,20698,21256,21802,22336,22859,23371,
+};
+
+/* val * y^n */
+static __always_inline u64 decay_load(u64 val, u64 n)
+{
+	unsigned int local_n;
+
+	if (!n)
+		return val;
+	else if (unlikely(n > LOAD_AVG_PERIOD * 63))
+		return 0;
+
+	local_n = n;
+
+	/* y^32 = 1/2, so whole half-lives are a shift */
+	if (unlikely(local_n >= LOAD_AVG_PERIOD)) {
+		val >>= local_n / LOAD_AVG_PERIOD;
+		local_n %= LOAD_AVG_PERIOD;
+	}
+
+	val *= runnable_avg_yN_inv[local_n];
+	return val >> 32;
+}
+
+/* Contribution of n full periods: 1024 * (y + y^2 + ... + y^n) */
+static u32 __compute_runnable_contrib(u64 n)
+{
+	u32 contrib = 0;
+
+	if (likely(n <= LOAD_AVG_PERIOD))
+		return runnable_avg_yN_sum[n];
+	else if (unlikely(n >= LOAD_AVG_MAX_N))
+		return LOAD_AVG_MAX;
+
+	do {
+		contrib /= 2;
+		contrib += runnable_avg_yN_sum[LOAD_AVG_PERIOD];
+		n -= LOAD_AVG_PERIOD;
+	} while (n > LOAD_AVG_PERIOD);
+
+	contrib = decay_load(contrib, n);
+	return contrib + runnable_avg_yN_sum[n];
+}
+
+/*
+ * Account the time since the last update as runnable (and running) or
+ * not. Returns non-zero when a period boundary was crossed, i.e. when
+ * the averages decayed.
+ */
+static __always_inline int
+__update_entity_runnable_avg(u64 now, struct sched_avg *sa,
+			     int runnable, int running)
+{
+	u64 delta, periods;
+	u32 contrib;
+	int delta_w, decayed = 0;
+
+	delta = now - sa->last_runnable_update;
+	/* the clock of another cpu may lag behind after a migration */
+	if ((s64)delta < 0) {
+		sa->last_runnable_update = now;
+		return 0;
+	}
+
+	/* use 1024ns as the unit, a period is then 1024us */
+	delta >>= 10;
+	if (!delta)
+		return 0;
+	sa->last_runnable_update = now;
+
+	/* complete the partial period left over from the last update */
+	delta_w = sa->runnable_avg_period % 1024;
+	if (delta + delta_w >= 1024) {
+		decayed = 1;
+
+		delta_w = 1024 - delta_w;
+		if (runnable)
+			sa->runnable_avg_sum += delta_w;
+		if (running)
+			sa->usage_avg_sum += delta_w;
+		sa->runnable_avg_period += delta_w;
+
+		delta -= delta_w;
+		periods = delta / 1024;
+		delta %= 1024;
+
+		sa->runnable_avg_sum = decay_load(sa->runnable_avg_sum,
+						  periods + 1);
+		sa->usage_avg_sum = decay_load(sa->usage_avg_sum,
+					       periods + 1);
+		sa->runnable_avg_period = decay_load(sa->runnable_avg_period,
+						     periods + 1);
+
+		/* the full periods in between */
+		contrib = __compute_runnable_contrib(periods);
+		if (runnable)
+			sa->runnable_avg_sum += contrib;
+		if (running)
+			sa->usage_avg_sum += contrib;
+		sa->runnable_avg_period += contrib;
+	}
+
+	/* and the start of the current one */
+	if (runnable)
+		sa->runnable_avg_sum += delta;
+	if (running)
+		sa->usage_avg_sum += delta;
+	sa->runnable_avg_period += delta;
+
+	return decayed;
+}
+
+/* Returns the change in the entity's load_avg_contrib */
+static long __update_entity_load_avg_contrib(struct sched_entity *se)
+{
+	long old_contrib = se->avg.load_avg_contrib;
+	u64 contrib;
+
+	contrib = (u64)se->avg.runnable_avg_sum * se->load.weight;
+	se->avg.load_avg_contrib = div_u64(contrib,
+					   se->avg.runnable_avg_period + 1);
+
+	return (long)se->avg.load_avg_contrib - old_contrib;
+}
+
+static void update_entity_load_avg(struct sched_entity *se)
+{
+	struct cfs_rq *cfs_rq = cfs_rq_of(se);
+	u64 now = rq_of(cfs_rq)->clock_task;
+	long contrib_delta;
+
+	/* a new entity starts its history now */
+	if (unlikely(!se->avg.last_runnable_update)) {
+		se->avg.last_runnable_update = now;
+		return;
+	}
+
+	if (!__update_entity_runnable_avg(now, &se->avg, se->on_rq,
+					  cfs_rq->curr == se))
+		return;
+
+	contrib_delta = __update_entity_load_avg_contrib(se);
+	if (se->on_rq)
+		cfs_rq->runnable_load_avg += contrib_delta;
+}
+
+/* Entity is being enqueued, account the time it was blocked */
+static inline void
+enqueue_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	cfs_rq->runnable_load_avg += se->avg.load_avg_contrib;
+}
+
+static inline void
+dequeue_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	update_entity_load_avg(se);
+	cfs_rq->runnable_load_avg -= min(cfs_rq->runnable_load_avg,
+					 se->avg.load_avg_contrib);
+}
+
+/*
+ * Recent utilisation of a task as a fraction of SCHED_POWER_SCALE,
+ * from the time it actually ran.
+ */
+static inline unsigned long task_usage_avg(struct task_struct *p)
+{
+	struct sched_avg *sa = &p->se.avg;
+
+	return div_u64((u64)sa->usage_avg_sum << SCHED_POWER_SHIFT,
+		       sa->runnable_avg_period + 1);
+}
+
+static sched_freq_hint_fn freq_hint_fn;
+
+int sched_register_freq_hint(sched_freq_hint_fn fn)
+{
+	if (cmpxchg(&freq_hint_fn, NULL, fn))
+		return -EBUSY;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sched_register_freq_hint);
+
+void sched_unregister_freq_hint(sched_freq_hint_fn fn)
+{
+	if (cmpxchg(&freq_hint_fn, fn, NULL) != fn)
+		return;
+	/* hints are issued with interrupts disabled */
+	synchronize_sched();
+}
+EXPORT_SYMBOL_GPL(sched_unregister_freq_hint);
+
+static inline void sched_freq_hint(struct rq *rq, struct task_struct *p)
+{
+	sched_freq_hint_fn fn = rcu_dereference_sched(freq_hint_fn);
+
+	if (fn)
+		fn(cpu_of(rq), p, task_usage_avg(p));
+}
+#else
+static inline void update_entity_load_avg(struct sched_entity *se)
+{
+}
+
+static inline void
+enqueue_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+}
+
+static inline void
+dequeue_entity_load_avg(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+}
+
+static inline void sched_freq_hint(struct rq *rq, struct task_struct *p)
+{
+}
+#endif /* CONFIG_SMP */
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 # ifdef CONFIG_SMP
 static void update_cfs_rq_load_contribution(struct cfs_rq *cfs_rq,
@@ -994,6 +1249,7 @@ enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 
 	update_stats_enqueue(cfs_rq, se);
 	check_spread(cfs_rq, se);
+	enqueue_entity_load_avg(cfs_rq, se);
 	if (se != cfs_rq->curr)
 		__enqueue_entity(cfs_rq, se);
 	se->on_rq = 1;
@@ -1071,6 +1327,7 @@ dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int flags)
 
 	clear_buddies(cfs_rq, se);
 
+	dequeue_entity_load_avg(cfs_rq, se);
 	if (se != cfs_rq->curr)
 		__dequeue_entity(cfs_rq, se);
 	se->on_rq = 0;
@@ -1144,6 +1401,8 @@ set_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
 		 */
 		update_stats_wait_end(cfs_rq, se);
 		__dequeue_entity(cfs_rq, se);
+		/* account the wait, curr is about to change */
+		update_entity_load_avg(se);
 	}
 
 	update_stats_curr_start(cfs_rq, se);
@@ -1215,6 +1474,8 @@ static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
 
 	check_spread(cfs_rq, prev);
 	if (prev->on_rq) {
+		/* account the time it ran, curr is about to change */
+		update_entity_load_avg(prev);
 		update_stats_wait_start(cfs_rq, prev);
 		/* Put 'current' back into the tree. */
 		__enqueue_entity(cfs_rq, prev);
@@ -1229,6 +1490,7 @@ entity_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr, int queued)
 	 * Update run-time statistics of the 'current'.
 	 */
 	update_curr(cfs_rq);
+	update_entity_load_avg(curr);
 
 	/*
 	 * Update share accounting for long-running entities.
@@ -1326,6 +1588,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 {
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
+	int wakeup = flags & ENQUEUE_WAKEUP;
 
 	for_each_sched_entity(se) {
 		if (se->on_rq)
@@ -1340,8 +1603,12 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 
 		update_cfs_load(cfs_rq, 0);
 		update_cfs_shares(cfs_rq);
+		update_entity_load_avg(se);
 	}
 
+	if (wakeup)
+		sched_freq_hint(rq, p);
+
 	hrtick_update(rq);
 }
 
@@ -1380,6 +1647,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 
 		update_cfs_load(cfs_rq, 0);
 		update_cfs_shares(cfs_rq);
+		update_entity_load_avg(se);
 	}
 
 	hrtick_update(rq);
@@ -1624,13 +1892,18 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 }
 
 /*
- * Try and locate an idle CPU in the sched_domain.
+ * Try and locate an idle CPU in the sched_domain. Failing that, move to
+ * the sibling with the least runnable load if the task fits there better
+ * than on target.
  */
 static int select_idle_sibling(struct task_struct *p, int target)
 {
 	int cpu = smp_processor_id();
 	int prev_cpu = task_cpu(p);
 	struct sched_domain *sd;
+	unsigned long load, min_load = ULONG_MAX;
+	int least_loaded = -1;
+	int found_idle = 0;
 	int i;
 
 	/*
@@ -1658,8 +1931,14 @@ static int select_idle_sibling(struct task_struct *p, int target)
 		for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
 			if (idle_cpu(i)) {
 				target = i;
+				found_idle = 1;
 				break;
 			}
+			load = ACCESS_ONCE(cpu_rq(i)->cfs.runnable_load_avg);
+			if (load < min_load) {
+				min_load = load;
+				least_loaded = i;
+			}
 		}
 
 		/*
@@ -1672,6 +1951,20 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	}
 	rcu_read_unlock();
 
+	/*
+	 * Everything is busy. A task which has recently been runnable
+	 * for a good part of the time would add noticeably to target,
+	 * take the least loaded sibling if it stays below target even
+	 * with the task's own contribution. Mostly sleeping tasks have
+	 * a small contribution and stay where their cache is.
+	 */
+	if (!found_idle && sched_feat(WAKE_LOAD_AVG) &&
+	    least_loaded >= 0 && least_loaded != target) {
+		load = ACCESS_ONCE(cpu_rq(target)->cfs.runnable_load_avg);
+		if (min_load + p->se.avg.load_avg_contrib < load)
+			target = least_loaded;
+	}
+
 	return target;
 }
 
@@ -2049,6 +2342,7 @@ static void pull_task(struct rq *src_rq, struct task_struct *p,
 	deactivate_task(src_rq, p, 0);
 	set_task_cpu(p, this_cpu);
 	activate_task(this_rq, p, 0);
+	sched_freq_hint(this_rq, p);
 	check_preempt_curr(this_rq, p, 0);
 }
 
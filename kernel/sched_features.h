@@ -72,3 +72,9 @@ SCHED_FEAT(NONIRQ_POWER, 1)
 SCHED_FEAT(TTWU_QUEUE, 1)
 
 SCHED_FEAT(FORCE_SD_OVERLAP, 0)
+
+/*
+ * When no idle sibling is found on wakeup, place the task on the sibling
+ * with the least per-entity tracked runnable load
+ */
+SCHED_FEAT(WAKE_LOAD_AVG, 1)
@@ -40,6 +40,18 @@ static int write_iteration = 50;
 module_param(write_iteration, uint, 0644);
 MODULE_PARM_DESC(write_iteration, "# of writes between timestamp readings");
 
+static char *stream_file;
+module_param(stream_file, charp, 0444);
+MODULE_PARM_DESC(stream_file, "stream the buffer to <stream_file>.cpuN instead of running the reader");
+
+static int stream_flush_pages = 16;
+module_param(stream_flush_pages, uint, 0644);
+MODULE_PARM_DESC(stream_flush_pages, "# of pages the stream batches per write");
+
+static int stream_flush_ms = 100;
+module_param(stream_flush_ms, uint, 0644);
+MODULE_PARM_DESC(stream_flush_ms, "max time the stream holds back a page");
+
 static int producer_nice = 19;
 static int consumer_nice = 19;
 
@@ -213,6 +225,8 @@ static void ring_buffer_consumer(void)
 
 static void ring_buffer_producer(void)
 {
+	struct ring_buffer_stream_stats stream_stats;
+	struct ring_buffer_stream *stream = NULL;
 	struct timeval start_tv;
 	struct timeval end_tv;
 	unsigned long long time;
@@ -227,6 +241,17 @@ static void ring_buffer_producer(void)
 	 * Hammer the buffer for 10 secs (this may
 	 * make the system stall)
 	 */
+	if (stream_file) {
+		stream = ring_buffer_stream_start(buffer, stream_file,
+						  stream_flush_pages,
+						  stream_flush_ms);
+		if (IS_ERR(stream)) {
+			trace_printk("Failed to stream to %s: %ld\n",
+				     stream_file, PTR_ERR(stream));
+			stream = NULL;
+		}
+	}
+
 	trace_printk("Starting ring buffer hammer\n");
 	do_gettimeofday(&start_tv);
 	do {
@@ -281,6 +306,9 @@ static void ring_buffer_producer(void)
 		wait_for_completion(&read_done);
 	}
 
+	if (stream)
+		ring_buffer_stream_stop(stream, &stream_stats);
+
 	time = end_tv.tv_sec - start_tv.tv_sec;
 	time *= USEC_PER_SEC;
 	time += (long long)((long)end_tv.tv_usec - (long)start_tv.tv_usec);
@@ -291,7 +319,7 @@ static void ring_buffer_producer(void)
 	if (kill_test)
 		trace_printk("ERROR!\n");
 
-	if (!disable_reader) {
+	if (consumer) {
 		if (consumer_fifo < 0)
 			trace_printk("Running Consumer at nice: %d\n",
 				     consumer_nice);
@@ -313,16 +341,32 @@ static void ring_buffer_producer(void)
 
 	trace_printk("Time:     %lld (usecs)\n", time);
 	trace_printk("Overruns: %lld\n", overruns);
-	if (disable_reader)
+	if (stream) {
+		trace_printk("Read:     (streamed to %s)\n", stream_file);
+		trace_printk("Streamed: %ld pages (%lld bytes)\n",
+			     stream_stats.pages, stream_stats.bytes);
+		trace_printk("Stream errors: %ld\n", stream_stats.errors);
+	} else if (!consumer)
 		trace_printk("Read:     (reader disabled)\n");
 	else
 		trace_printk("Read:     %ld  (by %s)\n", read,
 			read_events ? "events" : "pages");
 	trace_printk("Entries:  %lld\n", entries);
-	trace_printk("Total:    %lld\n", entries + overruns + read);
+	if (!stream)
+		trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
 	trace_printk("Hit:      %ld\n", hit);
 
+	if (stream && hit) {
+		unsigned long long lost = overruns * 10000;
+		unsigned long frac;
+
+		/* Loss rate in hundredths of a percent of the events written */
+		do_div(lost, hit);
+		frac = do_div(lost, 100);
+		trace_printk("Lost:     %lld.%02ld%%\n", lost, frac);
+	}
+
 	/* Convert time from usecs to millisecs */
 	do_div(time, USEC_PER_MSEC);
 	if (time)
@@ -425,7 +469,7 @@ static int __init ring_buffer_benchmark_init(void)
 	if (!buffer)
 		return -ENOMEM;
 
-	if (!disable_reader) {
+	if (!disable_reader && !stream_file) {
 		consumer = kthread_create(ring_buffer_consumer_thread,
 					  NULL, "rb_consumer");
 		ret = PTR_ERR(consumer);
@@ -443,7 +487,7 @@ static int __init ring_buffer_benchmark_init(void)
 	/*
 	 * Run them as low-prio background tasks by default:
 	 */
-	if (!disable_reader) {
+	if (consumer) {
 		if (consumer_fifo >= 0) {
 			struct sched_param param = {
 				.sched_priority = consumer_fifo
@@ -0,0 +1,348 @@
+/*
+ * Stream ring buffer pages to files
+ *
+ * A kernel thread pulls completed pages out of each per cpu buffer and
+ * writes them to one file per cpu, in the same format as the per cpu
+ * trace_pipe_raw files.  Pages are swapped out of the ring buffer with
+ * ring_buffer_read_page(), so the event data is never copied before it
+ * is handed to the file system, and they are batched so that the file
+ * sees one large write instead of one write per page.
+ */
+#include <linux/ring_buffer.h>
+#include <linux/kthread.h>
+#include <linux/cpu.h>
+#include <linux/module.h>
+#include <linux/uaccess.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/fs.h>
+
+struct rb_stream_cpu {
+	struct file			*file;
+	loff_t				pos;
+	void				**pages;
+	struct kvec			*vec;
+	unsigned int			nr;
+	/* jiffies at which pages[0] was pulled from the buffer */
+	unsigned long			first;
+	unsigned long			overrun_start;
+	struct ring_buffer_stream_stats	stats;
+};
+
+struct ring_buffer_stream {
+	struct ring_buffer		*buffer;
+	struct task_struct		*task;
+	unsigned int			flush_pages;
+	unsigned long			flush_jiffies;
+	unsigned long			max_pages;
+	struct rb_stream_cpu		**cpus;
+};
+
+static void rb_stream_write(struct ring_buffer_stream *stream,
+			    struct rb_stream_cpu *sc)
+{
+	mm_segment_t old_fs;
+	ssize_t ret;
+	int i;
+
+	if (!sc->nr)
+		return;
+
+	for (i = 0; i < sc->nr; i++) {
+		sc->vec[i].iov_base = sc->pages[i];
+		sc->vec[i].iov_len = PAGE_SIZE;
+	}
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	ret = vfs_writev(sc->file, (const struct iovec __user *)sc->vec,
+			 sc->nr, &sc->pos);
+	set_fs(old_fs);
+
+	if (ret < 0) {
+		sc->stats.errors++;
+	} else {
+		sc->stats.pages += ret >> PAGE_SHIFT;
+		sc->stats.bytes += ret;
+		if (ret != (ssize_t)sc->nr << PAGE_SHIFT)
+			sc->stats.errors++;
+	}
+	sc->nr = 0;
+}
+
+/*
+ * Pull pages out of the buffer of @cpu until it runs dry.  With @full
+ * set only pages the writer has left are taken; otherwise the page the
+ * writer is on is copied out as well.  The number of pages taken in one
+ * go is bounded by the size of the buffer, so that a writer that keeps
+ * up with us cannot keep us here forever.
+ */
+static void rb_stream_fill(struct ring_buffer_stream *stream,
+			   struct rb_stream_cpu *sc, int cpu, int full)
+{
+	unsigned long taken;
+	size_t size;
+	void *page;
+
+	for (taken = 0; taken < stream->max_pages; taken++) {
+		if (sc->nr == stream->flush_pages)
+			rb_stream_write(stream, sc);
+
+		if (ring_buffer_read_page(stream->buffer, &sc->pages[sc->nr],
+					  PAGE_SIZE, cpu, full) < 0)
+			break;
+
+		/* do not leak stale events into the file */
+		page = sc->pages[sc->nr];
+		size = ring_buffer_page_len(page);
+		if (size < PAGE_SIZE)
+			memset(page + size, 0, PAGE_SIZE - size);
+
+		if (!sc->nr)
+			sc->first = jiffies;
+		sc->nr++;
+	}
+
+	sc->stats.overrun = ring_buffer_overrun_cpu(stream->buffer, cpu) -
+		sc->overrun_start;
+}
+
+static int rb_stream_thread(void *arg)
+{
+	struct ring_buffer_stream *stream = arg;
+	unsigned long poll = max(stream->flush_jiffies / 4, 1UL);
+	struct rb_stream_cpu *sc;
+	int cpu;
+
+	for (;;) {
+		for_each_possible_cpu(cpu) {
+			sc = stream->cpus[cpu];
+			if (!sc)
+				continue;
+
+			rb_stream_fill(stream, sc, cpu, 1);
+			if (sc->nr && time_after_eq(jiffies,
+					sc->first + stream->flush_jiffies))
+				rb_stream_write(stream, sc);
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule_timeout(poll);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void rb_stream_free_cpu(struct ring_buffer_stream *stream,
+			       struct rb_stream_cpu *sc)
+{
+	int i;
+
+	if (sc->file)
+		filp_close(sc->file, NULL);
+	if (sc->pages) {
+		for (i = 0; i < stream->flush_pages; i++)
+			if (sc->pages[i])
+				ring_buffer_free_read_page(stream->buffer,
+							   sc->pages[i]);
+		kfree(sc->pages);
+	}
+	kfree(sc->vec);
+	kfree(sc);
+}
+
+static struct rb_stream_cpu *
+rb_stream_alloc_cpu(struct ring_buffer_stream *stream, const char *prefix,
+		    int cpu)
+{
+	struct rb_stream_cpu *sc;
+	char *name;
+	int i;
+
+	sc = kzalloc(sizeof(*sc), GFP_KERNEL);
+	if (!sc)
+		return ERR_PTR(-ENOMEM);
+
+	sc->pages = kcalloc(stream->flush_pages, sizeof(*sc->pages),
+			    GFP_KERNEL);
+	sc->vec = kcalloc(stream->flush_pages, sizeof(*sc->vec), GFP_KERNEL);
+	if (!sc->pages || !sc->vec)
+		goto out_nomem;
+
+	for (i = 0; i < stream->flush_pages; i++) {
+		sc->pages[i] = ring_buffer_alloc_read_page(stream->buffer);
+		if (!sc->pages[i])
+			goto out_nomem;
+	}
+
+	name = kasprintf(GFP_KERNEL, "%s.cpu%d", prefix, cpu);
+	if (!name)
+		goto out_nomem;
+
+	sc->file = filp_open(name, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
+			     0600);
+	kfree(name);
+	if (IS_ERR(sc->file)) {
+		long err = PTR_ERR(sc->file);
+
+		sc->file = NULL;
+		rb_stream_free_cpu(stream, sc);
+		return ERR_PTR(err);
+	}
+
+	sc->overrun_start = ring_buffer_overrun_cpu(stream->buffer, cpu);
+
+	return sc;
+
+ out_nomem:
+	rb_stream_free_cpu(stream, sc);
+	return ERR_PTR(-ENOMEM);
+}
+
+/**
+ * ring_buffer_stream_start - start streaming a ring buffer to files
+ * @buffer: the buffer to stream
+ * @prefix: path prefix of the files, ".cpuN" is appended for each cpu
+ * @flush_pages: number of pages to batch up before writing them out
+ * @flush_ms: longest time a page may be held back before it is written
+ *
+ * Creates (or truncates) one file for every online cpu and starts a
+ * kernel thread that moves completed buffer pages into them.  Each page
+ * is written in full, with the unused tail zeroed, so the files can be
+ * parsed like the output of the per cpu trace_pipe_raw files.
+ *
+ * The stream consumes the buffer: anything else reading from it will
+ * only see the events the stream has not taken yet.
+ *
+ * Returns the stream or an ERR_PTR() value.
+ */
+struct ring_buffer_stream *
+ring_buffer_stream_start(struct ring_buffer *buffer, const char *prefix,
+			 unsigned int flush_pages, unsigned int flush_ms)
+{
+	struct ring_buffer_stream *stream;
+	struct rb_stream_cpu *sc;
+	int cpu;
+	int ret;
+
+	if (!flush_pages || flush_pages > RING_BUFFER_STREAM_MAX_PAGES)
+		return ERR_PTR(-EINVAL);
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (!stream)
+		return ERR_PTR(-ENOMEM);
+
+	stream->cpus = kcalloc(nr_cpu_ids, sizeof(*stream->cpus), GFP_KERNEL);
+	if (!stream->cpus) {
+		kfree(stream);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	stream->buffer = buffer;
+	stream->flush_pages = flush_pages;
+	stream->flush_jiffies = max(msecs_to_jiffies(flush_ms), 1UL);
+	/* the buffer pages plus the reader page */
+	stream->max_pages = DIV_ROUND_UP(ring_buffer_size(buffer),
+					 PAGE_SIZE) + 1;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		sc = rb_stream_alloc_cpu(stream, prefix, cpu);
+		if (IS_ERR(sc)) {
+			put_online_cpus();
+			ret = PTR_ERR(sc);
+			goto out_free;
+		}
+		stream->cpus[cpu] = sc;
+	}
+	put_online_cpus();
+
+	stream->task = kthread_run(rb_stream_thread, stream, "rb_stream");
+	if (IS_ERR(stream->task)) {
+		ret = PTR_ERR(stream->task);
+		goto out_free;
+	}
+
+	return stream;
+
+ out_free:
+	for_each_possible_cpu(cpu)
+		if (stream->cpus[cpu])
+			rb_stream_free_cpu(stream, stream->cpus[cpu]);
+	kfree(stream->cpus);
+	kfree(stream);
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_stream_start);
+
+/**
+ * ring_buffer_stream_stop - flush and stop a ring buffer stream
+ * @stream: the stream returned by ring_buffer_stream_start()
+ * @total: if not NULL, filled with the statistics summed over all cpus
+ *
+ * Everything still in the buffer, including pages that are only
+ * partially filled, is written out before the files are closed.
+ */
+void ring_buffer_stream_stop(struct ring_buffer_stream *stream,
+			     struct ring_buffer_stream_stats *total)
+{
+	struct rb_stream_cpu *sc;
+	int cpu;
+
+	kthread_stop(stream->task);
+
+	if (total)
+		memset(total, 0, sizeof(*total));
+
+	for_each_possible_cpu(cpu) {
+		sc = stream->cpus[cpu];
+		if (!sc)
+			continue;
+
+		/* Take what is left, including the pages the writers are on */
+		rb_stream_fill(stream, sc, cpu, 0);
+		rb_stream_write(stream, sc);
+
+		if (total) {
+			total->pages += sc->stats.pages;
+			total->bytes += sc->stats.bytes;
+			total->overrun += sc->stats.overrun;
+			total->errors += sc->stats.errors;
+		}
+		rb_stream_free_cpu(stream, sc);
+	}
+	kfree(stream->cpus);
+	kfree(stream);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_stream_stop);
+
+/**
+ * ring_buffer_stream_stats - read the statistics of a stream
+ * @stream: the stream to read from
+ * @cpu: the cpu buffer to report on
+ * @stats: where to store the statistics
+ *
+ * Returns -ENODEV if @cpu is not being streamed.  The values are
+ * updated by the stream thread without locking and may be slightly
+ * out of date.
+ */
+int ring_buffer_stream_stats(struct ring_buffer_stream *stream, int cpu,
+			     struct ring_buffer_stream_stats *stats)
+{
+	struct rb_stream_cpu *sc;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids)
+		return -ENODEV;
+
+	sc = stream->cpus[cpu];
+	if (!sc)
+		return -ENODEV;
+
+	*stats = sc->stats;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_stream_stats);
@@ -3940,6 +3940,154 @@ static const struct file_operations tracing_buffers_fops = {
 	.llseek		= no_llseek,
 };
 
+/*
+ * Streaming of the per cpu buffers to files, see ring_buffer_stream.c.
+ * trace_stream_mutex protects the stream and its settings.
+ */
+static DEFINE_MUTEX(trace_stream_mutex);
+static struct ring_buffer_stream *trace_stream;
+static char *trace_stream_prefix;
+static unsigned long trace_stream_flush_pages = 16;
+static unsigned long trace_stream_flush_ms = 1000;
+
+static ssize_t
+tracing_stream_file_read(struct file *filp, char __user *ubuf,
+			 size_t cnt, loff_t *ppos)
+{
+	char *buf;
+	int r;
+
+	mutex_lock(&trace_stream_mutex);
+	buf = kasprintf(GFP_KERNEL, "%s\n",
+			trace_stream_prefix ? trace_stream_prefix : "");
+	mutex_unlock(&trace_stream_mutex);
+	if (!buf)
+		return -ENOMEM;
+
+	r = simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+	kfree(buf);
+
+	return r;
+}
+
+static ssize_t
+tracing_stream_file_write(struct file *filp, const char __user *ubuf,
+			  size_t cnt, loff_t *ppos)
+{
+	struct ring_buffer_stream *stream;
+	char *buf, *prefix;
+	int ret = 0;
+
+	if (cnt >= PATH_MAX)
+		return -EINVAL;
+
+	buf = kmalloc(cnt + 1, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	if (copy_from_user(buf, ubuf, cnt)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[cnt] = 0;
+	prefix = strstrip(buf);
+
+	mutex_lock(&trace_stream_mutex);
+
+	/* Writing anything stops the current stream first */
+	if (trace_stream) {
+		ring_buffer_stream_stop(trace_stream, NULL);
+		trace_stream = NULL;
+		kfree(trace_stream_prefix);
+		trace_stream_prefix = NULL;
+	}
+
+	if (*prefix) {
+		stream = ring_buffer_stream_start(global_trace.buffer, prefix,
+						  trace_stream_flush_pages,
+						  trace_stream_flush_ms);
+		if (IS_ERR(stream)) {
+			ret = PTR_ERR(stream);
+		} else {
+			trace_stream = stream;
+			trace_stream_prefix = kstrdup(prefix, GFP_KERNEL);
+		}
+	}
+
+	mutex_unlock(&trace_stream_mutex);
+	kfree(buf);
+
+	if (ret)
+		return ret;
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
+static ssize_t
+tracing_stream_param_read(struct file *filp, char __user *ubuf,
+			  size_t cnt, loff_t *ppos)
+{
+	unsigned long *ptr = filp->private_data;
+	char buf[64];
+	int r;
+
+	r = snprintf(buf, sizeof(buf), "%lu\n", *ptr);
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, r);
+}
+
+static ssize_t
+tracing_stream_param_write(struct file *filp, const char __user *ubuf,
+			   size_t cnt, loff_t *ppos)
+{
+	unsigned long *ptr = filp->private_data;
+	char buf[64];
+	unsigned long val;
+	int ret;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(&buf, ubuf, cnt))
+		return -EFAULT;
+
+	buf[cnt] = 0;
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret < 0)
+		return ret;
+
+	if (!val)
+		return -EINVAL;
+	if (ptr == &trace_stream_flush_pages &&
+	    val > RING_BUFFER_STREAM_MAX_PAGES)
+		return -EINVAL;
+
+	/* Takes effect when the next stream is started */
+	mutex_lock(&trace_stream_mutex);
+	*ptr = val;
+	mutex_unlock(&trace_stream_mutex);
+
+	*ppos += cnt;
+
+	return cnt;
+}
+
+static const struct file_operations tracing_stream_file_fops = {
+	.open		= tracing_open_generic,
+	.read		= tracing_stream_file_read,
+	.write		= tracing_stream_file_write,
+	.llseek		= generic_file_llseek,
+};
+
+static const struct file_operations tracing_stream_param_fops = {
+	.open		= tracing_open_generic,
+	.read		= tracing_stream_param_read,
+	.write		= tracing_stream_param_write,
+	.llseek		= generic_file_llseek,
+};
+
 static ssize_t
 tracing_stats_read(struct file *filp, char __user *ubuf,
 		   size_t count, loff_t *ppos)
@@ -3964,6 +4112,20 @@ tracing_stats_read(struct file *filp, char __user *ubuf,
 	cnt = ring_buffer_commit_overrun_cpu(tr->buffer, cpu);
 	trace_seq_printf(s, "commit overrun: %ld\n", cnt);
 
+	mutex_lock(&trace_stream_mutex);
+	if (trace_stream) {
+		struct ring_buffer_stream_stats stats;
+
+		if (!ring_buffer_stream_stats(trace_stream, cpu, &stats)) {
+			trace_seq_printf(s, "stream pages: %lu\n", stats.pages);
+			trace_seq_printf(s, "stream overrun: %lu\n",
+					 stats.overrun);
+			trace_seq_printf(s, "stream errors: %lu\n",
+					 stats.errors);
+		}
+	}
+	mutex_unlock(&trace_stream_mutex);
+
 	count = simple_read_from_buffer(ubuf, count, ppos, s->buffer, s->len);
 
 	kfree(s);
@@ -4405,6 +4567,15 @@ static __init int tracer_init_debugfs(void)
 	trace_create_file("trace_clock", 0644, d_tracer, NULL,
 			  &trace_clock_fops);
 
+	trace_create_file("trace_stream_file", 0644, d_tracer,
+			NULL, &tracing_stream_file_fops);
+
+	trace_create_file("trace_stream_flush_pages", 0644, d_tracer,
+			&trace_stream_flush_pages, &tracing_stream_param_fops);
+
+	trace_create_file("trace_stream_flush_ms", 0644, d_tracer,
+			&trace_stream_flush_ms, &tracing_stream_param_fops);
+
 #ifdef CONFIG_DYNAMIC_FTRACE
 	trace_create_file("dyn_ftrace_total_info", 0444, d_tracer,
 			&ftrace_update_tot_cnt, &tracing_dyn_info_fops);
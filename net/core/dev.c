@@ -133,6 +133,7 @@
 #include <linux/pci.h>
 #include <linux/inetdevice.h>
 #include <linux/cpu_rmap.h>
+#include <linux/cpuidle.h>
 
 #include "net-sysfs.h"
 
@@ -2006,25 +2007,6 @@ static int dev_gso_segment(struct sk_buff *skb, int features)
 	return 0;
 }
 
-/*
- * Try to orphan skb early, right before transmission by the device.
- * We cannot orphan skb if tx timestamp is requested or the sk-reference
- * is needed on driver level for other reasons, e.g. see net/can/raw.c
- */
-static inline void skb_orphan_try(struct sk_buff *skb)
-{
-	struct sock *sk = skb->sk;
-
-	if (sk && !skb_shinfo(skb)->tx_flags) {
-		/* skb_tx_hash() wont be able to get sk.
-		 * We copy sk_hash into skb->rxhash
-		 */
-		if (!skb->rxhash)
-			skb->rxhash = sk->sk_hash;
-		skb_orphan(skb);
-	}
-}
-
 static bool can_checksum_protocol(unsigned long features, __be16 protocol)
 {
 	return ((features & NETIF_F_GEN_CSUM) ||
@@ -2113,8 +2095,6 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		if (!list_empty(&ptype_all))
 			dev_queue_xmit_nit(skb, dev);
 
-		skb_orphan_try(skb);
-
 		features = netif_skb_features(skb);
 
 		if (vlan_tx_tag_present(skb) &&
@@ -2587,6 +2567,20 @@ EXPORT_SYMBOL(__skb_get_rxhash);
 struct rps_sock_flow_table __rcu *rps_sock_flow_table __read_mostly;
 EXPORT_SYMBOL(rps_sock_flow_table);
 
+/*
+ * RFS leaves a flow on the receiving cpu rather than waking the cpu of
+ * its consumer from an idle state with an exit latency above this (in
+ * usecs).  0 steers flows regardless of idle state.
+ */
+int netdev_rps_idle_latency __read_mostly;
+
+static inline bool rps_cpu_deep_idle(int cpu)
+{
+	int latency = netdev_rps_idle_latency;
+
+	return latency > 0 && cpuidle_cpu_exit_latency(cpu) > latency;
+}
+
 static struct rps_dev_flow *
 set_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	    struct rps_dev_flow *rflow, u16 next_cpu)
@@ -2692,6 +2686,18 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 		next_cpu = sock_flow_table->ents[skb->rxhash &
 		    sock_flow_table->mask];
 
+		/*
+		 * Waking the consumer's cpu from deep idle costs more than
+		 * handling the flow here, so make this cpu the desired one.
+		 * The move is subject to the same ordering rule as below.
+		 */
+		if (next_cpu != RPS_NO_CPU &&
+		    next_cpu != raw_smp_processor_id() &&
+		    rps_cpu_deep_idle(next_cpu)) {
+			next_cpu = raw_smp_processor_id();
+			this_cpu_inc(softnet_data.rfs_idle_kept);
+		}
+
 		/*
 		 * If the desired CPU (where last recvmsg was done) is
 		 * different from current CPU (one in the rx-queue flow
@@ -2712,6 +2718,8 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 		}
 
 		if (tcpu != RPS_NO_CPU && cpu_online(tcpu)) {
+			if (tcpu != raw_smp_processor_id())
+				this_cpu_inc(softnet_data.rfs_steered);
 			*rflowp = rflow;
 			cpu = tcpu;
 			goto done;
@@ -4098,10 +4106,12 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct softnet_data *sd = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x "
+		   "%08x %08x\n",
 		   sd->processed, sd->dropped, sd->time_squeeze, 0,
 		   0, 0, 0, 0, /* was fastroute */
-		   sd->cpu_collision, sd->received_rps);
+		   sd->cpu_collision, sd->received_rps,
+		   sd->rfs_steered, sd->rfs_idle_kept);
 	return 0;
 }
 
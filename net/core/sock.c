@@ -1215,6 +1215,11 @@ struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 
 		sock_copy(newsk, sk);
 
+#ifdef CONFIG_NETFILTER_XT_MATCH_QTAGUID
+		/* The tag belongs to the parent, the child starts untagged */
+		RCU_INIT_POINTER(newsk->sk_qtaguid_tag, NULL);
+#endif
+
 		/* SANITY */
 		get_net(sock_net(newsk));
 		sk_node_init(&newsk->sk_node);
@@ -2059,6 +2064,11 @@ void release_sock(struct sock *sk)
 	spin_lock_bh(&sk->sk_lock.slock);
 	if (sk->sk_backlog.tail)
 		__release_sock(sk);
+
+	/* work deferred by softirq handlers while the user owned the socket */
+	if (sk->sk_prot->release_cb)
+		sk->sk_prot->release_cb(sk);
+
 	sk->sk_lock.owned = 0;
 	if (waitqueue_active(&sk->sk_lock.wq))
 		wake_up(&sk->sk_lock.wq);
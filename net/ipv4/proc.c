@@ -255,6 +255,8 @@ static const struct snmp_mib snmp4_net_list[] = {
 	SNMP_MIB_ITEM("TCPTimeWaitOverflow", LINUX_MIB_TCPTIMEWAITOVERFLOW),
 	SNMP_MIB_ITEM("TCPChallengeACK", LINUX_MIB_TCPCHALLENGEACK),
 	SNMP_MIB_ITEM("TCPSYNChallenge", LINUX_MIB_TCPSYNCHALLENGE),
+	SNMP_MIB_ITEM("TCPSmallQueueThrottle", LINUX_MIB_TCPSMALLQUEUETHROTTLE),
+	SNMP_MIB_ITEM("TCPPacingDefer", LINUX_MIB_TCPPACINGDEFER),
 	SNMP_MIB_SENTINEL
 };
 
@@ -3204,6 +3204,26 @@ static void tcp_cong_avoid(struct sock *sk, u32 ack, u32 in_flight)
 	tcp_sk(sk)->snd_cwnd_stamp = tcp_time_stamp;
 }
 
+/* Smoothed usec RTT for pacing, from the timestamp tcp_transmit_skb() puts
+ * on every skb while tcp_pacing is set. Same 1/8 gain as srtt.
+ * That timestamp is wall clock time: a sample which does not agree with
+ * the jiffy RTT seq_rtt of the same skb spans a clock step, and is dropped.
+ */
+static void tcp_pacing_rtt(struct tcp_sock *tp, s64 rtt_us, s32 seq_rtt)
+{
+	u32 m;
+
+	if (rtt_us < 0 || rtt_us > jiffies_to_usecs(seq_rtt + 1) ||
+	    (seq_rtt > 1 && rtt_us < jiffies_to_usecs(seq_rtt - 1)))
+		return;
+
+	m = max_t(u32, rtt_us, 1);
+	if (tp->pacing_srtt_us)
+		tp->pacing_srtt_us += m - (tp->pacing_srtt_us >> 3);
+	else
+		tp->pacing_srtt_us = m << 3;
+}
+
 /* Restart timer after forward progress on connection.
  * RFC2988 recommends to restart timer to now+rto.
  */
@@ -3350,6 +3370,13 @@ static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
 		tcp_ack_update_rtt(sk, flag, seq_rtt);
 		tcp_rearm_rto(sk);
 
+		if (sysctl_tcp_pacing && !(flag & FLAG_RETRANS_DATA_ACKED) &&
+		    ca_seq_rtt >= 0 &&
+		    !ktime_equal(last_ackt, net_invalid_timestamp()))
+			tcp_pacing_rtt(tp, ktime_us_delta(ktime_get_real(),
+							  last_ackt),
+				       ca_seq_rtt);
+
 		if (tcp_is_reno(tp)) {
 			tcp_remove_reno_sacks(sk, pkts_acked);
 		} else {
@@ -3659,6 +3686,39 @@ static void tcp_send_challenge_ack(struct sock *sk)
 	}
 }
 
+/* Pace at 200 % of the current rate (mss * cwnd / srtt), so that slow
+ * start can still double cwnd every RTT.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 cwnd = max(tp->snd_cwnd, tp->packets_out);
+	u64 rate;
+
+	if (!sysctl_tcp_pacing)
+		return;
+
+	/* Prefer the usec RTT from the skb timestamps. srtt only has jiffy
+	 * resolution (7.8ms at HZ=128), which would leave Wi-Fi and LAN
+	 * paths all but unpaced.
+	 */
+	if (tp->pacing_srtt_us) {
+		rate = (u64)tp->mss_cache * 2 * (USEC_PER_SEC << 3) * cwnd;
+		do_div(rate, tp->pacing_srtt_us);
+	} else {
+		rate = (u64)tp->mss_cache * 2 * (HZ << 3) * cwnd;
+
+		/* srtt is in jiffies << 3. Below a couple of jiffies it says
+		 * little, be generous and assume 1/8 jiffy. This also covers
+		 * srtt == 0, before tcp_rtt_estimator() ran.
+		 */
+		if (tp->srtt > 8 + 2)
+			do_div(rate, tp->srtt);
+	}
+
+	tp->pacing_rate = min_t(u64, rate, ~0U);
+}
+
 /* This routine deals with incoming acks, but not outgoing ones. */
 static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 {
@@ -3765,6 +3825,8 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	tcp_update_pacing_rate(sk);
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(__sk_dst_get(sk));
 
@@ -63,6 +63,12 @@ int sysctl_tcp_slow_start_after_idle __read_mostly = 1;
 int sysctl_tcp_cookie_size __read_mostly = 0; /* TCP_COOKIE_MAX */
 EXPORT_SYMBOL_GPL(sysctl_tcp_cookie_size);
 
+/* Default TSQ limit of two TSO segments */
+int sysctl_tcp_limit_output_bytes __read_mostly = 131072;
+
+/* Spread transmits over the RTT at tp->pacing_rate, off by default */
+int sysctl_tcp_pacing __read_mostly;
+
 
 /* Account for new data that has been sent to the network. */
 static void tcp_event_new_data_sent(struct sock *sk, struct sk_buff *skb)
@@ -805,10 +811,11 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 
 	BUG_ON(!skb || !tcp_skb_pcount(skb));
 
-	/* If congestion control is doing timestamping, we must
+	/* If congestion control or pacing is doing timestamping, we must
 	 * take such a timestamp before we potentially clone/copy.
 	 */
-	if (icsk->icsk_ca_ops->flags & TCP_CONG_RTT_STAMP)
+	if ((icsk->icsk_ca_ops->flags & TCP_CONG_RTT_STAMP) ||
+	    sysctl_tcp_pacing)
 		__net_timestamp(skb);
 
 	if (likely(clone_it)) {
@@ -840,7 +847,12 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 
 	skb_push(skb, tcp_header_size);
 	skb_reset_transport_header(skb);
-	skb_set_owner_w(skb, sk);
+
+	skb_orphan(skb);
+	skb->sk = sk;
+	skb->destructor = (sysctl_tcp_limit_output_bytes > 0) ?
+			  tcp_wfree : sock_wfree;
+	atomic_add(skb->truesize, &sk->sk_wmem_alloc);
 
 	/* Build TCP header and checksum it. */
 	th = tcp_hdr(skb);
@@ -1722,6 +1734,48 @@ static int tcp_mtu_probe(struct sock *sk)
 	return -1;
 }
 
+/* With sysctl_tcp_pacing, an skb may only leave once the previous ones
+ * have had their time at tp->pacing_rate. Returns true, with the pacing
+ * timer armed, if the next skb has to wait.
+ */
+static bool tcp_pacing_check(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (!sysctl_tcp_pacing || !tp->pacing_rate)
+		return false;
+
+	/* tcp_pace_kick() will get us going again */
+	if (hrtimer_active(&tp->pacing_timer))
+		return true;
+
+	if (ktime_to_ns(ktime_sub(tp->pacing_next, ktime_get())) <= 0)
+		return false;
+
+	hrtimer_start(&tp->pacing_timer, tp->pacing_next, HRTIMER_MODE_ABS);
+	NET_INC_STATS(sock_net(sk), LINUX_MIB_TCPPACINGDEFER);
+	return true;
+}
+
+/* Account the time len bytes take at the pacing rate. An idle socket
+ * does not build up credit, the next skb after a pause goes out at once.
+ */
+static void tcp_pacing_advance(struct sock *sk, unsigned int len)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	ktime_t now;
+
+	if (!sysctl_tcp_pacing || !tp->pacing_rate)
+		return;
+
+	now = ktime_get();
+	if (ktime_to_ns(ktime_sub(tp->pacing_next, now)) < 0)
+		tp->pacing_next = now;
+	tp->pacing_next = ktime_add_ns(tp->pacing_next,
+				       div_u64((u64)len * NSEC_PER_SEC,
+					       tp->pacing_rate));
+}
+
 /* This routine writes packets to the network.  It advances the
  * send_head.  This happens as incoming acks open up the remote
  * window for us.
@@ -1788,11 +1842,28 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		    unlikely(tso_fragment(sk, skb, limit, mss_now, gfp)))
 			break;
 
+		/* TSQ : sk_wmem_alloc accounts skb truesize,
+		 * including skb overhead. But thats OK.
+		 */
+		if (sysctl_tcp_limit_output_bytes > 0 &&
+		    atomic_read(&sk->sk_wmem_alloc) >=
+		    sysctl_tcp_limit_output_bytes) {
+			set_bit(TSQ_THROTTLED, &tp->tsq_flags);
+			NET_INC_STATS(sock_net(sk),
+				      LINUX_MIB_TCPSMALLQUEUETHROTTLE);
+			break;
+		}
+
+		if (tcp_pacing_check(sk))
+			break;
+
 		TCP_SKB_CB(skb)->when = tcp_time_stamp;
 
 		if (unlikely(tcp_transmit_skb(sk, skb, 1, gfp)))
 			break;
 
+		tcp_pacing_advance(sk, skb->len);
+
 		/* Advance the send_head.  This one is sent out.
 		 * This call will increment packets_out.
 		 */
@@ -1812,6 +1883,167 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 	return !tp->packets_out && tcp_send_head(sk);
 }
 
+/* TCP SMALL QUEUES (TSQ)
+ *
+ * TSQ goal is to keep small amount of skbs per tcp flow in tx queues (qdisc+dev)
+ * to reduce RTT and bufferbloat.
+ * We do this using a special skb destructor (tcp_wfree).
+ *
+ * Its important tcp_wfree() can be replaced by sock_wfree() in the event skb
+ * needs to be reallocated in a driver.
+ * The invariant being skb->truesize substracted from sk->sk_wmem_alloc
+ *
+ * Since transmit from skb destructor is forbidden, we use a tasklet
+ * to process all sockets that eventually need to send more skbs.
+ * We use one tasklet per cpu, with its own queue of sockets.
+ * The pacing timer hands its sockets to the same tasklet.
+ */
+struct tsq_tasklet {
+	struct tasklet_struct	tasklet;
+	struct list_head	head; /* queue of tcp sockets */
+};
+static DEFINE_PER_CPU(struct tsq_tasklet, tsq_tasklet);
+
+static void tcp_tsq_handler(struct sock *sk)
+{
+	if ((1 << sk->sk_state) &
+	    (TCPF_ESTABLISHED | TCPF_FIN_WAIT1 | TCPF_CLOSING |
+	     TCPF_CLOSE_WAIT  | TCPF_LAST_ACK))
+		tcp_write_xmit(sk, tcp_current_mss(sk), 0, 0, GFP_ATOMIC);
+}
+
+/*
+ * One tasklet per cpu tries to send more skbs.
+ * We run in tasklet context but need to disable irqs when
+ * transfering tsq->head because tcp_wfree() might
+ * interrupt us (non NAPI drivers)
+ */
+static void tcp_tasklet_func(unsigned long data)
+{
+	struct tsq_tasklet *tsq = (struct tsq_tasklet *)data;
+	LIST_HEAD(list);
+	unsigned long flags;
+	struct list_head *q, *n;
+	struct tcp_sock *tp;
+	struct sock *sk;
+
+	local_irq_save(flags);
+	list_splice_init(&tsq->head, &list);
+	local_irq_restore(flags);
+
+	list_for_each_safe(q, n, &list) {
+		tp = list_entry(q, struct tcp_sock, tsq_node);
+		list_del(&tp->tsq_node);
+
+		sk = (struct sock *)tp;
+
+		/* Allow the socket to be queued again from here on, so that
+		 * a pacing timer firing while we are sending is not lost.
+		 */
+		smp_mb__before_clear_bit();
+		clear_bit(TSQ_QUEUED, &tp->tsq_flags);
+
+		bh_lock_sock(sk);
+		if (!sock_owned_by_user(sk)) {
+			tcp_tsq_handler(sk);
+		} else {
+			/* defer the work to tcp_release_cb() */
+			set_bit(TCP_TSQ_DEFERRED, &tp->tsq_flags);
+		}
+		bh_unlock_sock(sk);
+
+		sk_free(sk);
+	}
+}
+
+/**
+ * tcp_release_cb - tcp release_sock() callback
+ * @sk: socket
+ *
+ * called from release_sock() to perform protocol dependent
+ * actions before socket release.
+ */
+void tcp_release_cb(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (test_and_clear_bit(TCP_TSQ_DEFERRED, &tp->tsq_flags))
+		tcp_tsq_handler(sk);
+}
+EXPORT_SYMBOL(tcp_release_cb);
+
+void __init tcp_tasklet_init(void)
+{
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct tsq_tasklet *tsq = &per_cpu(tsq_tasklet, i);
+
+		INIT_LIST_HEAD(&tsq->head);
+		tasklet_init(&tsq->tasklet,
+			     tcp_tasklet_func,
+			     (unsigned long)tsq);
+	}
+}
+
+/* Put the socket on this cpu's tsq tasklet. The caller set TSQ_QUEUED and
+ * holds a reference on sk_wmem_alloc, which the tasklet releases.
+ */
+static void tcp_tsq_queue(struct tcp_sock *tp)
+{
+	struct tsq_tasklet *tsq;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	tsq = &__get_cpu_var(tsq_tasklet);
+	list_add(&tp->tsq_node, &tsq->head);
+	tasklet_schedule(&tsq->tasklet);
+	local_irq_restore(flags);
+}
+
+/*
+ * Write buffer destructor automatically called from kfree_skb.
+ * We cant xmit new skbs from this context, as we might already
+ * hold qdisc lock.
+ */
+void tcp_wfree(struct sk_buff *skb)
+{
+	struct sock *sk = skb->sk;
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (test_and_clear_bit(TSQ_THROTTLED, &tp->tsq_flags) &&
+	    !test_and_set_bit(TSQ_QUEUED, &tp->tsq_flags)) {
+		/* Keep a ref on socket.
+		 * This last ref will be released in tcp_tasklet_func()
+		 */
+		atomic_sub(skb->truesize - 1, &sk->sk_wmem_alloc);
+		tcp_tsq_queue(tp);
+	} else {
+		sock_wfree(skb);
+	}
+}
+EXPORT_SYMBOL(tcp_wfree);
+
+/* Pacing timer, armed by tcp_pacing_check(). Runs in hard irq context,
+ * so it only hands the socket to the tsq tasklet.
+ */
+enum hrtimer_restart tcp_pace_kick(struct hrtimer *timer)
+{
+	struct tcp_sock *tp = container_of(timer, struct tcp_sock,
+					   pacing_timer);
+	struct sock *sk = (struct sock *)tp;
+
+	if (test_and_set_bit(TSQ_QUEUED, &tp->tsq_flags))
+		return HRTIMER_NORESTART;
+
+	/* sk_wmem_alloc only drops to zero once the socket is gone */
+	if (atomic_inc_not_zero(&sk->sk_wmem_alloc))
+		tcp_tsq_queue(tp);
+	else
+		clear_bit(TSQ_QUEUED, &tp->tsq_flags);
+	return HRTIMER_NORESTART;
+}
+
 /* Push out any pending frames which were held back due to
  * TCP_CORK or attempt at coalescing tiny packets.
  * The socket must be locked by the caller.
@@ -40,6 +40,9 @@ void tcp_init_xmit_timers(struct sock *sk)
 {
 	inet_csk_init_xmit_timers(sk, &tcp_write_timer, &tcp_delack_timer,
 				  &tcp_keepalive_timer);
+	hrtimer_init(&tcp_sk(sk)->pacing_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_ABS);
+	tcp_sk(sk)->pacing_timer.function = tcp_pace_kick;
 }
 EXPORT_SYMBOL(tcp_init_xmit_timers);
 
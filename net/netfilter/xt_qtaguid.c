@@ -15,11 +15,13 @@
 #define DEBUG
 
 #include <linux/file.h>
+#include <linux/hash.h>
 #include <linux/inetdevice.h>
 #include <linux/module.h>
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_qtaguid.h>
 #include <linux/ratelimit.h>
+#include <linux/rculist.h>
 #include <linux/skbuff.h>
 #include <linux/workqueue.h>
 #include <net/addrconf.h>
@@ -185,31 +187,51 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
  *     iface_stat_list_lock
  *
  * qtaguid_mt()
+ *   iface_stat_update_from_skb()
+ *     rcu_read_lock
+ *       (iface_stat_list)
  *   account_for_uid()
  *     if_tag_stat_update()
- *       get_sock_stat()
- *         sock_tag_list_lock
- *       struct iface_stat->tag_stat_list_lock
- *         tag_stat_update()
- *           get_active_counter_set()
- *             tag_counter_set_list_lock
- *         tag_stat_update()
- *           get_active_counter_set()
- *             tag_counter_set_list_lock
+ *       rcu_read_lock
+ *         (iface_stat_list)
+ *         get_sock_tag_rcu()
+ *           (sk->sk_qtaguid_tag, sock_tag->counter_set)
+ *         get_active_counter_set()
+ *           only for untagged sockets
+ *           (tag_counter_set_hash)
+ *         tag_stat_lookup_rcu()
+ *           (struct iface_stat->tag_stat_hash)
+ *         struct iface_stat->tag_stat_list_lock
+ *           only when a new tag_stat has to be created
+ *
+ * The packet path above never takes sock_tag_list_lock,
+ * tag_counter_set_list_lock or iface_stat_list_lock. The tag of a socket
+ * and the counter set of its uid are found through pointers cached in
+ * struct sock and struct sock_tag. Those, and the hash tables mirroring
+ * the rb trees, are only changed with the matching lock held, and the
+ * entries they point to are freed after an RCU grace period. The
+ * counters it updates are per cpu (struct data_counters_cpu).
+ *
+ * A sock_tag caches a pointer to the tag_counter_set of its uid, so
+ * tag_counter_set entries are only added or removed with both
+ * sock_tag_list_lock and tag_counter_set_list_lock held.
  *
  *
  * qtaguid_ctrl_parse()
  *   ctrl_cmd_delete()
  *     sock_tag_list_lock
- *     tag_counter_set_list_lock
+ *       tag_counter_set_list_lock
  *     iface_stat_list_lock
  *       struct iface_stat->tag_stat_list_lock
  *     uid_tag_data_tree_lock
  *   ctrl_cmd_counter_set()
- *     tag_counter_set_list_lock
- *   ctrl_cmd_tag()
  *     sock_tag_list_lock
+ *       tag_counter_set_list_lock
  *       (sock_tag_tree)
+ *   ctrl_cmd_tag()
+ *     sock_tag_list_lock
+ *       (sk->sk_qtaguid_tag)
+ *       tag_counter_set_list_lock
  *       get_tag_ref()
  *         uid_tag_data_tree_lock
  *           (uid_tag_data_tree)
@@ -223,10 +245,18 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
 static LIST_HEAD(iface_stat_list);
 static DEFINE_SPINLOCK(iface_stat_list_lock);
 
+#define TAG_COUNTER_SET_HASH_BITS 5
+
 static struct rb_root sock_tag_tree = RB_ROOT;
 static DEFINE_SPINLOCK(sock_tag_list_lock);
+/*
+ * Lets get_sock_tag_rcu() read sock_tag.tag and sock_tag.counter_set
+ * while the socket is being retagged.
+ */
+static seqcount_t sock_tag_seq = SEQCNT_ZERO;
 
 static struct rb_root tag_counter_set_tree = RB_ROOT;
+static struct hlist_head tag_counter_set_hash[1 << TAG_COUNTER_SET_HASH_BITS];
 static DEFINE_SPINLOCK(tag_counter_set_list_lock);
 
 static struct rb_root uid_tag_data_tree = RB_ROOT;
@@ -361,24 +391,6 @@ static struct tag_ref *tag_ref_tree_search(struct rb_root *root, tag_t tag)
 	return rb_entry(&node->node, struct tag_ref, tn.node);
 }
 
-static struct sock_tag *sock_tag_tree_search(struct rb_root *root,
-					     const struct sock *sk)
-{
-	struct rb_node *node = root->rb_node;
-
-	while (node) {
-		struct sock_tag *data = rb_entry(node, struct sock_tag,
-						 sock_node);
-		if (sk < data->sk)
-			node = node->rb_left;
-		else if (sk > data->sk)
-			node = node->rb_right;
-		else
-			return data;
-	}
-	return NULL;
-}
-
 static void sock_tag_tree_insert(struct sock_tag *data, struct rb_root *root)
 {
 	struct rb_node **new = &(root->rb_node), *parent = NULL;
@@ -401,6 +413,27 @@ static void sock_tag_tree_insert(struct sock_tag *data, struct rb_root *root)
 	rb_insert_color(&data->sock_node, root);
 }
 
+/*
+ * Add a fully set up sock_tag to sock_tag_tree and hang it off its sock.
+ * sock_tag_list_lock must be held.
+ */
+static void sock_tag_add(struct sock_tag *st_entry)
+{
+	sock_tag_tree_insert(st_entry, &sock_tag_tree);
+	rcu_assign_pointer(st_entry->sk->sk_qtaguid_tag, st_entry);
+}
+
+/*
+ * Remove a sock_tag from sock_tag_tree and from its sock.
+ * sock_tag_list_lock must be held. The entry must be freed with
+ * kfree_rcu() as the packet path might still be looking at it.
+ */
+static void sock_tag_del(struct sock_tag *st_entry)
+{
+	rb_erase(&st_entry->sock_node, &sock_tag_tree);
+	rcu_assign_pointer(st_entry->sk->sk_qtaguid_tag, NULL);
+}
+
 static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 {
 	struct rb_node *node;
@@ -417,7 +450,7 @@ static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 			 get_uid_from_tag(st_entry->tag));
 		rb_erase(&st_entry->sock_node, st_to_free_tree);
 		sockfd_put(st_entry->socket);
-		kfree(st_entry);
+		kfree_rcu(st_entry, rcu);
 	}
 }
 
@@ -728,27 +761,38 @@ static int read_proc_bool(char *page, char **start, off_t off,
 	return len;
 }
 
+static struct hlist_head *tag_counter_set_bucket(tag_t tag)
+{
+	return &tag_counter_set_hash[hash_64(tag, TAG_COUNTER_SET_HASH_BITS)];
+}
+
 static int get_active_counter_set(tag_t tag)
 {
 	int active_set = 0;
 	struct tag_counter_set *tcs;
+	struct hlist_node *pos;
 
 	MT_DEBUG("qtaguid: get_active_counter_set(tag=0x%llx)"
 		 " (uid=%u)\n",
 		 tag, get_uid_from_tag(tag));
 	/* For now we only handle UID tags for active sets */
 	tag = get_utag_from_tag(tag);
-	spin_lock_bh(&tag_counter_set_list_lock);
-	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
-	if (tcs)
-		active_set = tcs->active_set;
-	spin_unlock_bh(&tag_counter_set_list_lock);
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(tcs, pos, tag_counter_set_bucket(tag),
+				 hash_node) {
+		if (tcs->tn.tag == tag) {
+			active_set = ACCESS_ONCE(tcs->active_set);
+			break;
+		}
+	}
+	rcu_read_unlock();
 	return active_set;
 }
 
 /*
  * Find the entry for tracking the specified interface.
- * Caller must hold iface_stat_list_lock
+ * Caller must hold iface_stat_list_lock or rcu_read_lock.
+ * iface_stat entries are never freed.
  */
 static struct iface_stat *get_iface_entry(const char *ifname)
 {
@@ -761,7 +805,7 @@ static struct iface_stat *get_iface_entry(const char *ifname)
 	}
 
 	/* Iterate over interfaces */
-	list_for_each_entry(iface_entry, &iface_stat_list, list) {
+	list_for_each_entry_rcu(iface_entry, &iface_stat_list, list) {
 		if (!strcmp(ifname, iface_entry->ifname))
 			goto done;
 	}
@@ -788,9 +832,9 @@ static int pp_iface_stat_line(bool header, char *outp,
 			       "tx_other_bytes tx_other_packets\n"
 			);
 	} else {
-		struct data_counters *cnts;
+		struct data_counters sum, *cnts = &sum;
 		int cnt_set = 0;   /* We only use one set for the device */
-		cnts = &iface_entry->totals_via_skb;
+		data_counters_fold(cnts, iface_entry->totals_via_skb);
 		len = snprintf(
 			outp, char_count,
 			"%s "
@@ -972,6 +1016,56 @@ static void _iface_stat_set_active(struct iface_stat *entry,
 	}
 }
 
+/*
+ * alloc_percpu() may sleep, but iface and tag stats are created from
+ * atomic notifiers and from the packet path. Their counters come from a
+ * pool of per-cpu allocations that a work item keeps topped up.
+ */
+#define COUNTERS_POOL_SIZE 128
+static struct data_counters_cpu __percpu *counters_pool[COUNTERS_POOL_SIZE];
+static int counters_pool_count;
+static DEFINE_SPINLOCK(counters_pool_lock);
+
+static void counters_pool_refill(struct work_struct *work)
+{
+	struct data_counters_cpu __percpu *pcpu;
+	unsigned long flags;
+
+	for (;;) {
+		pcpu = alloc_percpu(struct data_counters_cpu);
+		if (!pcpu) {
+			pr_err("qtaguid: counters pool refill failed\n");
+			return;
+		}
+		spin_lock_irqsave(&counters_pool_lock, flags);
+		if (counters_pool_count < COUNTERS_POOL_SIZE) {
+			counters_pool[counters_pool_count++] = pcpu;
+			pcpu = NULL;
+		}
+		spin_unlock_irqrestore(&counters_pool_lock, flags);
+		if (pcpu) {
+			free_percpu(pcpu);
+			return;
+		}
+	}
+}
+
+static DECLARE_WORK(counters_pool_work, counters_pool_refill);
+
+static struct data_counters_cpu __percpu *data_counters_cpu_alloc(void)
+{
+	struct data_counters_cpu __percpu *pcpu = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&counters_pool_lock, flags);
+	if (counters_pool_count)
+		pcpu = counters_pool[--counters_pool_count];
+	if (counters_pool_count < COUNTERS_POOL_SIZE / 2)
+		schedule_work(&counters_pool_work);
+	spin_unlock_irqrestore(&counters_pool_lock, flags);
+	return pcpu;
+}
+
 /* Caller must hold iface_stat_list_lock */
 static struct iface_stat *iface_alloc(struct net_device *net_dev)
 {
@@ -991,6 +1085,14 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		kfree(new_iface);
 		return NULL;
 	}
+	new_iface->totals_via_skb = data_counters_cpu_alloc();
+	if (new_iface->totals_via_skb == NULL) {
+		pr_err("qtaguid: iface_stat: create(%s): "
+		       "counters alloc failed\n", net_dev->name);
+		kfree(new_iface->ifname);
+		kfree(new_iface);
+		return NULL;
+	}
 	spin_lock_init(&new_iface->tag_stat_list_lock);
 	new_iface->tag_stat_tree = RB_ROOT;
 	_iface_stat_set_active(new_iface, net_dev, true);
@@ -1004,6 +1106,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		pr_err("qtaguid: iface_stat: create(%s): "
 		       "work alloc failed\n", new_iface->ifname);
 		_iface_stat_set_active(new_iface, net_dev, false);
+		free_percpu(new_iface->totals_via_skb);
 		kfree(new_iface->ifname);
 		kfree(new_iface);
 		return NULL;
@@ -1011,7 +1114,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 	isw->iface_entry = new_iface;
 	INIT_WORK(&isw->iface_work, iface_create_proc_worker);
 	schedule_work(&isw->iface_work);
-	list_add(&new_iface->list, &iface_stat_list);
+	list_add_rcu(&new_iface->list, &iface_stat_list);
 	return new_iface;
 }
 
@@ -1186,22 +1289,39 @@ done_put:
 	in_dev_put(in_dev);
 }
 
+/* Caller must hold sock_tag_list_lock */
 static struct sock_tag *get_sock_stat_nl(const struct sock *sk)
 {
 	MT_DEBUG("qtaguid: get_sock_stat_nl(sk=%p)\n", sk);
-	return sock_tag_tree_search(&sock_tag_tree, sk);
+	return rcu_dereference_protected(sk->sk_qtaguid_tag,
+					 lockdep_is_held(&sock_tag_list_lock));
 }
 
-static struct sock_tag *get_sock_stat(const struct sock *sk)
+/*
+ * Lockless lookup of the tag of a socket and of the active counter set
+ * of its uid, for the packet path. Caller must hold rcu_read_lock.
+ * Returns false if the socket is not tagged.
+ */
+static bool get_sock_tag_rcu(const struct sock *sk, tag_t *tag,
+			     int *active_set)
 {
 	struct sock_tag *sock_tag_entry;
-	MT_DEBUG("qtaguid: get_sock_stat(sk=%p)\n", sk);
+	struct tag_counter_set *tcs;
+	unsigned int seq;
+
+	MT_DEBUG("qtaguid: get_sock_tag_rcu(sk=%p)\n", sk);
 	if (!sk)
-		return NULL;
-	spin_lock_bh(&sock_tag_list_lock);
-	sock_tag_entry = get_sock_stat_nl(sk);
-	spin_unlock_bh(&sock_tag_list_lock);
-	return sock_tag_entry;
+		return false;
+	sock_tag_entry = rcu_dereference(sk->sk_qtaguid_tag);
+	if (!sock_tag_entry)
+		return false;
+	do {
+		seq = read_seqcount_begin(&sock_tag_seq);
+		*tag = sock_tag_entry->tag;
+		tcs = rcu_dereference(sock_tag_entry->counter_set);
+	} while (read_seqcount_retry(&sock_tag_seq, seq));
+	*active_set = tcs ? ACCESS_ONCE(tcs->active_set) : 0;
+	return true;
 }
 
 static int ipx_proto(const struct sk_buff *skb,
@@ -1244,6 +1364,22 @@ data_counters_update(struct data_counters *dc, int set,
 	}
 }
 
+/* Update the copy of the counters that belongs to the current cpu. */
+static void
+data_counters_cpu_update(struct data_counters_cpu __percpu *pcpu, int set,
+			 enum ifs_tx_rx direction, int proto, int bytes)
+{
+	struct data_counters_cpu *dcc;
+
+	/* Keep softirqs on this cpu from updating the same copy */
+	local_bh_disable();
+	dcc = this_cpu_ptr(pcpu);
+	u64_stats_update_begin(&dcc->syncp);
+	data_counters_update(&dcc->dc, set, direction, proto, bytes);
+	u64_stats_update_end(&dcc->syncp);
+	local_bh_enable();
+}
+
 /*
  * Update stats for the specified interface. Do nothing if the entry
  * does not exist (when a device was never configured with an IP address).
@@ -1352,37 +1488,64 @@ static void iface_stat_update_from_skb(const struct sk_buff *skb,
 		 par->hooknum, __func__, el_dev->name, el_dev->type,
 		 par->family, proto, direction);
 
-	spin_lock_bh(&iface_stat_list_lock);
+	rcu_read_lock();
 	entry = get_iface_entry(el_dev->name);
 	if (entry == NULL) {
 		IF_DEBUG("qtaguid[%d]: iface_stat: %s(%s): not tracked\n",
 			 par->hooknum, __func__, el_dev->name);
-		spin_unlock_bh(&iface_stat_list_lock);
+		rcu_read_unlock();
 		return;
 	}
 
 	IF_DEBUG("qtaguid[%d]: %s(%s): entry=%p\n", par->hooknum,  __func__,
 		 el_dev->name, entry);
 
-	data_counters_update(&entry->totals_via_skb, 0, direction, proto,
-			     bytes);
-	spin_unlock_bh(&iface_stat_list_lock);
+	data_counters_cpu_update(entry->totals_via_skb, 0, direction, proto,
+				 bytes);
+	rcu_read_unlock();
 }
 
-static void tag_stat_update(struct tag_stat *tag_entry,
+static void tag_stat_update(struct tag_stat *tag_entry, int active_set,
 			enum ifs_tx_rx direction, int proto, int bytes)
 {
-	int active_set;
-	active_set = get_active_counter_set(tag_entry->tn.tag);
 	MT_DEBUG("qtaguid: tag_stat_update(tag=0x%llx (uid=%u) set=%d "
 		 "dir=%d proto=%d bytes=%d)\n",
 		 tag_entry->tn.tag, get_uid_from_tag(tag_entry->tn.tag),
 		 active_set, direction, proto, bytes);
-	data_counters_update(&tag_entry->counters, active_set, direction,
-			     proto, bytes);
+	data_counters_cpu_update(tag_entry->counters, active_set, direction,
+				 proto, bytes);
 	if (tag_entry->parent_counters)
-		data_counters_update(tag_entry->parent_counters, active_set,
-				     direction, proto, bytes);
+		data_counters_cpu_update(tag_entry->parent_counters, active_set,
+					 direction, proto, bytes);
+}
+
+static struct hlist_head *tag_stat_bucket(struct iface_stat *iface_entry,
+					  tag_t tag)
+{
+	return &iface_entry->tag_stat_hash[hash_64(tag, TAG_STAT_HASH_BITS)];
+}
+
+/* Lockless lookup of a tag_stat. Caller must hold rcu_read_lock. */
+static struct tag_stat *tag_stat_lookup_rcu(struct iface_stat *iface_entry,
+					    tag_t tag)
+{
+	struct tag_stat *ts_entry;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(ts_entry, pos,
+				 tag_stat_bucket(iface_entry, tag), hash_node) {
+		if (ts_entry->tn.tag == tag)
+			return ts_entry;
+	}
+	return NULL;
+}
+
+static void tag_stat_free_rcu(struct rcu_head *head)
+{
+	struct tag_stat *ts_entry = container_of(head, struct tag_stat, rcu);
+
+	free_percpu(ts_entry->counters);
+	kfree(ts_entry);
 }
 
 /*
@@ -1391,21 +1554,31 @@ static void tag_stat_update(struct tag_stat *tag_entry,
  * iface_entry->tag_stat_list_lock should be held.
  */
 static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
-					   tag_t tag)
+					   tag_t tag,
+					   struct data_counters_cpu __percpu *parent)
 {
 	struct tag_stat *new_tag_stat_entry = NULL;
 	IF_DEBUG("qtaguid: iface_stat: %s(): ife=%p tag=0x%llx"
 		 " (uid=%u)\n", __func__,
 		 iface_entry, tag, get_uid_from_tag(tag));
 	new_tag_stat_entry = kzalloc(sizeof(*new_tag_stat_entry), GFP_ATOMIC);
-	if (!new_tag_stat_entry) {
-		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
-		goto done;
+	if (!new_tag_stat_entry)
+		goto err;
+	new_tag_stat_entry->counters = data_counters_cpu_alloc();
+	if (!new_tag_stat_entry->counters) {
+		kfree(new_tag_stat_entry);
+		goto err;
 	}
 	new_tag_stat_entry->tn.tag = tag;
+	new_tag_stat_entry->parent_counters = parent;
 	tag_stat_tree_insert(new_tag_stat_entry, &iface_entry->tag_stat_tree);
-done:
+	hlist_add_head_rcu(&new_tag_stat_entry->hash_node,
+			   tag_stat_bucket(iface_entry, tag));
 	return new_tag_stat_entry;
+
+err:
+	pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
+	return NULL;
 }
 
 static void if_tag_stat_update(const char *ifname, uid_t uid,
@@ -1415,20 +1588,20 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	struct tag_stat *tag_stat_entry;
 	tag_t tag, acct_tag;
 	tag_t uid_tag;
-	struct data_counters *uid_tag_counters;
-	struct sock_tag *sock_tag_entry;
+	struct data_counters_cpu __percpu *uid_tag_counters;
 	struct iface_stat *iface_entry;
 	struct tag_stat *new_tag_stat = NULL;
+	int active_set;
 	MT_DEBUG("qtaguid: if_tag_stat_update(ifname=%s "
 		"uid=%u sk=%p dir=%d proto=%d bytes=%d)\n",
 		 ifname, uid, sk, direction, proto, bytes);
 
-
+	rcu_read_lock();
 	iface_entry = get_iface_entry(ifname);
 	if (!iface_entry) {
 		pr_err_ratelimited("qtaguid: tag_stat: stat_update() "
 				   "%s not found\n", ifname);
-		return;
+		goto out;
 	}
 	/* It is ok to process data when an iface_entry is inactive */
 
@@ -1439,32 +1612,39 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	 * Look for a tagged sock.
 	 * It will have an acct_uid.
 	 */
-	sock_tag_entry = get_sock_stat(sk);
-	if (sock_tag_entry) {
-		tag = sock_tag_entry->tag;
+	if (get_sock_tag_rcu(sk, &tag, &active_set)) {
 		acct_tag = get_atag_from_tag(tag);
 		uid_tag = get_utag_from_tag(tag);
 	} else {
 		acct_tag = make_atag_from_value(0);
 		tag = combine_atag_with_uid(acct_tag, uid);
 		uid_tag = make_tag_from_uid(uid);
+		active_set = get_active_counter_set(uid_tag);
 	}
 	MT_DEBUG("qtaguid: tag_stat: stat_update(): "
 		 " looking for tag=0x%llx (uid=%u) in ife=%p\n",
 		 tag, get_uid_from_tag(tag), iface_entry);
-	/* Loop over tag list under this interface for {acct_tag,uid_tag} */
-	spin_lock_bh(&iface_entry->tag_stat_list_lock);
-
-	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
-					      tag);
+	/* Look for {acct_tag,uid_tag} under this interface */
+	tag_stat_entry = tag_stat_lookup_rcu(iface_entry, tag);
 	if (tag_stat_entry) {
 		/*
 		 * Updating the {acct_tag, uid_tag} entry handles both stats:
 		 * {0, uid_tag} will also get updated.
 		 */
-		tag_stat_update(tag_stat_entry, direction, proto, bytes);
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
-		return;
+		tag_stat_update(tag_stat_entry, active_set, direction, proto,
+				bytes);
+		goto out;
+	}
+
+	spin_lock_bh(&iface_entry->tag_stat_list_lock);
+
+	/* Another cpu might have created it since the lookup above */
+	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
+					      tag);
+	if (tag_stat_entry) {
+		tag_stat_update(tag_stat_entry, active_set, direction, proto,
+				bytes);
+		goto unlock;
 	}
 
 	/* Loop over tag list under this interface for {0,uid_tag} */
@@ -1476,20 +1656,20 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 * No parent counters. So
 		 *  - No {0, uid_tag} stats and no {acc_tag, uid_tag} stats.
 		 */
-		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag);
+		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag, NULL);
 		if (!new_tag_stat)
 			goto unlock;
-		uid_tag_counters = &new_tag_stat->counters;
+		uid_tag_counters = new_tag_stat->counters;
 	} else {
-		uid_tag_counters = &tag_stat_entry->counters;
+		uid_tag_counters = tag_stat_entry->counters;
 	}
 
 	if (acct_tag) {
 		/* Create the child {acct_tag, uid_tag} and hook up parent. */
-		new_tag_stat = create_if_tag_stat(iface_entry, tag);
+		new_tag_stat = create_if_tag_stat(iface_entry, tag,
+						  uid_tag_counters);
 		if (!new_tag_stat)
 			goto unlock;
-		new_tag_stat->parent_counters = uid_tag_counters;
 	} else {
 		/*
 		 * For new_tag_stat to be still NULL here would require:
@@ -1501,9 +1681,11 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 */
 		BUG_ON(!new_tag_stat);
 	}
-	tag_stat_update(new_tag_stat, direction, proto, bytes);
+	tag_stat_update(new_tag_stat, active_set, direction, proto, bytes);
 unlock:
 	spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+out:
+	rcu_read_unlock();
 }
 
 static int iface_netdev_event_handler(struct notifier_block *nb,
@@ -2094,7 +2276,7 @@ static int ctrl_cmd_delete(const char *input)
 			 input, st_entry->tag, entry_uid);
 
 		if (!acct_tag || st_entry->tag == tag) {
-			rb_erase(&st_entry->sock_node, &sock_tag_tree);
+			sock_tag_del(st_entry);
 			/* Can't sockfd_put() within spinlock, do it later. */
 			sock_tag_tree_insert(st_entry, &st_to_free_tree);
 			tr_entry = lookup_tag_ref(st_entry->tag, NULL);
@@ -2111,11 +2293,12 @@ static int ctrl_cmd_delete(const char *input)
 				list_del(&st_entry->list);
 		}
 	}
-	spin_unlock_bh(&sock_tag_list_lock);
 
-	sock_tag_tree_erase(&st_to_free_tree);
-
-	/* Delete tag counter-sets */
+	/*
+	 * Delete tag counter-sets.
+	 * Still under sock_tag_list_lock, so that no sock_tag of this uid
+	 * can pick up the counter set before it is gone.
+	 */
 	spin_lock_bh(&tag_counter_set_list_lock);
 	/* Counter sets are only on the uid tag, not full tag */
 	tcs_entry = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
@@ -2127,9 +2310,13 @@ static int ctrl_cmd_delete(const char *input)
 			 get_uid_from_tag(tcs_entry->tn.tag),
 			 tcs_entry->active_set);
 		rb_erase(&tcs_entry->tn.node, &tag_counter_set_tree);
-		kfree(tcs_entry);
+		hlist_del_rcu(&tcs_entry->hash_node);
+		kfree_rcu(tcs_entry, rcu);
 	}
 	spin_unlock_bh(&tag_counter_set_list_lock);
+	spin_unlock_bh(&sock_tag_list_lock);
+
+	sock_tag_tree_erase(&st_to_free_tree);
 
 	/*
 	 * If acct_tag is 0, then all entries belonging to uid are
@@ -2158,7 +2345,8 @@ static int ctrl_cmd_delete(const char *input)
 					 entry_uid);
 				rb_erase(&ts_entry->tn.node,
 					 &iface_entry->tag_stat_tree);
-				kfree(ts_entry);
+				hlist_del_rcu(&ts_entry->hash_node);
+				call_rcu(&ts_entry->rcu, tag_stat_free_rcu);
 			}
 		}
 		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
@@ -2202,6 +2390,8 @@ static int ctrl_cmd_counter_set(const char *input)
 	tag_t tag;
 	int res, argc;
 	struct tag_counter_set *tcs;
+	struct sock_tag *st_entry;
+	struct rb_node *node;
 	int counter_set;
 
 	argc = sscanf(input, "%c %d %u", &cmd, &counter_set, &uid);
@@ -2227,12 +2417,14 @@ static int ctrl_cmd_counter_set(const char *input)
 	}
 
 	tag = make_tag_from_uid(uid);
+	spin_lock_bh(&sock_tag_list_lock);
 	spin_lock_bh(&tag_counter_set_list_lock);
 	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
 	if (!tcs) {
 		tcs = kzalloc(sizeof(*tcs), GFP_ATOMIC);
 		if (!tcs) {
 			spin_unlock_bh(&tag_counter_set_list_lock);
+			spin_unlock_bh(&sock_tag_list_lock);
 			pr_err("qtaguid: ctrl_counterset(%s): "
 			       "failed to alloc counter set\n",
 			       input);
@@ -2240,13 +2432,24 @@ static int ctrl_cmd_counter_set(const char *input)
 			goto err;
 		}
 		tcs->tn.tag = tag;
+		tcs->active_set = counter_set;
 		tag_counter_set_tree_insert(tcs, &tag_counter_set_tree);
+		hlist_add_head_rcu(&tcs->hash_node,
+				   tag_counter_set_bucket(tag));
+		/* Sockets of this uid tagged before now have a counter set */
+		for (node = rb_first(&sock_tag_tree); node;
+		     node = rb_next(node)) {
+			st_entry = rb_entry(node, struct sock_tag, sock_node);
+			if (get_uid_from_tag(st_entry->tag) == uid)
+				rcu_assign_pointer(st_entry->counter_set, tcs);
+		}
 		CT_DEBUG("qtaguid: ctrl_counterset(%s): added tcs tag=0x%llx "
 			 "(uid=%u) set=%d\n",
 			 input, tag, get_uid_from_tag(tag), counter_set);
 	}
 	tcs->active_set = counter_set;
 	spin_unlock_bh(&tag_counter_set_list_lock);
+	spin_unlock_bh(&sock_tag_list_lock);
 	atomic64_inc(&qtu_events.counter_set_changes);
 	res = 0;
 
@@ -2265,6 +2468,7 @@ static int ctrl_cmd_tag(const char *input)
 	int res, argc;
 	struct sock_tag *sock_tag_entry;
 	struct tag_ref *tag_ref_entry;
+	struct tag_counter_set *tcs;
 	struct uid_tag_data *uid_tag_data_entry;
 	struct proc_qtu_data *pqd_entry;
 
@@ -2323,6 +2527,10 @@ static int ctrl_cmd_tag(const char *input)
 		goto err_put;
 	}
 	tag_ref_entry->num_sock_tags++;
+	spin_lock_bh(&tag_counter_set_list_lock);
+	tcs = tag_counter_set_tree_search(&tag_counter_set_tree,
+					  get_utag_from_tag(full_tag));
+	spin_unlock_bh(&tag_counter_set_list_lock);
 	if (sock_tag_entry) {
 		struct tag_ref *prev_tag_ref_entry;
 
@@ -2342,7 +2550,10 @@ static int ctrl_cmd_tag(const char *input)
 		BUG_ON(IS_ERR_OR_NULL(prev_tag_ref_entry));
 		BUG_ON(prev_tag_ref_entry->num_sock_tags <= 0);
 		prev_tag_ref_entry->num_sock_tags--;
+		write_seqcount_begin(&sock_tag_seq);
 		sock_tag_entry->tag = full_tag;
+		rcu_assign_pointer(sock_tag_entry->counter_set, tcs);
+		write_seqcount_end(&sock_tag_seq);
 	} else {
 		CT_DEBUG("qtaguid: ctrl_tag(%s): newtag for sk=%p\n",
 			 input, el_socket->sk);
@@ -2361,6 +2572,7 @@ static int ctrl_cmd_tag(const char *input)
 		sock_tag_entry->pid = current->tgid;
 		sock_tag_entry->tag = combine_atag_with_uid(acct_tag,
 							    uid);
+		RCU_INIT_POINTER(sock_tag_entry->counter_set, tcs);
 		spin_lock_bh(&uid_tag_data_tree_lock);
 		pqd_entry = proc_qtu_data_tree_search(
 			&proc_qtu_data_tree, current->tgid);
@@ -2381,7 +2593,7 @@ static int ctrl_cmd_tag(const char *input)
 				 &pqd_entry->sock_tag_list);
 		spin_unlock_bh(&uid_tag_data_tree_lock);
 
-		sock_tag_tree_insert(sock_tag_entry, &sock_tag_tree);
+		sock_tag_add(sock_tag_entry);
 		atomic64_inc(&qtu_events.sockets_tagged);
 	}
 	spin_unlock_bh(&sock_tag_list_lock);
@@ -2447,7 +2659,7 @@ static int ctrl_cmd_untag(const char *input)
 	 * The socket already belongs to the current process
 	 * so it can do whatever it wants to it.
 	 */
-	rb_erase(&sock_tag_entry->sock_node, &sock_tag_tree);
+	sock_tag_del(sock_tag_entry);
 
 	tag_ref_entry = lookup_tag_ref(sock_tag_entry->tag, &utd_entry);
 	BUG_ON(!tag_ref_entry);
@@ -2484,7 +2696,7 @@ static int ctrl_cmd_untag(const char *input)
 		 atomic_long_read(&el_socket->file->f_count) - 1);
 	sockfd_put(el_socket);
 
-	kfree(sock_tag_entry);
+	kfree_rcu(sock_tag_entry, rcu);
 	atomic64_inc(&qtu_events.sockets_untagged);
 
 	return 0;
@@ -2571,7 +2783,7 @@ struct proc_print_info {
 static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
 {
 	int len;
-	struct data_counters *cnts;
+	struct data_counters sum, *cnts = &sum;
 
 	if (!ppi->item_index) {
 		if (ppi->item_index++ < ppi->items_to_skip)
@@ -2603,7 +2815,7 @@ static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
 		}
 		if (ppi->item_index++ < ppi->items_to_skip)
 			return 0;
-		cnts = &ppi->ts_entry->counters;
+		data_counters_fold(cnts, ppi->ts_entry->counters);
 		len = snprintf(
 			ppi->outp, ppi->char_count,
 			"%d %s 0x%llx %u %u "
@@ -2850,7 +3062,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 		tr->num_sock_tags--;
 		free_tag_ref_from_utd_entry(tr, utd_entry);
 
-		rb_erase(&st_entry->sock_node, &sock_tag_tree);
+		sock_tag_del(st_entry);
 		list_del(&st_entry->list);
 		/* Can't sockfd_put() within spinlock, do it later. */
 		sock_tag_tree_insert(st_entry, &st_to_free_tree);
@@ -2955,6 +3167,7 @@ static struct xt_match qtaguid_mt_reg __read_mostly = {
 
 static int __init qtaguid_mt_init(void)
 {
+	counters_pool_refill(NULL);
 	if (qtaguid_proc_register(&xt_qtaguid_procdir)
 	    || iface_stat_init(xt_qtaguid_procdir)
 	    || xt_register_match(&qtaguid_mt_reg)
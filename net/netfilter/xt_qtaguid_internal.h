@@ -12,7 +12,10 @@
 
 #include <linux/types.h>
 #include <linux/rbtree.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 
 /* Iface handling */
@@ -197,6 +200,45 @@ static inline uint64_t dc_sum_packets(struct data_counters *counters,
 		+ counters->bpc[set][direction][IFS_PROTO_OTHER].packets;
 }
 
+/*
+ * The packet path only updates the copy of the cpu it runs on, without
+ * taking any lock. Readers add up the copies of all cpus with
+ * data_counters_fold().
+ * The copies are per-cpu allocations (alloc_percpu()).
+ */
+struct data_counters_cpu {
+	struct data_counters dc;
+	struct u64_stats_sync syncp;
+};
+
+static inline void data_counters_fold(
+	struct data_counters *sum,
+	const struct data_counters_cpu __percpu *pcpu)
+{
+	const int n = sizeof(sum->bpc) / sizeof(sum->bpc[0][0][0]);
+	struct byte_packet_counters *s = &sum->bpc[0][0][0];
+	const struct byte_packet_counters *c;
+	unsigned int start;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct data_counters snap;
+
+		const struct data_counters_cpu *dcc = per_cpu_ptr(pcpu, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&dcc->syncp);
+			snap = dcc->dc;
+		} while (u64_stats_fetch_retry(&dcc->syncp, start));
+
+		c = &snap.bpc[0][0][0];
+		for (i = 0; i < n; i++) {
+			s[i].bytes += c[i].bytes;
+			s[i].packets += c[i].packets;
+		}
+	}
+}
 
 /* Generic X based nodes used as a base for rb_tree ops */
 struct tag_node {
@@ -204,14 +246,20 @@ struct tag_node {
 	tag_t tag;
 };
 
+/* Number of hash buckets for the tag_stats of one iface_stat */
+#define TAG_STAT_HASH_BITS 5
+
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
+	/* in iface_stat.tag_stat_hash, for the lockless packet path */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
+	struct data_counters_cpu __percpu *counters;
 	/*
 	 * If this tag is acct_tag based, we need to count against the
 	 * matching parent uid_tag.
 	 */
-	struct data_counters *parent_counters;
+	struct data_counters_cpu __percpu *parent_counters;
 };
 
 struct iface_stat {
@@ -222,7 +270,7 @@ struct iface_stat {
 	struct net_device *net_dev;
 
 	struct byte_packet_counters totals_via_dev[IFS_MAX_DIRECTIONS];
-	struct data_counters totals_via_skb;
+	struct data_counters_cpu __percpu *totals_via_skb;
 	/*
 	 * We keep the last_known, because some devices reset their counters
 	 * just before NETDEV_UP, while some will reset just before
@@ -238,6 +286,9 @@ struct iface_stat {
 	struct proc_dir_entry *proc_ptr;
 
 	struct rb_root tag_stat_tree;
+	/* Same entries as tag_stat_tree, looked up under RCU */
+	struct hlist_head tag_stat_hash[1 << TAG_STAT_HASH_BITS];
+	/* Protects tag_stat_tree and tag_stat_hash updates */
 	spinlock_t tag_stat_list_lock;
 };
 
@@ -255,7 +306,13 @@ struct iface_stat_work {
  */
 struct sock_tag {
 	struct rb_node sock_node;
-	struct sock *sk;  /* Only used as a number, never dereferenced */
+	struct rcu_head rcu;
+	/*
+	 * sk->sk_qtaguid_tag points back here while the sock_tag is in
+	 * sock_tag_tree. The sk stays valid as long as the ref on
+	 * socket is held.
+	 */
+	struct sock *sk;
 	/* The socket is needed for sockfd_put() */
 	struct socket *socket;
 	/* Used to associate with a given pid */
@@ -263,6 +320,8 @@ struct sock_tag {
 	pid_t pid;
 
 	tag_t tag;
+	/* Counter set of the uid in tag, NULL if it has none */
+	struct tag_counter_set __rcu *counter_set;
 };
 
 struct qtaguid_event_counts {
@@ -300,6 +359,9 @@ struct qtaguid_event_counts {
 /* Track the set active_set for the given tag. */
 struct tag_counter_set {
 	struct tag_node tn;
+	/* in tag_counter_set_hash, for the lockless packet path */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 	int active_set;
 };
 
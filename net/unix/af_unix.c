@@ -114,6 +114,7 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/splice.h>
 
 static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
 static DEFINE_SPINLOCK(unix_table_lock);
@@ -361,6 +362,12 @@ static void unix_sock_destructor(struct sock *sk)
 	if (u->addr)
 		unix_release_addr(u->addr);
 
+	/* left over from copying the linear part of skbs into a pipe */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	atomic_long_dec(&unix_nr_socks);
 	local_bh_disable();
 	sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
@@ -514,6 +521,11 @@ static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int,
+				    size_t, int);
+static ssize_t unix_stream_splice_read(struct socket *, loff_t *,
+				       struct pipe_inode_info *, size_t,
+				       unsigned int);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t);
 static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
@@ -543,7 +555,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1394,6 +1407,16 @@ static int unix_scm_to_skb(struct scm_cookie *scm, struct sk_buff *skb, bool sen
 	return err;
 }
 
+/*
+ * Stream skbs may be read in several goes; the part already read stays
+ * in the skb and is skipped with UNIXCB(skb).consumed, as page fragments
+ * cannot be pulled off the front.
+ */
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 /*
  *	Send AF_UNIX data.
  */
@@ -1681,6 +1704,107 @@ out_err:
 	return sent ? : err;
 }
 
+/*
+ * A page can be added to the last skb in the peer's queue if it came
+ * from us with the same credentials, carries no descriptors, and we
+ * have not used up our send buffer yet.
+ */
+static bool unix_skb_can_append(struct sock *sk, struct sk_buff *skb,
+				struct scm_cookie *scm)
+{
+	return skb->sk == sk && !UNIXCB(skb).fp &&
+	       UNIXCB(skb).pid == scm->pid &&
+	       UNIXCB(skb).cred == scm->cred &&
+	       atomic_read(&sk->sk_wmem_alloc) < sk->sk_sndbuf;
+}
+
+/*
+ * Queue a page for the peer without copying it, so that splice() and
+ * sendfile() onto a stream socket only take a page reference. The
+ * receive side never modifies an skb that is on its queue without
+ * holding the state lock, so holding it here is enough to extend the
+ * last queued skb.
+ */
+static ssize_t unix_stream_sendpage(struct socket *sock, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct sock *other;
+	struct sk_buff *skb;
+	struct scm_cookie scm;
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	/* only compared against, unix_scm_to_skb() takes the references */
+	memset(&scm, 0, sizeof(scm));
+	scm.pid = task_tgid(current);
+	scm.cred = current_cred();
+
+	unix_state_lock(other);
+
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN))
+		goto pipe_err_unlock;
+
+	skb = skb_peek_tail(&other->sk_receive_queue);
+	if (skb && unix_skb_can_append(sk, skb, &scm)) {
+		spin_lock(&other->sk_receive_queue.lock);
+		err = skb_append_pagefrags(skb, page, offset, size);
+		if (!err) {
+			skb->len += size;
+			skb->data_len += size;
+			skb->truesize += size;
+			atomic_add(size, &sk->sk_wmem_alloc);
+		}
+		spin_unlock(&other->sk_receive_queue.lock);
+		if (!err)
+			goto out;
+	}
+	unix_state_unlock(other);
+
+	skb = sock_alloc_send_pskb(sk, 0, 0, flags & MSG_DONTWAIT, &err);
+	if (!skb)
+		return err;
+
+	unix_scm_to_skb(&scm, skb, false);
+	skb_append_pagefrags(skb, page, offset, size);
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	unix_state_lock(other);
+
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN)) {
+		unix_state_unlock(other);
+		kfree_skb(skb);
+		goto pipe_err;
+	}
+
+	skb_queue_tail(&other->sk_receive_queue, skb);
+out:
+	unix_state_unlock(other);
+	other->sk_data_ready(other, size);
+	return size;
+
+pipe_err_unlock:
+	unix_state_unlock(other);
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+	return -EPIPE;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1848,15 +1972,33 @@ static long unix_stream_data_wait(struct sock *sk, long timeo)
 
 
 
-static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
-			       struct msghdr *msg, size_t size,
-			       int flags)
+struct unix_stream_read_state {
+	int (*recv_actor)(struct sk_buff *, int,
+			  struct unix_stream_read_state *);
+	struct socket *socket;
+	struct scm_cookie *scm;
+	struct msghdr *msg;
+	struct pipe_inode_info *pipe;
+	size_t size;
+	int flags;
+	unsigned int splice_flags;
+};
+
+/*
+ * The common part of recvmsg() and splice(): pull data off the queue,
+ * hand it to the recv_actor and account for what it took. The actor
+ * returns the number of bytes it used, which may be less than offered,
+ * or an error.
+ */
+static int unix_stream_read_generic(struct unix_stream_read_state *state)
 {
-	struct sock_iocb *siocb = kiocb_to_siocb(iocb);
-	struct scm_cookie tmp_scm;
+	struct scm_cookie *scm = state->scm;
+	struct socket *sock = state->socket;
 	struct sock *sk = sock->sk;
 	struct unix_sock *u = unix_sk(sk);
-	struct sockaddr_un *sunaddr = msg->msg_name;
+	struct sockaddr_un *sunaddr = state->msg ? state->msg->msg_name : NULL;
+	int flags = state->flags;
+	size_t size = state->size;
 	int copied = 0;
 	int check_creds = 0;
 	int target;
@@ -1874,17 +2016,10 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	target = sock_rcvlowat(sk, flags&MSG_WAITALL, size);
 	timeo = sock_rcvtimeo(sk, flags&MSG_DONTWAIT);
 
-	msg->msg_namelen = 0;
-
 	/* Lock the socket to prevent queue disordering
 	 * while sleeps in memcpy_tomsg
 	 */
 
-	if (!siocb->scm) {
-		siocb->scm = &tmp_scm;
-		memset(&tmp_scm, 0, sizeof(tmp_scm));
-	}
-
 	err = mutex_lock_interruptible(&u->readlock);
 	if (err) {
 		err = sock_intr_errno(timeo);
@@ -1935,28 +2070,29 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		if (check_creds) {
 			/* Never glue messages from different writers */
-			if ((UNIXCB(skb).pid  != siocb->scm->pid) ||
-			    (UNIXCB(skb).cred != siocb->scm->cred)) {
+			if ((UNIXCB(skb).pid  != scm->pid) ||
+			    (UNIXCB(skb).cred != scm->cred)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
 		} else {
 			/* Copy credentials */
-			scm_set_cred(siocb->scm, UNIXCB(skb).pid, UNIXCB(skb).cred);
+			scm_set_cred(scm, UNIXCB(skb).pid, UNIXCB(skb).cred);
 			check_creds = 1;
 		}
 
 		/* Copy address just once */
 		if (sunaddr) {
-			unix_copy_addr(msg, skb->sk);
+			unix_copy_addr(state->msg, skb->sk);
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		chunk = state->recv_actor(skb, chunk, state);
+		if (chunk < 0) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
-				copied = -EFAULT;
+				copied = chunk;
 			break;
 		}
 		copied += chunk;
@@ -1964,26 +2100,26 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
-				unix_detach_fds(siocb->scm, skb);
+				unix_detach_fds(scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
 
 			consume_skb(skb);
 
-			if (siocb->scm->fp)
+			if (scm->fp)
 				break;
 		} else {
 			/* It is questionable, see note in unix_dgram_recvmsg.
 			 */
 			if (UNIXCB(skb).fp)
-				siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+				scm->fp = scm_fp_dup(UNIXCB(skb).fp);
 
 			/* put message back and return */
 			skb_queue_head(&sk->sk_receive_queue, skb);
@@ -1992,11 +2128,95 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	} while (size);
 
 	mutex_unlock(&u->readlock);
-	scm_recv(sock, msg, siocb->scm, flags);
+	if (state->msg)
+		scm_recv(sock, state->msg, scm, flags);
+	else
+		/* there is nobody to pass credentials or descriptors to */
+		scm_destroy(scm);
 out:
 	return copied ? : err;
 }
 
+static int unix_stream_read_actor(struct sk_buff *skb, int chunk,
+				  struct unix_stream_read_state *state)
+{
+	int ret;
+
+	ret = skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+				      state->msg->msg_iov, chunk);
+	return ret ?: chunk;
+}
+
+static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
+			       struct msghdr *msg, size_t size,
+			       int flags)
+{
+	struct sock_iocb *siocb = kiocb_to_siocb(iocb);
+	struct scm_cookie tmp_scm;
+	struct unix_stream_read_state state = {
+		.recv_actor = unix_stream_read_actor,
+		.socket = sock,
+		.msg = msg,
+		.size = size,
+		.flags = flags,
+	};
+
+	msg->msg_namelen = 0;
+
+	if (!siocb->scm) {
+		siocb->scm = &tmp_scm;
+		memset(&tmp_scm, 0, sizeof(tmp_scm));
+	}
+	state.scm = siocb->scm;
+
+	return unix_stream_read_generic(&state);
+}
+
+/*
+ * The reader keeps holding u->readlock while the pages go into the pipe.
+ * That does not invert against splicing into a unix socket, as
+ * unix_stream_sendpage() never takes the readlock of its peer.
+ */
+static ssize_t unix_stream_splice_to_pipe(struct sock *sk,
+					  struct pipe_inode_info *pipe,
+					  struct splice_pipe_desc *spd)
+{
+	return splice_to_pipe(pipe, spd);
+}
+
+static int unix_stream_splice_actor(struct sk_buff *skb, int chunk,
+				    struct unix_stream_read_state *state)
+{
+	return skb_splice_bits(skb, state->socket->sk, UNIXCB(skb).consumed,
+			       state->pipe, chunk, state->splice_flags,
+			       unix_stream_splice_to_pipe);
+}
+
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t size, unsigned int flags)
+{
+	struct scm_cookie scm;
+	struct unix_stream_read_state state = {
+		.recv_actor = unix_stream_splice_actor,
+		.socket = sock,
+		.scm = &scm,
+		.pipe = pipe,
+		.size = size,
+		.splice_flags = flags,
+	};
+
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if ((sock->file->f_flags & O_NONBLOCK) ||
+	    (flags & SPLICE_F_NONBLOCK))
+		state.flags = MSG_DONTWAIT;
+
+	memset(&scm, 0, sizeof(scm));
+	return unix_stream_read_generic(&state);
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -2063,7 +2283,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
@@ -3,7 +3,18 @@
 
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
+extern int bench_sched_wakeup(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_futex_hash(int argc, const char **argv, const char *prefix);
+extern int bench_futex_wake(int argc, const char **argv, const char *prefix);
+extern int bench_futex_wake_parallel(int argc, const char **argv, const char *prefix);
+extern int bench_futex_requeue(int argc, const char **argv, const char *prefix);
+extern int bench_futex_lock_pi(int argc, const char **argv, const char *prefix);
+extern int bench_net_udp(int argc, const char **argv, const char *prefix);
+extern int bench_net_tpacket(int argc, const char **argv, const char *prefix);
+extern int bench_net_unix(int argc, const char **argv, const char *prefix);
+extern int bench_net_conntrack(int argc, const char **argv, const char *prefix);
+extern int bench_net_latency(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,210 @@
+/*
+ *
+ * futex-hash.c
+ *
+ * hash: Stress the futex hash table
+ *
+ * Each thread operates on its own set of private futexes, so there is
+ * no contention on the futex words themselves, only on the kernel hash
+ * buckets they map to. By default the futex values never match and
+ * every FUTEX_WAIT returns -EWOULDBLOCK after taking the bucket lock;
+ * with --wake FUTEX_WAKE is issued on futexes nobody waits on instead.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nsecs = 10;
+static unsigned int nfutexes = 1024;
+static bool fshared;
+static bool wake;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+static int futex_flag;
+
+struct worker {
+	pthread_t thread;
+	u_int32_t *futex;
+	unsigned long ops;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of cpus)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes,
+		     "Specify amount of futexes per thread"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_BOOLEAN('w', "wake", &wake,
+		    "Wake futexes nobody waits on instead of waiting"),
+	OPT_END()
+};
+
+static const char * const bench_futex_hash_usage[] = {
+	"perf bench futex hash <options>",
+	NULL
+};
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int i;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		for (i = 0; i < nfutexes; i++, w->ops++) {
+			if (wake)
+				ret = futex_wake(&w->futex[i], 1, futex_flag);
+			else
+				ret = futex_wait(&w->futex[i], 1234, NULL,
+						 futex_flag);
+			/*
+			 * Both are expected to fail (or wake nobody),
+			 * anything else means the kernel misbehaves.
+			 */
+			if (!done && ((wake && ret) ||
+				      (!wake && (!ret || errno != EWOULDBLOCK))))
+				fprintf(stderr, "futex %s returned %d\n",
+					wake ? "wake" : "wait", ret);
+		}
+	} while (!done);
+
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_futex_hash(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct worker *worker;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, result_usec;
+	unsigned long min = ~0UL, max = 0;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_hash_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_hash_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nfutexes)
+		nfutexes = 1;
+	futex_flag = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		worker[i].futex = calloc(nfutexes, sizeof(*worker[i].futex));
+		if (!worker[i].futex)
+			die("calloc");
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		total += worker[i].ops;
+		if (worker[i].ops < min)
+			min = worker[i].ops;
+		if (worker[i].ops > max)
+			max = worker[i].ops;
+		free(worker[i].futex);
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads, %u %s futexes each, %s\n\n",
+		       nthreads, nfutexes, fshared ? "shared" : "private",
+		       wake ? "waking nobody" : "waiting on a stale value");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+
+		printf(" %14llu ops/sec\n", total * 1000000ULL / result_usec);
+		printf(" %14llu ops/sec per thread (min %llu, max %llu)\n",
+		       total * 1000000ULL / nthreads / result_usec,
+		       min * 1000000ULL / result_usec,
+		       max * 1000000ULL / result_usec);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total * 1000000ULL / result_usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(worker);
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ *
+ * futex-lock-pi.c
+ *
+ * lock-pi: Measure the throughput of priority inheritance futexes
+ *
+ * Threads repeatedly take and release a PI futex through the
+ * FUTEX_LOCK_PI/FUTEX_UNLOCK_PI syscalls, skipping the usual userspace
+ * fast path, so every operation goes through the kernel's pi_state and
+ * rt_mutex handling. By default they all share one futex.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+struct worker {
+	pthread_t thread;
+	u_int32_t *futex;
+	unsigned long ops;
+	unsigned long errors;
+};
+
+static unsigned int nthreads;
+static unsigned int nsecs = 10;
+static bool multi;
+static bool fshared;
+
+static u_int32_t global_futex;
+static volatile int done;
+static int futex_flag;
+
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of cpus)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_BOOLEAN('M', "multi", &multi,
+		    "Use a futex per thread (default: one shared by all)"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_lock_pi_usage[] = {
+	"perf bench futex lock-pi <options>",
+	NULL
+};
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	do {
+		ret = futex_lock_pi(w->futex, NULL, 0, futex_flag);
+		if (ret) {
+			/* the owner may be exiting, just try again */
+			if (errno != EAGAIN && errno != EINTR)
+				w->errors++;
+			continue;
+		}
+
+		/* hold it for a moment, so there is some contention */
+		usleep(1);
+		if (futex_unlock_pi(w->futex, futex_flag))
+			w->errors++;
+		w->ops++;
+	} while (!done);
+
+	return NULL;
+}
+
+int bench_futex_lock_pi(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct worker *worker;
+	struct timeval start, stop, diff;
+	unsigned long long total = 0, errors = 0, result_usec;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_lock_pi_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_lock_pi_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	futex_flag = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		if (multi) {
+			worker[i].futex = calloc(1, sizeof(*worker[i].futex));
+			if (!worker[i].futex)
+				die("calloc");
+		} else
+			worker[i].futex = &global_futex;
+
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		total += worker[i].ops;
+		errors += worker[i].errors;
+		if (multi)
+			free(worker[i].futex);
+	}
+
+	if (errors)
+		fprintf(stderr, "%llu futex lock/unlock errors\n", errors);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads on %s %s PI futex%s\n\n",
+		       nthreads, multi ? "their own" : "a single",
+		       fshared ? "shared" : "private", multi ? "es" : "");
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+
+		printf(" %14llu lock+unlock ops/sec\n",
+		       total * 1000000ULL / result_usec);
+		printf(" %14llu lock+unlock ops/sec per thread\n",
+		       total * 1000000ULL / nthreads / result_usec);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu\n", total * 1000000ULL / result_usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(worker);
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *
+ * futex-wake-parallel.c
+ *
+ * wake-parallel: Measure the cost of waking up tasks blocked on a futex
+ *		  from several wakers at once
+ *
+ * Like 'wake', but the blocked threads are split between nwakers
+ * waker threads which all issue their FUTEX_WAKE at the same time,
+ * so the hash bucket lock is contended by the wakers.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+struct waker {
+	pthread_t thread;
+	unsigned int nwoken;
+	struct timeval runtime;
+};
+
+static unsigned int nthreads;
+static unsigned int nwakers = 2;
+static unsigned int repeat = 10;
+static bool fshared;
+
+static u_int32_t futex1;
+static int futex_flag;
+
+static pthread_t *blocked;
+static struct waker *waker;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of cpus)"),
+	OPT_UINTEGER('w', "nwakers", &nwakers,
+		     "Specify amount of waking threads"),
+	OPT_UINTEGER('r', "repeat", &repeat,
+		     "Specify amount of times to repeat the run"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use a shared futex instead of a private one"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_parallel_usage[] = {
+	"perf bench futex wake-parallel <options>",
+	NULL
+};
+
+/* Wait until every thread created so far has checked in, then go */
+static void start_threads(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void check_in(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *blocked_workerfn(void *arg __used)
+{
+	check_in();
+
+	while (1) {
+		/* only a wakeup (ret 0) makes us leave */
+		if (!futex_wait(&futex1, 0, NULL, futex_flag))
+			break;
+	}
+
+	return NULL;
+}
+
+static void *waking_workerfn(void *arg)
+{
+	struct waker *w = arg;
+	unsigned int nwakes = nthreads / nwakers;
+	struct timeval start, end;
+	int ret;
+
+	/* the first waker picks up the remainder */
+	if (w == waker)
+		nwakes += nthreads % nwakers;
+
+	check_in();
+
+	gettimeofday(&start, NULL);
+	ret = futex_wake(&futex1, nwakes, futex_flag);
+	gettimeofday(&end, NULL);
+
+	w->nwoken = ret > 0 ? ret : 0;
+	timersub(&end, &start, &w->runtime);
+
+	return NULL;
+}
+
+int bench_futex_wake_parallel(int argc, const char **argv,
+			      const char *prefix __used)
+{
+	struct stats waketime_stats;
+	unsigned int i, j, nwoken;
+	double avg, stddev;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_wake_parallel_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_wake_parallel_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nwakers)
+		nwakers = 1;
+	if (nwakers > nthreads)
+		nwakers = nthreads;
+	if (!repeat)
+		repeat = 1;
+	futex_flag = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	blocked = calloc(nthreads, sizeof(*blocked));
+	waker = calloc(nwakers, sizeof(*waker));
+	if (!blocked || !waker)
+		die("calloc");
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+	init_stats(&waketime_stats);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %u waking threads, %u threads blocked on a %s futex\n\n",
+		       nwakers, nthreads, fshared ? "shared" : "private");
+
+	for (j = 0; j < repeat; j++) {
+		threads_starting = nthreads;
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&blocked[i], NULL,
+					   blocked_workerfn, NULL))
+				die("pthread_create");
+		}
+		start_threads();
+
+		/* make sure all threads are actually blocked on the futex */
+		usleep(100000);
+
+		threads_starting = nwakers;
+		for (i = 0; i < nwakers; i++) {
+			if (pthread_create(&waker[i].thread, NULL,
+					   waking_workerfn, &waker[i]))
+				die("pthread_create");
+		}
+		start_threads();
+
+		nwoken = 0;
+		for (i = 0; i < nwakers; i++) {
+			if (pthread_join(waker[i].thread, NULL))
+				die("pthread_join");
+			nwoken += waker[i].nwoken;
+			update_stats(&waketime_stats,
+				     waker[i].runtime.tv_sec * 1000000ULL +
+				     waker[i].runtime.tv_usec);
+		}
+
+		if (nwoken != nthreads)
+			fprintf(stderr, "[Run %u]: only %u of %u threads woken\n",
+				j + 1, nwoken, nthreads);
+
+		/* wake up whoever was missed and reap everybody */
+		while (nwoken < nthreads) {
+			int ret = futex_wake(&futex1, nthreads, futex_flag);
+
+			if (ret > 0)
+				nwoken += ret;
+		}
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_join(blocked[i], NULL))
+				die("pthread_join");
+		}
+	}
+
+	avg = avg_stats(&waketime_stats);
+	stddev = stddev_stats(&waketime_stats);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14s: %.4f ms (+- %.2f%%)\n", "Avg per waker",
+		       avg / 1000.0, rel_stddev_stats(stddev, avg));
+		printf(" %14.4f usecs/thread\n", avg * nwakers / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		/* usecs per waker, relative stddev in % */
+		printf("%.3f %.2f\n", avg, rel_stddev_stats(stddev, avg));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(waker);
+	free(blocked);
+
+	return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ *
+ * futex-wake.c
+ *
+ * wake: Measure the cost of waking up tasks blocked on a futex
+ *
+ * A set of threads blocks on a single futex, then the main thread wakes
+ * them nwakes at a time and the time taken to wake all of them is
+ * measured. This is repeated several times to get an average.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned int nthreads;
+static unsigned int nwakes = 1;
+static unsigned int repeat = 10;
+static bool fshared;
+
+static u_int32_t futex1;
+static int futex_flag;
+
+static pthread_t *worker;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of cpus)"),
+	OPT_UINTEGER('w', "nwakes", &nwakes,
+		     "Specify amount of threads to wake at once"),
+	OPT_UINTEGER('r', "repeat", &repeat,
+		     "Specify amount of times to repeat the run"),
+	OPT_BOOLEAN('S', "shared", &fshared,
+		    "Use a shared futex instead of a private one"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wake_usage[] = {
+	"perf bench futex wake <options>",
+	NULL
+};
+
+static void *workerfn(void *arg __used)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	while (1) {
+		/* only a wakeup (ret 0) makes us leave */
+		if (!futex_wait(&futex1, 0, NULL, futex_flag))
+			break;
+	}
+
+	return NULL;
+}
+
+static void block_threads(void)
+{
+	unsigned int i;
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&worker[i], NULL, workerfn, NULL))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	/* make sure all threads are actually blocked on the futex */
+	usleep(100000);
+}
+
+int bench_futex_wake(int argc, const char **argv,
+		     const char *prefix __used)
+{
+	struct timeval start, end, runtime;
+	struct stats waketime_stats;
+	unsigned int i, j, nwoken;
+	double avg, stddev;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_wake_usage, 0);
+	if (argc) {
+		usage_with_options(bench_futex_wake_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!nwakes)
+		nwakes = 1;
+	if (!repeat)
+		repeat = 1;
+	futex_flag = fshared ? 0 : FUTEX_PRIVATE_FLAG;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	if (!worker)
+		die("calloc");
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+	init_stats(&waketime_stats);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Waking %u threads blocked on a %s futex, %u at a time\n\n",
+		       nthreads, fshared ? "shared" : "private", nwakes);
+
+	for (j = 0; j < repeat; j++) {
+		block_threads();
+
+		nwoken = 0;
+		gettimeofday(&start, NULL);
+		while (nwoken != nthreads) {
+			int ret = futex_wake(&futex1, nwakes, futex_flag);
+
+			if (ret > 0)
+				nwoken += ret;
+		}
+		gettimeofday(&end, NULL);
+		timersub(&end, &start, &runtime);
+
+		update_stats(&waketime_stats, runtime.tv_sec * 1000000ULL +
+			     runtime.tv_usec);
+
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf(" [Run %u]: woke %u threads in %.4f ms\n",
+			       j + 1, nwoken, runtime.tv_usec / 1000.0 +
+			       runtime.tv_sec * 1000.0);
+
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_join(worker[i], NULL))
+				die("pthread_join");
+		}
+	}
+
+	avg = avg_stats(&waketime_stats);
+	stddev = stddev_stats(&waketime_stats);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("\n %14s: %.4f ms (+- %.2f%%)\n", "Average wakeup",
+		       avg / 1000.0, rel_stddev_stats(stddev, avg));
+		printf(" %14.4f usecs/thread\n", avg / nthreads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		/* usecs to wake all threads, relative stddev in % */
+		printf("%.3f %.2f\n", avg, rel_stddev_stats(stddev, avg));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(worker);
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+/*
+ *
+ * net-conntrack.c
+ *
+ * conntrack: Churn of short UDP flows through connection tracking
+ *
+ * Every sender thread sends datagrams over the loopback interface to its
+ * own receiver thread, picking a different source address in 127.0.0.0/8
+ * for each one (with IP_PKTINFO) until --flows addresses have been used,
+ * and then starting over. Each address is a flow of its own for
+ * connection tracking, so with more flows than nf_conntrack_max every
+ * datagram creates a conntrack and forces an early drop of another one,
+ * the way a busy tethering gateway sees it. With iptable_nat loaded every
+ * new flow also goes through the NAT setup, add a SNAT or MASQUERADE rule
+ * to make it a real mapping.
+ *
+ * Besides the packet rate, the insert, early drop and drop counters of
+ * /proc/net/stat/nf_conntrack are shown per second.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CT_STAT		"/proc/net/stat/nf_conntrack"
+#define CT_COUNT	"/proc/sys/net/netfilter/nf_conntrack_count"
+
+static unsigned int nthreads;
+static unsigned int nsecs = 10;
+static unsigned int nflows = 65536;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct churner {
+	pthread_t sender, receiver;
+	unsigned int id;
+	int tx_fd, rx_fd;
+	struct sockaddr_in dst;
+	unsigned long sent, received;
+};
+
+/* the counters of /proc/net/stat/nf_conntrack we report, summed over cpus */
+enum {
+	CT_NEW,
+	CT_INSERT,
+	CT_INSERT_FAILED,
+	CT_DROP,
+	CT_EARLY_DROP,
+	CT_NR_STATS,
+};
+
+static const char * const ct_stat_names[CT_NR_STATS] = {
+	[CT_NEW]		= "new",
+	[CT_INSERT]		= "insert",
+	[CT_INSERT_FAILED]	= "insert_failed",
+	[CT_DROP]		= "drop",
+	[CT_EARLY_DROP]		= "early_drop",
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of sender/receiver pairs (default: number of cpus)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('f', "flows", &nflows,
+		     "Specify number of distinct flows per sender"),
+	OPT_END()
+};
+
+static const char * const bench_net_conntrack_usage[] = {
+	"perf bench net conntrack <options>",
+	NULL
+};
+
+static void wait_for_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+/*
+ * Sum up the columns of the per cpu statistics. Returns -1 if conntrack
+ * is not there.
+ */
+static int read_ct_stats(unsigned long long *stats)
+{
+	char line[1024], *tok, *save;
+	int col[CT_NR_STATS];
+	int i, n;
+	FILE *f;
+
+	memset(stats, 0, sizeof(*stats) * CT_NR_STATS);
+
+	f = fopen(CT_STAT, "r");
+	if (!f)
+		return -1;
+
+	/* the first line names the columns */
+	if (!fgets(line, sizeof(line), f)) {
+		fclose(f);
+		return -1;
+	}
+	for (i = 0; i < CT_NR_STATS; i++)
+		col[i] = -1;
+	for (n = 0, tok = strtok_r(line, " \n", &save); tok;
+	     n++, tok = strtok_r(NULL, " \n", &save)) {
+		for (i = 0; i < CT_NR_STATS; i++)
+			if (!strcmp(tok, ct_stat_names[i]))
+				col[i] = n;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		for (n = 0, tok = strtok_r(line, " \n", &save); tok;
+		     n++, tok = strtok_r(NULL, " \n", &save)) {
+			for (i = 0; i < CT_NR_STATS; i++)
+				if (col[i] == n)
+					stats[i] += strtoull(tok, NULL, 16);
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static long read_ct_count(void)
+{
+	long count = -1;
+	FILE *f;
+
+	f = fopen(CT_COUNT, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%ld", &count) != 1)
+		count = -1;
+	fclose(f);
+	return count;
+}
+
+static void *senderfn(void *arg)
+{
+	struct churner *c = arg;
+	char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+	struct in_pktinfo *info;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char payload[32];
+	unsigned int flow = 0;
+
+	memset(payload, 0, sizeof(payload));
+	iov.iov_base = payload;
+	iov.iov_len = sizeof(payload);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &c->dst;
+	msg.msg_namelen = sizeof(c->dst);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = IPPROTO_IP;
+	cmsg->cmsg_type = IP_PKTINFO;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+	info = (struct in_pktinfo *)CMSG_DATA(cmsg);
+	memset(info, 0, sizeof(*info));
+
+	wait_for_start();
+
+	while (!done) {
+		/* 127.<sender>.<flow / 256>.<flow % 256> */
+		info->ipi_spec_dst.s_addr = htonl(0x7f000000 |
+						  (c->id + 1) << 16 | flow);
+		if (sendmsg(c->tx_fd, &msg, 0) == (ssize_t)sizeof(payload))
+			c->sent++;
+		else if (errno != ENOBUFS && errno != EAGAIN &&
+			 errno != EPERM && !done)
+			die("sendmsg");
+
+		if (++flow == nflows)
+			flow = 0;
+	}
+
+	return NULL;
+}
+
+static void *receiverfn(void *arg)
+{
+	struct churner *c = arg;
+	char buf[64];
+
+	wait_for_start();
+
+	while (!done) {
+		/* the receive timeout lets us notice the end of the run */
+		if (recv(c->rx_fd, buf, sizeof(buf), 0) >= 0)
+			c->received++;
+	}
+
+	return NULL;
+}
+
+static void setup_churner(struct churner *c, unsigned int id)
+{
+	socklen_t len = sizeof(c->dst);
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+
+	c->id = id;
+	c->rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	c->tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (c->rx_fd < 0 || c->tx_fd < 0)
+		die("socket");
+
+	memset(&c->dst, 0, sizeof(c->dst));
+	c->dst.sin_family = AF_INET;
+	c->dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	c->dst.sin_port = 0;
+	if (bind(c->rx_fd, (struct sockaddr *)&c->dst, sizeof(c->dst)))
+		die("bind");
+	if (getsockname(c->rx_fd, (struct sockaddr *)&c->dst, &len))
+		die("getsockname");
+	if (setsockopt(c->rx_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		die("setsockopt");
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_net_conntrack(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct churner *churner;
+	struct timeval start, stop, diff;
+	unsigned long long sent = 0, received = 0, result_usec;
+	unsigned long long before[CT_NR_STATS], after[CT_NR_STATS];
+	bool have_stats;
+	long count;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_conntrack_usage, 0);
+	/* the flow number has to fit into the lower 16 bits of the address */
+	if (argc || !nflows || nflows > 65536) {
+		usage_with_options(bench_net_conntrack_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	/* and the sender into the second byte */
+	if (nthreads > 254) {
+		usage_with_options(bench_net_conntrack_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	churner = calloc(nthreads, sizeof(*churner));
+	if (!churner)
+		die("calloc");
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads * 2;
+	for (i = 0; i < nthreads; i++) {
+		setup_churner(&churner[i], i);
+		if (pthread_create(&churner[i].receiver, NULL, receiverfn,
+				   &churner[i]))
+			die("pthread_create");
+		if (pthread_create(&churner[i].sender, NULL, senderfn,
+				   &churner[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+
+	have_stats = !read_ct_stats(before);
+	gettimeofday(&start, NULL);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(churner[i].sender, NULL))
+			die("pthread_join");
+	}
+	gettimeofday(&stop, NULL);
+	if (have_stats)
+		have_stats = !read_ct_stats(after);
+	count = read_ct_count();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(churner[i].receiver, NULL))
+			die("pthread_join");
+	}
+
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	for (i = 0; i < nthreads; i++) {
+		sent += churner[i].sent;
+		received += churner[i].received;
+		close(churner[i].tx_fd);
+		close(churner[i].rx_fd);
+	}
+
+	for (i = 0; i < CT_NR_STATS; i++)
+		after[i] = have_stats ? (after[i] - before[i]) * 1000000ULL /
+			result_usec : 0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u senders, %u flows each\n\n", nthreads, nflows);
+
+		printf(" %14s: %llu.%03llu [sec]\n\n", "Total time",
+		       result_usec / 1000000, (result_usec % 1000000) / 1000);
+
+		printf(" %14llu packets/sec sent\n",
+		       sent * 1000000ULL / result_usec);
+		printf(" %14llu packets/sec received\n",
+		       received * 1000000ULL / result_usec);
+		if (!have_stats) {
+			printf("\n # no %s, is conntrack loaded?\n", CT_STAT);
+			break;
+		}
+		printf(" %14llu new conntracks/sec\n", after[CT_NEW]);
+		printf(" %14llu inserts/sec\n", after[CT_INSERT]);
+		printf(" %14llu failed inserts/sec\n", after[CT_INSERT_FAILED]);
+		printf(" %14llu early drops/sec\n", after[CT_EARLY_DROP]);
+		printf(" %14llu drops/sec\n", after[CT_DROP]);
+		if (count >= 0)
+			printf(" %14ld conntracks at the end\n", count);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu %llu %llu\n", sent * 1000000ULL / result_usec,
+		       after[CT_NEW], after[CT_EARLY_DROP]);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(churner);
+
+	return 0;
+}
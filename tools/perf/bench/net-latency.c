@@ -0,0 +1,489 @@
+/*
+ *
+ * net-latency.c
+ *
+ * latency: Round trip time of a sparse flow behind bulk TCP streams
+ *
+ * A probe thread bounces small UDP datagrams off a peer at a fixed
+ * interval, first on an idle path and then while a number of TCP
+ * streams push as much data as they can to the same peer. Whatever
+ * queue builds up in front of the bottleneck shows up as additional
+ * round trip time of the probes, which is what an interactive flow
+ * (DNS, VoIP, ssh) sees behind an upload.
+ *
+ * The peer is the same program started with --server. Without an
+ * address the server runs in process on the loopback interface, which
+ * has no queue to speak of; to compare queueing disciplines put the
+ * peer behind a rate limited veth pair, see the perf-bench
+ * documentation for a netem based setup.
+ *
+ * How often TCP held the streams back on the sending side, because of
+ * net.ipv4.tcp_limit_output_bytes or net.ipv4.tcp_pacing, is taken from
+ * the TcpExt counters of /proc/net/netstat.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NETSTAT		"/proc/net/netstat"
+
+static const char *addr_str;
+static unsigned int port = 9001;
+static unsigned int nthreads = 4;
+static unsigned int nsecs = 10;
+static unsigned int idle_secs = 2;
+static unsigned int interval = 10;
+static bool server;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct stream {
+	pthread_t thread;
+	int fd;
+	unsigned long long bytes;
+};
+
+struct probe {
+	unsigned int seq;
+	struct timeval sent;
+};
+
+struct rtt_stats {
+	unsigned int probes, lost;
+	unsigned long min, avg, p99, max;	/* usecs */
+};
+
+/* the TcpExt counters of /proc/net/netstat we report */
+enum {
+	TCP_TSQ_THROTTLE,
+	TCP_PACING_DEFER,
+	TCP_NR_STATS,
+};
+
+static const char * const tcp_stat_names[TCP_NR_STATS] = {
+	[TCP_TSQ_THROTTLE]	= "TCPSmallQueueThrottle",
+	[TCP_PACING_DEFER]	= "TCPPacingDefer",
+};
+
+static const struct option options[] = {
+	OPT_STRING('a', "addr", &addr_str, "addr",
+		   "Specify IPv4 address of the server (default: in process on loopback)"),
+	OPT_UINTEGER('p', "port", &port,
+		     "Specify TCP and UDP port of the server"),
+	OPT_BOOLEAN('S', "server", &server,
+		    "Run as server, sinking the streams and echoing the probes"),
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of bulk TCP streams"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime under load (in seconds)"),
+	OPT_UINTEGER('I', "idle", &idle_secs,
+		     "Specify runtime without load (in seconds)"),
+	OPT_UINTEGER('i', "interval", &interval,
+		     "Specify interval between probes (in msecs)"),
+	OPT_END()
+};
+
+static const char * const bench_net_latency_usage[] = {
+	"perf bench net latency <options>",
+	NULL
+};
+
+static void wait_for_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static unsigned long tv_usecs(const struct timeval *tv)
+{
+	return tv->tv_sec * 1000000UL + tv->tv_usec;
+}
+
+/*
+ * Fill in the TcpExt counters we know about. Returns -1 if the kernel
+ * has none of them.
+ */
+static int read_tcp_stats(unsigned long long *stats)
+{
+	char names[8192], values[8192], *tok, *val, *save, *vsave;
+	int i, found = 0;
+	FILE *f;
+
+	memset(stats, 0, sizeof(*stats) * TCP_NR_STATS);
+
+	f = fopen(NETSTAT, "r");
+	if (!f)
+		return -1;
+
+	/* a line of names is followed by a line of values */
+	while (fgets(names, sizeof(names), f) &&
+	       fgets(values, sizeof(values), f)) {
+		if (strncmp(names, "TcpExt:", 7))
+			continue;
+		for (tok = strtok_r(names, " \n", &save),
+		     val = strtok_r(values, " \n", &vsave); tok && val;
+		     tok = strtok_r(NULL, " \n", &save),
+		     val = strtok_r(NULL, " \n", &vsave)) {
+			for (i = 0; i < TCP_NR_STATS; i++) {
+				if (strcmp(tok, tcp_stat_names[i]))
+					continue;
+				stats[i] = strtoull(val, NULL, 10);
+				found++;
+			}
+		}
+	}
+
+	fclose(f);
+	return found ? 0 : -1;
+}
+
+static void *sinkfn(void *arg)
+{
+	int fd = (long)arg;
+	char buf[65536];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+	return NULL;
+}
+
+static void *acceptfn(void *arg)
+{
+	int lfd = (long)arg, fd;
+	pthread_t thread;
+
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			die("accept");
+		}
+		if (pthread_create(&thread, NULL, sinkfn, (void *)(long)fd))
+			die("pthread_create");
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+static void *echofn(void *arg)
+{
+	int fd = (long)arg;
+	struct sockaddr_in from;
+	socklen_t len;
+	char buf[512];
+	ssize_t n;
+
+	for (;;) {
+		len = sizeof(from);
+		n = recvfrom(fd, buf, sizeof(buf), 0,
+			     (struct sockaddr *)&from, &len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die("recvfrom");
+		}
+		sendto(fd, buf, n, 0, (struct sockaddr *)&from, len);
+	}
+	return NULL;
+}
+
+/* start the sink and the echo threads, they run until the process exits */
+static void start_server(struct sockaddr_in *addr)
+{
+	pthread_t thread;
+	int lfd, ufd, one = 1;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	ufd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (lfd < 0 || ufd < 0)
+		die("socket");
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lfd, (struct sockaddr *)addr, sizeof(*addr)) ||
+	    bind(ufd, (struct sockaddr *)addr, sizeof(*addr)))
+		die("bind");
+	if (listen(lfd, 128))
+		die("listen");
+
+	if (pthread_create(&thread, NULL, acceptfn, (void *)(long)lfd) ||
+	    pthread_create(&thread, NULL, echofn, (void *)(long)ufd))
+		die("pthread_create");
+}
+
+static void *streamfn(void *arg)
+{
+	struct stream *s = arg;
+	char buf[65536];
+	ssize_t n;
+
+	memset(buf, 0, sizeof(buf));
+
+	wait_for_start();
+
+	while (!done) {
+		n = write(s->fd, buf, sizeof(buf));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die("write");
+		}
+		s->bytes += n;
+	}
+
+	close(s->fd);
+	return NULL;
+}
+
+static int compare_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Send one probe every interval for secs seconds (or until done is set
+ * when secs is 0) and fill in st. A reply that does not arrive within
+ * a second counts as lost; late replies to earlier probes are skipped.
+ */
+static void run_probes(int fd, unsigned int secs, unsigned long *rtt,
+		       unsigned int max_probes, struct rtt_stats *st)
+{
+	struct timeval start, now;
+	struct probe p, reply;
+	unsigned long long sum = 0;
+	unsigned int n = 0, seq = 0;
+	ssize_t len;
+
+	memset(st, 0, sizeof(*st));
+	gettimeofday(&start, NULL);
+
+	while (!done && st->probes < max_probes) {
+		gettimeofday(&now, NULL);
+		if (secs && tv_usecs(&now) - tv_usecs(&start) >=
+		    secs * 1000000UL)
+			break;
+
+		p.seq = ++seq;
+		p.sent = now;
+		st->probes++;
+		if (send(fd, &p, sizeof(p), 0) != sizeof(p)) {
+			st->lost++;
+			goto next;
+		}
+
+		for (;;) {
+			len = recv(fd, &reply, sizeof(reply), 0);
+			if (len < 0) {
+				if (errno != EINTR) {
+					st->lost++;
+					break;
+				}
+				if (!done)
+					continue;
+				/* the run ended while we were waiting */
+				st->probes--;
+				break;
+			}
+			if (len != sizeof(reply) || reply.seq != p.seq)
+				continue;
+			gettimeofday(&now, NULL);
+			rtt[n] = tv_usecs(&now) - tv_usecs(&p.sent);
+			sum += rtt[n++];
+			break;
+		}
+next:
+		usleep(interval * 1000);
+	}
+
+	if (!n)
+		return;
+
+	qsort(rtt, n, sizeof(*rtt), compare_ulong);
+	st->min = rtt[0];
+	st->max = rtt[n - 1];
+	st->p99 = rtt[(n - 1) * 99 / 100];
+	st->avg = sum / n;
+}
+
+static void print_rtt(const char *name, struct rtt_stats *st)
+{
+	printf(" %8s: %6u probes %6u lost, rtt min/avg/p99/max "
+	       "%lu.%03lu/%lu.%03lu/%lu.%03lu/%lu.%03lu ms\n",
+	       name, st->probes, st->lost,
+	       st->min / 1000, st->min % 1000, st->avg / 1000, st->avg % 1000,
+	       st->p99 / 1000, st->p99 % 1000, st->max / 1000, st->max % 1000);
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_net_latency(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	struct sockaddr_in addr;
+	struct stream *stream;
+	struct rtt_stats idle, loaded;
+	unsigned long long tcp_start[TCP_NR_STATS], tcp_stop[TCP_NR_STATS];
+	int have_tcp_stats;
+	struct timeval start, stop, diff, tv = { .tv_sec = 1, .tv_usec = 0 };
+	unsigned long long bytes = 0, result_usec;
+	unsigned long *rtt;
+	unsigned int i, max_probes;
+	int fd;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_latency_usage, 0);
+	if (argc || !port || port > 65535 || !interval) {
+		usage_with_options(bench_net_latency_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(server ? INADDR_ANY : INADDR_LOOPBACK);
+	if (addr_str && !inet_aton(addr_str, &addr.sin_addr)) {
+		usage_with_options(bench_net_latency_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (server) {
+		start_server(&addr);
+		if (bench_format == BENCH_FORMAT_DEFAULT)
+			printf("# Serving on %s:%u, interrupt to stop\n",
+			       inet_ntoa(addr.sin_addr), port);
+		for (;;)
+			pause();
+	}
+	if (!addr_str)
+		start_server(&addr);
+
+	max_probes = ((idle_secs > nsecs ? idle_secs : nsecs) * 1000) /
+		     interval + 1;
+	rtt = calloc(max_probes, sizeof(*rtt));
+	stream = calloc(nthreads, sizeof(*stream));
+	if (!rtt || !stream)
+		die("calloc");
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		die("connect");
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		die("setsockopt");
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	run_probes(fd, idle_secs, rtt, max_probes, &idle);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		stream[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (stream[i].fd < 0)
+			die("socket");
+		if (connect(stream[i].fd, (struct sockaddr *)&addr,
+			    sizeof(addr)))
+			die("connect");
+		if (pthread_create(&stream[i].thread, NULL, streamfn,
+				   &stream[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	have_tcp_stats = !read_tcp_stats(tcp_start);
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+
+	/* let the streams fill the queue before the first probe */
+	usleep(500000);
+	run_probes(fd, 0, rtt, max_probes, &loaded);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(stream[i].thread, NULL))
+			die("pthread_join");
+		bytes += stream[i].bytes;
+	}
+	gettimeofday(&stop, NULL);
+	if (have_tcp_stats && read_tcp_stats(tcp_stop))
+		have_tcp_stats = 0;
+	close(fd);
+
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u TCP streams to %s:%u, one probe every %u ms\n\n",
+		       nthreads, inet_ntoa(addr.sin_addr), port, interval);
+		print_rtt("idle", &idle);
+		print_rtt("loaded", &loaded);
+		printf("\n %14llu Mbit/sec sent by the streams\n",
+		       bytes * 8 / result_usec);
+		if (!have_tcp_stats)
+			break;
+		for (i = 0; i < TCP_NR_STATS; i++)
+			printf(" %14llu %s/sec\n",
+			       (tcp_stop[i] - tcp_start[i]) * 1000000ULL /
+			       result_usec, tcp_stat_names[i]);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu %lu %lu %lu %llu\n", idle.avg, idle.p99,
+		       loaded.avg, loaded.p99, bytes * 8 / result_usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(stream);
+	free(rtt);
+
+	return 0;
+}
@@ -0,0 +1,425 @@
+/*
+ *
+ * net-tpacket.c
+ *
+ * tpacket: Capture rate of an AF_PACKET receive ring
+ *
+ * Sender threads flood the loopback interface with small UDP datagrams
+ * while the main thread reads them back out of a PACKET_RX_RING bound
+ * to it, in either the frame based TPACKET_V2 or the block based
+ * TPACKET_V3 layout. With more than one reader, every reader thread has
+ * its own socket and ring and the sockets are put into a PACKET_FANOUT
+ * group. Needs CAP_NET_RAW.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+static unsigned int nthreads = 1;
+static unsigned int nsecs = 10;
+static unsigned int size = 64;
+static unsigned int version = 3;
+static unsigned int block_kb = 64;
+static unsigned int nblocks = 64;
+static unsigned int frame_size = 256;
+static unsigned int tmo_ms;
+static unsigned int nreaders = 1;
+static unsigned int fanout_type;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct reader {
+	pthread_t thread;
+	int fd;
+	char *ring;
+	size_t ring_size;
+	struct tpacket_req3 req;
+	unsigned long long packets, polls, blocks;
+	struct tpacket_stats_v3 st;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('V', "tpacket-version", &version,
+		     "Specify ring layout, 2 (frames) or 3 (blocks)"),
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of sender threads"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('s', "size", &size,
+		     "Specify UDP payload size (in bytes)"),
+	OPT_UINTEGER('b', "block-size", &block_kb,
+		     "Specify ring block size (in KB)"),
+	OPT_UINTEGER('n', "blocks", &nblocks,
+		     "Specify number of ring blocks"),
+	OPT_UINTEGER('f', "frame-size", &frame_size,
+		     "Specify frame size of a TPACKET_V2 ring (in bytes)"),
+	OPT_UINTEGER('T', "timeout", &tmo_ms,
+		     "Specify TPACKET_V3 block retire timeout (in msecs, 0: kernel default)"),
+	OPT_UINTEGER('R', "readers", &nreaders,
+		     "Specify amount of reader threads, more than one forms a fanout group"),
+	OPT_UINTEGER('F', "fanout", &fanout_type,
+		     "Specify fanout type, 0 (hash), 1 (round robin) or 2 (cpu)"),
+	OPT_END()
+};
+
+static const char * const bench_net_tpacket_usage[] = {
+	"perf bench net tpacket <options>",
+	NULL
+};
+
+static void wait_for_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *senderfn(void *arg __used)
+{
+	struct sockaddr_in addr;
+	char *buf;
+	int fd;
+
+	buf = calloc(1, size);
+	if (!buf)
+		die("calloc");
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+
+	/* nobody listens on the discard port, the capture is all we want */
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(9);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		die("connect");
+
+	wait_for_start();
+
+	while (!done) {
+		if (send(fd, buf, size, 0) < 0 && errno != ENOBUFS &&
+		    errno != EAGAIN && errno != ECONNREFUSED && !done)
+			die("send");
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int setup_ring(struct tpacket_req3 *req)
+{
+	/* any id will do, as long as all readers use the same one */
+	int fanout = (getpid() & 0xffff) | (fanout_type << 16);
+	struct sockaddr_ll ll;
+	int fd, val;
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd < 0)
+		die("AF_PACKET socket (needs CAP_NET_RAW)");
+
+	val = version == 3 ? TPACKET_V3 : TPACKET_V2;
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)))
+		die("PACKET_VERSION %u", version);
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_ALL);
+	ll.sll_ifindex = if_nametoindex("lo");
+	if (!ll.sll_ifindex)
+		die("if_nametoindex(lo)");
+	if (bind(fd, (struct sockaddr *)&ll, sizeof(ll)))
+		die("bind");
+
+	if (nreaders > 1 &&
+	    setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)))
+		die("PACKET_FANOUT");
+
+	memset(req, 0, sizeof(*req));
+	req->tp_block_size = block_kb * 1024;
+	req->tp_block_nr = nblocks;
+	req->tp_frame_size = frame_size;
+	req->tp_frame_nr = req->tp_block_size / frame_size * nblocks;
+	req->tp_retire_blk_tov = tmo_ms;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, req,
+		       version == 3 ? sizeof(*req) : sizeof(struct tpacket_req)))
+		die("PACKET_RX_RING");
+
+	return fd;
+}
+
+static void wait_ring(int fd, unsigned long long *polls)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLERR };
+
+	/* time out now and then, so that the end of the run is noticed */
+	poll(&pfd, 1, 100);
+	(*polls)++;
+}
+
+static unsigned long long read_v2(int fd, char *ring,
+				  struct tpacket_req3 *req,
+				  unsigned long long *polls)
+{
+	unsigned long long packets = 0;
+	struct tpacket2_hdr *h;
+	unsigned int i = 0;
+
+	while (!done) {
+		h = (void *)(ring + (size_t)i * req->tp_frame_size);
+		if (!(h->tp_status & TP_STATUS_USER)) {
+			wait_ring(fd, polls);
+			continue;
+		}
+		packets++;
+		__sync_synchronize();
+		h->tp_status = TP_STATUS_KERNEL;
+		i = (i + 1) % req->tp_frame_nr;
+	}
+	return packets;
+}
+
+static unsigned long long read_v3(int fd, char *ring,
+				  struct tpacket_req3 *req,
+				  unsigned long long *polls,
+				  unsigned long long *blocks)
+{
+	unsigned long long packets = 0;
+	struct tpacket_block_desc *pbd;
+	unsigned int i = 0;
+
+	while (!done) {
+		pbd = (void *)(ring + (size_t)i * req->tp_block_size);
+		if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER)) {
+			wait_ring(fd, polls);
+			continue;
+		}
+		/*
+		 * Walking the frames is what a real reader has to do, so
+		 * do it even though num_pkts alone would be enough here.
+		 */
+		{
+			struct tpacket3_hdr *ppd;
+			unsigned int n;
+
+			ppd = (void *)((char *)pbd +
+				       pbd->hdr.bh1.offset_to_first_pkt);
+			for (n = 0; n < pbd->hdr.bh1.num_pkts; n++) {
+				packets++;
+				ppd = (void *)((char *)ppd +
+					       ppd->tp_next_offset);
+			}
+		}
+		(*blocks)++;
+		__sync_synchronize();
+		pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		i = (i + 1) % req->tp_block_nr;
+	}
+	return packets;
+}
+
+static void *readerfn(void *arg)
+{
+	struct reader *r = arg;
+	socklen_t st_len = sizeof(r->st);
+
+	wait_for_start();
+
+	if (version == 3)
+		r->packets = read_v3(r->fd, r->ring, &r->req, &r->polls,
+				     &r->blocks);
+	else
+		r->packets = read_v2(r->fd, r->ring, &r->req, &r->polls);
+
+	if (getsockopt(r->fd, SOL_PACKET, PACKET_STATISTICS, &r->st, &st_len))
+		die("PACKET_STATISTICS");
+
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_net_tpacket(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t st_len;
+	struct reader *reader;
+	pthread_t *threads;
+	struct timeval start, stop, diff;
+	unsigned long long packets = 0, drops = 0, polls = 0, blocks = 0;
+	unsigned long long freezes = 0, result_usec;
+	struct reader *r;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_tpacket_usage, 0);
+	if (argc || (version != 2 && version != 3) || fanout_type > 2) {
+		usage_with_options(bench_net_tpacket_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = 1;
+	if (!nreaders)
+		nreaders = 1;
+	if (!size)
+		size = 1;
+
+	reader = calloc(nreaders, sizeof(*reader));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!reader || !threads)
+		die("calloc");
+
+	for (i = 0; i < nreaders; i++) {
+		r = &reader[i];
+		r->fd = setup_ring(&r->req);
+		r->ring_size = (size_t)r->req.tp_block_size * r->req.tp_block_nr;
+		r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, r->fd, 0);
+		if (r->ring == MAP_FAILED)
+			die("mmap");
+	}
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads + nreaders;
+	for (i = 0; i < nreaders; i++) {
+		if (pthread_create(&reader[i].thread, NULL, readerfn,
+				   &reader[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, senderfn, NULL))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+
+	/* forget whatever was captured while setting up */
+	for (i = 0; i < nreaders; i++) {
+		st_len = sizeof(st);
+		getsockopt(reader[i].fd, SOL_PACKET, PACKET_STATISTICS,
+			   &st, &st_len);
+	}
+
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+
+	for (i = 0; i < nreaders; i++) {
+		if (pthread_join(reader[i].thread, NULL))
+			die("pthread_join");
+	}
+	gettimeofday(&stop, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(threads[i], NULL))
+			die("pthread_join");
+	}
+
+	for (i = 0; i < nreaders; i++) {
+		r = &reader[i];
+		packets += r->packets;
+		drops += r->st.tp_drops;
+		polls += r->polls;
+		blocks += r->blocks;
+		freezes += r->st.tp_freeze_q_cnt;
+		munmap(r->ring, r->ring_size);
+		close(r->fd);
+	}
+
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u TPACKET_V%u ring(s) of %u x %u KB, %u sender threads, "
+		       "%u byte datagrams\n\n",
+		       nreaders, version, nblocks, block_kb, nthreads, size);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long) (diff.tv_usec / 1000));
+
+		printf(" %14llu packets/sec captured\n",
+		       packets * 1000000ULL / result_usec);
+		printf(" %14llu packets/sec dropped\n",
+		       drops * 1000000ULL / result_usec);
+		printf(" %14llu polls/sec\n",
+		       polls * 1000000ULL / result_usec);
+		if (version == 3) {
+			printf(" %14llu blocks/sec\n",
+			       blocks * 1000000ULL / result_usec);
+			printf(" %14llu queue freezes\n", freezes);
+		}
+		if (nreaders > 1) {
+			printf("\n");
+			for (i = 0; i < nreaders; i++)
+				printf(" reader %3u: %14llu packets/sec captured,"
+				       " %llu dropped\n", i,
+				       reader[i].packets * 1000000ULL / result_usec,
+				       (unsigned long long)reader[i].st.tp_drops);
+		}
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu %llu\n", packets * 1000000ULL / result_usec,
+		       drops * 1000000ULL / result_usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(threads);
+	free(reader);
+
+	return 0;
+}
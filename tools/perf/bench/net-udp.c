@@ -0,0 +1,327 @@
+/*
+ *
+ * net-udp.c
+ *
+ * udp: Flood of UDP datagrams over the loopback interface
+ *
+ * Every sender thread has its own receiver thread and socket pair, so
+ * the threads only share what the network stack shares: netfilter
+ * hooks, per interface accounting and the like. Run it once with and
+ * once without an iptables rule (e.g. an xt_qtaguid "owner" match in
+ * OUTPUT) to see what the rule costs per packet. With --tag the
+ * sockets are tagged through /proc/net/xt_qtaguid/ctrl first, so the
+ * tagged socket accounting path is taken as well.
+ *
+ * With --gso every send() hands the kernel a burst of datagrams and a
+ * UDP_SEGMENT size, so that they travel the stack as one buffer and are
+ * only cut apart right before the device. The CPU time of the whole run
+ * is divided by the number of datagrams to compare the cost per packet,
+ * e.g. for RTP sized (-s 172) and full sized (-s 1400) datagrams.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define QTAGUID_CTRL	"/proc/net/xt_qtaguid/ctrl"
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103
+#endif
+
+static unsigned int nthreads;
+static unsigned int nsecs = 10;
+static unsigned int size = 64;
+static unsigned int tag;
+static unsigned int gso_segs;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct pair {
+	pthread_t sender, receiver;
+	int tx_fd, rx_fd;
+	unsigned long sent, received;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of sender/receiver pairs (default: number of cpus)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_UINTEGER('s', "size", &size,
+		     "Specify UDP payload size (in bytes)"),
+	OPT_UINTEGER('T', "tag", &tag,
+		     "Tag the sockets with this xt_qtaguid accounting tag"),
+	OPT_UINTEGER('g', "gso", &gso_segs,
+		     "Send this many datagrams per send() with UDP_SEGMENT"),
+	OPT_END()
+};
+
+static const char * const bench_net_udp_usage[] = {
+	"perf bench net udp <options>",
+	NULL
+};
+
+static void wait_for_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void *senderfn(void *arg)
+{
+	struct pair *p = arg;
+	unsigned int burst = gso_segs ? gso_segs : 1;
+	size_t len = (size_t)size * burst;
+	char *buf;
+
+	buf = calloc(1, len);
+	if (!buf)
+		die("calloc");
+
+	wait_for_start();
+
+	while (!done) {
+		if (send(p->tx_fd, buf, len, 0) == (ssize_t)len)
+			p->sent += burst;
+		else if (errno != ENOBUFS && errno != EAGAIN && !done)
+			die("send");
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void *receiverfn(void *arg)
+{
+	struct pair *p = arg;
+	char *buf;
+
+	buf = malloc(size);
+	if (!buf)
+		die("malloc");
+
+	wait_for_start();
+
+	while (!done) {
+		/* the receive timeout lets us notice the end of the run */
+		if (recv(p->rx_fd, buf, size, 0) >= 0)
+			p->received++;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void tag_socket(int ctrl, int fd)
+{
+	char cmd[64];
+	int len;
+
+	/* the accounting tag lives in the upper 32 bits of the full tag */
+	len = snprintf(cmd, sizeof(cmd), "t %d %llu", fd,
+		       (unsigned long long)tag << 32);
+	/* the whole command has to arrive in a single write */
+	if (write(ctrl, cmd, len) != len)
+		die("tagging socket %d through %s", fd, QTAGUID_CTRL);
+}
+
+static void setup_pair(struct pair *p, int ctrl)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+
+	p->rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	p->tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (p->rx_fd < 0 || p->tx_fd < 0)
+		die("socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if (bind(p->rx_fd, (struct sockaddr *)&addr, sizeof(addr)))
+		die("bind");
+	if (getsockname(p->rx_fd, (struct sockaddr *)&addr, &len))
+		die("getsockname");
+	if (connect(p->tx_fd, (struct sockaddr *)&addr, sizeof(addr)))
+		die("connect");
+	if (setsockopt(p->rx_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		die("setsockopt");
+	if (gso_segs &&
+	    setsockopt(p->tx_fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)))
+		die("UDP_SEGMENT");
+
+	if (ctrl >= 0) {
+		tag_socket(ctrl, p->tx_fd);
+		tag_socket(ctrl, p->rx_fd);
+	}
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+int bench_net_udp(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct pair *pair;
+	struct timeval start, stop, diff;
+	struct rusage ru_start, ru_stop;
+	unsigned long long sent = 0, received = 0, result_usec, cpu_usec;
+	int ctrl = -1;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_udp_usage, 0);
+	if (argc) {
+		usage_with_options(bench_net_udp_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (!size)
+		size = 1;
+	/* the whole burst has to fit into one IPv4 datagram */
+	if ((unsigned long long)size * (gso_segs ? gso_segs : 1) > 65000) {
+		usage_with_options(bench_net_udp_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (tag) {
+		ctrl = open(QTAGUID_CTRL, O_WRONLY);
+		if (ctrl < 0)
+			die("opening %s", QTAGUID_CTRL);
+	}
+
+	pair = calloc(nthreads, sizeof(*pair));
+	if (!pair)
+		die("calloc");
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads * 2;
+	for (i = 0; i < nthreads; i++) {
+		setup_pair(&pair[i], ctrl);
+		if (pthread_create(&pair[i].receiver, NULL, receiverfn,
+				   &pair[i]))
+			die("pthread_create");
+		if (pthread_create(&pair[i].sender, NULL, senderfn, &pair[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	getrusage(RUSAGE_SELF, &ru_start);
+	alarm(nsecs);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(pair[i].sender, NULL))
+			die("pthread_join");
+	}
+	gettimeofday(&stop, NULL);
+	getrusage(RUSAGE_SELF, &ru_stop);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(pair[i].receiver, NULL))
+			die("pthread_join");
+	}
+
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	/* user and system time of all senders and receivers */
+	timersub(&ru_stop.ru_utime, &ru_start.ru_utime, &diff);
+	cpu_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	timersub(&ru_stop.ru_stime, &ru_start.ru_stime, &diff);
+	cpu_usec += diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	for (i = 0; i < nthreads; i++) {
+		sent += pair[i].sent;
+		received += pair[i].received;
+		close(pair[i].tx_fd);
+		close(pair[i].rx_fd);
+	}
+	if (ctrl >= 0)
+		close(ctrl);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u sender/receiver pairs, %u byte datagrams%s",
+		       nthreads, size, tag ? ", tagged sockets" : "");
+		if (gso_segs)
+			printf(", %u per send with UDP_SEGMENT", gso_segs);
+		printf("\n\n");
+
+		printf(" %14s: %llu.%03llu [sec]\n\n", "Total time",
+		       result_usec / 1000000, (result_usec % 1000000) / 1000);
+
+		printf(" %14llu packets/sec sent\n",
+		       sent * 1000000ULL / result_usec);
+		printf(" %14llu packets/sec received\n",
+		       received * 1000000ULL / result_usec);
+		printf(" %14llu Mbit/sec received\n",
+		       received * size * 8 / result_usec);
+		printf(" %14.3f usecs CPU per packet sent\n",
+		       sent ? (double)cpu_usec / sent : 0.0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%llu %llu\n", sent * 1000000ULL / result_usec,
+		       received * 1000000ULL / result_usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(pair);
+
+	return 0;
+}
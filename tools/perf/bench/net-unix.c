@@ -0,0 +1,310 @@
+/*
+ *
+ * net-unix.c
+ *
+ * unix: Throughput of an AF_UNIX stream socket pair
+ *
+ * One sender thread pushes messages into a socket pair as fast as one
+ * receiver thread takes them out, once for every message size from
+ * --min-size to --max-size, doubling each time. Either side can use
+ * splice() through a pipe instead of write()/read(), which moves pages
+ * into and out of the socket without copying them.
+ *
+ */
+
+/* splice() and vmsplice(), before perf.h pulls in the libc headers */
+#define _GNU_SOURCE 1
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ	1031
+#endif
+
+static unsigned int nsecs = 2;
+static unsigned int min_size = 4096;
+static unsigned int max_size = 1024 * 1024;
+static bool splice_send;
+static bool splice_recv;
+
+static volatile int done;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+
+struct peer {
+	pthread_t thread;
+	int fd;
+	int pipe[2];
+	unsigned int size;
+	unsigned long long bytes;
+};
+
+static const struct option options[] = {
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime per message size (in seconds)"),
+	OPT_UINTEGER('m', "min-size", &min_size,
+		     "Specify smallest message size (in bytes)"),
+	OPT_UINTEGER('M', "max-size", &max_size,
+		     "Specify largest message size (in bytes)"),
+	OPT_BOOLEAN('S', "splice-send", &splice_send,
+		    "Send through a pipe with vmsplice() and splice()"),
+	OPT_BOOLEAN('R', "splice-recv", &splice_recv,
+		    "Receive into a pipe with splice() and drain it to /dev/null"),
+	OPT_END()
+};
+
+static const char * const bench_net_unix_usage[] = {
+	"perf bench net unix <options>",
+	NULL
+};
+
+static void wait_for_start(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+}
+
+static void setup_pipe(struct peer *p)
+{
+	if (pipe(p->pipe))
+		die("pipe");
+	/* a whole message should fit, but the default is fine if it can't */
+	fcntl(p->pipe[1], F_SETPIPE_SZ, p->size);
+}
+
+/* move len bytes from the pipe to fd, returns 0 at end of file */
+static ssize_t drain_pipe(struct peer *p, int fd, size_t len)
+{
+	ssize_t n, total = 0;
+
+	while (len) {
+		n = splice(p->pipe[0], NULL, fd, NULL, len,
+			   SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n <= 0)
+			return n < 0 && total == 0 ? n : total;
+		total += n;
+		len -= n;
+	}
+	return total;
+}
+
+static void *senderfn(void *arg)
+{
+	struct peer *p = arg;
+	struct iovec iov;
+	size_t left;
+	ssize_t n;
+	char *buf;
+
+	buf = calloc(1, p->size);
+	if (!buf)
+		die("calloc");
+
+	wait_for_start();
+
+	while (!done) {
+		for (left = p->size; left; left -= n) {
+			if (!splice_send) {
+				n = write(p->fd, buf + p->size - left, left);
+			} else {
+				iov.iov_base = buf + p->size - left;
+				iov.iov_len = left;
+				n = vmsplice(p->pipe[1], &iov, 1, 0);
+				if (n > 0 && drain_pipe(p, p->fd, n) != n)
+					n = -1;
+			}
+			if (n < 0)
+				die("send");
+		}
+		p->bytes += p->size;
+	}
+
+	/* let the receiver see the end of the stream */
+	shutdown(p->fd, SHUT_WR);
+	free(buf);
+	return NULL;
+}
+
+static void *receiverfn(void *arg)
+{
+	struct peer *p = arg;
+	ssize_t n;
+	char *buf = NULL;
+	int null = -1;
+
+	if (splice_recv) {
+		null = open("/dev/null", O_WRONLY);
+		if (null < 0)
+			die("opening /dev/null");
+	} else {
+		buf = malloc(p->size);
+		if (!buf)
+			die("malloc");
+	}
+
+	wait_for_start();
+
+	for (;;) {
+		if (!splice_recv) {
+			n = read(p->fd, buf, p->size);
+		} else {
+			n = splice(p->fd, NULL, p->pipe[1], NULL, p->size,
+				   SPLICE_F_MOVE);
+			if (n > 0 && drain_pipe(p, null, n) != n)
+				n = -1;
+		}
+		if (n < 0)
+			die("receive");
+		if (!n)
+			break;
+		p->bytes += n;
+	}
+
+	if (null >= 0)
+		close(null);
+	free(buf);
+	return NULL;
+}
+
+static void toggle_done(int sig __used)
+{
+	done = 1;
+}
+
+static unsigned long long run_size(unsigned int size,
+				   unsigned long long *msgs)
+{
+	struct peer tx, rx;
+	struct timeval start, stop, diff;
+	unsigned long long result_usec;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		die("socketpair");
+
+	memset(&tx, 0, sizeof(tx));
+	memset(&rx, 0, sizeof(rx));
+	tx.fd = sv[0];
+	rx.fd = sv[1];
+	tx.size = rx.size = size;
+	if (splice_send)
+		setup_pipe(&tx);
+	if (splice_recv)
+		setup_pipe(&rx);
+
+	done = 0;
+	threads_starting = 2;
+	if (pthread_create(&rx.thread, NULL, receiverfn, &rx) ||
+	    pthread_create(&tx.thread, NULL, senderfn, &tx))
+		die("pthread_create");
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	gettimeofday(&start, NULL);
+	alarm(nsecs);
+
+	if (pthread_join(tx.thread, NULL) || pthread_join(rx.thread, NULL))
+		die("pthread_join");
+	gettimeofday(&stop, NULL);
+
+	close(sv[0]);
+	close(sv[1]);
+	if (splice_send) {
+		close(tx.pipe[0]);
+		close(tx.pipe[1]);
+	}
+	if (splice_recv) {
+		close(rx.pipe[0]);
+		close(rx.pipe[1]);
+	}
+
+	timersub(&stop, &start, &diff);
+	result_usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (!result_usec)
+		result_usec = 1;
+
+	*msgs = rx.bytes / size * 1000000ULL / result_usec;
+	return rx.bytes * 1000000ULL / result_usec;
+}
+
+int bench_net_unix(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	unsigned long long bytes, msgs;
+	unsigned int size;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_unix_usage, 0);
+	if (argc || !min_size || min_size > max_size) {
+		usage_with_options(bench_net_unix_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGINT, toggle_done);
+	signal(SIGALRM, toggle_done);
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# AF_UNIX stream, send with %s, receive with %s, "
+		       "%u sec per size\n\n",
+		       splice_send ? "splice" : "write",
+		       splice_recv ? "splice" : "read", nsecs);
+
+	for (size = min_size; size <= max_size; size *= 2) {
+		bytes = run_size(size, &msgs);
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf(" %8u bytes: %10llu MB/sec %10llu msgs/sec\n",
+			       size, bytes >> 20, msgs);
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%u %llu\n", size, bytes);
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+
+		/* do not loop forever once size wraps */
+		if (size > max_size / 2)
+			break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ *
+ * sched-wakeup.c
+ *
+ * wakeup: Measure wakeup latency at a fixed utilisation
+ *
+ * Every thread runs a periodic duty cycle: it burns cpu for util% of
+ * the period, then sleeps until the start of the next period with an
+ * absolute timer. The delay between the timer expiry and the thread
+ * actually running again is the wakeup latency, which includes the
+ * time spent waiting for a cpu while the other threads are busy.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+/* 1us resolution up to 10ms, anything later lands in the last slot */
+#define LAT_BUCKETS	10000
+
+struct worker {
+	pthread_t thread;
+	unsigned long *hist;
+	unsigned long long sum;
+	unsigned long samples;
+	unsigned long overruns;
+	unsigned long max;
+};
+
+static unsigned int nthreads;
+static unsigned int util = 50;
+static unsigned int period = 10000;
+static unsigned int nsecs = 5;
+
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static unsigned int threads_starting;
+static struct timespec start_ts;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads,
+		     "Specify amount of threads (default: number of cpus)"),
+	OPT_UINTEGER('u', "util", &util,
+		     "Specify the busy part of each period, in percent"),
+	OPT_UINTEGER('p', "period", &period,
+		     "Specify the period (in usecs)"),
+	OPT_UINTEGER('r', "runtime", &nsecs,
+		     "Specify runtime (in seconds)"),
+	OPT_END()
+};
+
+static const char * const bench_sched_wakeup_usage[] = {
+	"perf bench sched wakeup <options>",
+	NULL
+};
+
+static inline unsigned long long ts_to_ns(struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static inline void ns_to_ts(unsigned long long ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts_to_ns(&ts);
+}
+
+static void *workerfn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long period_ns = period * 1000ULL;
+	unsigned long long busy_ns = period_ns * util / 100;
+	unsigned long long next, end, now, lat;
+	struct timespec ts;
+
+	pthread_mutex_lock(&thread_lock);
+	if (!--threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	next = ts_to_ns(&start_ts);
+	end = next + nsecs * 1000000000ULL;
+
+	while (next < end) {
+		/* the busy part of the duty cycle */
+		while (now_ns() < next + busy_ns)
+			;
+
+		next += period_ns;
+		now = now_ns();
+		if (now >= next) {
+			/* we ran over, skip the periods we missed */
+			w->overruns += (now - next) / period_ns + 1;
+			next += ((now - next) / period_ns + 1) * period_ns;
+		}
+
+		ns_to_ts(next, &ts);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &ts, NULL) == EINTR)
+			;
+
+		lat = (now_ns() - next) / 1000;
+		w->hist[lat < LAT_BUCKETS ? lat : LAT_BUCKETS - 1]++;
+		w->sum += lat;
+		w->samples++;
+		if (lat > w->max)
+			w->max = lat;
+	}
+
+	return NULL;
+}
+
+/* Latency, in usecs, below which pct percent of the samples fall */
+static unsigned long percentile(unsigned long *hist, unsigned long samples,
+				unsigned int pct)
+{
+	unsigned long long target = (unsigned long long)samples * pct / 100;
+	unsigned long long seen = 0;
+	unsigned long i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > target)
+			break;
+	}
+
+	return i;
+}
+
+int bench_sched_wakeup(int argc, const char **argv,
+		       const char *prefix __used)
+{
+	struct worker *worker;
+	unsigned long *hist;
+	unsigned long long sum = 0;
+	unsigned long samples = 0, overruns = 0, max = 0;
+	unsigned long p50, p90, p99;
+	unsigned int i, j;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_wakeup_usage, 0);
+	if (argc) {
+		usage_with_options(bench_sched_wakeup_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (util > 100)
+		util = 100;
+	if (!period)
+		period = 1;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	hist = calloc(LAT_BUCKETS, sizeof(*hist));
+	if (!worker || !hist)
+		die("calloc");
+
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	threads_starting = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		worker[i].hist = calloc(LAT_BUCKETS, sizeof(*worker[i].hist));
+		if (!worker[i].hist)
+			die("calloc");
+		if (pthread_create(&worker[i].thread, NULL, workerfn,
+				   &worker[i]))
+			die("pthread_create");
+	}
+
+	pthread_mutex_lock(&thread_lock);
+	while (threads_starting)
+		pthread_cond_wait(&thread_parent, &thread_lock);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	pthread_cond_broadcast(&thread_worker);
+	pthread_mutex_unlock(&thread_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_join(worker[i].thread, NULL))
+			die("pthread_join");
+
+		for (j = 0; j < LAT_BUCKETS; j++)
+			hist[j] += worker[i].hist[j];
+		sum += worker[i].sum;
+		samples += worker[i].samples;
+		overruns += worker[i].overruns;
+		if (worker[i].max > max)
+			max = worker[i].max;
+		free(worker[i].hist);
+	}
+
+	p50 = percentile(hist, samples, 50);
+	p90 = percentile(hist, samples, 90);
+	p99 = percentile(hist, samples, 99);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u threads, %u%% busy out of every %u usecs, for %u secs\n\n",
+		       nthreads, util, period, nsecs);
+
+		printf(" %14lu wakeups, %lu missed periods\n\n",
+		       samples, overruns);
+		printf(" %14s: %.2f usecs\n", "Average",
+		       samples ? (double)sum / samples : 0.0);
+		printf(" %14s: %lu usecs\n", "50th", p50);
+		printf(" %14s: %lu usecs\n", "90th", p90);
+		printf(" %14s: %lu usecs\n", "99th", p99);
+		printf(" %14s: %lu usecs\n", "Max", max);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		/* avg p50 p90 p99 max (usecs) wakeups missed-periods */
+		printf("%.2f %lu %lu %lu %lu %lu %lu\n",
+		       samples ? (double)sum / samples : 0.0,
+		       p50, p90, p99, max, samples, overruns);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	free(hist);
+	free(worker);
+
+	return 0;
+}
@@ -13,6 +13,8 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  futex ... futex performance
+ *  net   ... network stack performance
  *
  */
 
@@ -42,6 +44,9 @@ static struct bench_suite sched_suites[] = {
 	{ "pipe",
 	  "Flood of communication over pipe() between two processes",
 	  bench_sched_pipe      },
+	{ "wakeup",
+	  "Wakeup latency of periodic tasks at a fixed utilisation",
+	  bench_sched_wakeup    },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -58,6 +63,50 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite futex_suites[] = {
+	{ "hash",
+	  "Benchmark for futex hash table",
+	  bench_futex_hash },
+	{ "wake",
+	  "Benchmark for futex wake calls",
+	  bench_futex_wake },
+	{ "wake-parallel",
+	  "Benchmark for parallel futex wake calls",
+	  bench_futex_wake_parallel },
+	{ "requeue",
+	  "Benchmark for futex requeue calls",
+	  bench_futex_requeue },
+	{ "lock-pi",
+	  "Benchmark for futex lock_pi calls",
+	  bench_futex_lock_pi },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
+static struct bench_suite net_suites[] = {
+	{ "udp",
+	  "Flood of UDP datagrams over the loopback interface",
+	  bench_net_udp },
+	{ "tpacket",
+	  "Capture rate of an AF_PACKET receive ring",
+	  bench_net_tpacket },
+	{ "unix",
+	  "Throughput of an AF_UNIX stream socket pair",
+	  bench_net_unix },
+	{ "conntrack",
+	  "Churn of short UDP flows through connection tracking",
+	  bench_net_conntrack },
+	{ "latency",
+	  "Round trip time of a sparse flow behind bulk TCP streams",
+	  bench_net_latency },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +120,12 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "futex",
+	  "futex performance",
+	  futex_suites },
+	{ "net",
+	  "network stack performance",
+	  net_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },